@@ -1,6 +1,9 @@
 #pragma once
 #include "registers.hpp"
 
+#include <cstdio>
+#include <string>
+
 class Backend
 {
 public:
@@ -14,6 +17,41 @@ public:
 	virtual void print_help() const = 0;
 
 	virtual void emit(GIFBlock& block) = 0;
+
+	// Checked by the frontend once the input is done, for backends that
+	// judge the blocks themselves and want the run to fail
+	virtual bool failed() const
+	{
+		return false;
+	}
+
+	// Writes to a stream the caller owns rather than the output file, for compiling in memory
+	void set_output_stream(FILE* stream)
+	{
+		this->stream = stream;
+	}
+
+protected:
+	// Set by set_output_stream, never closed here
+	FILE* stream = nullptr;
+
+	// The output stream if one was given, otherwise path, or stdout when path is empty
+	FILE* open_output(const std::string& path, const char* mode) const
+	{
+		if(stream != nullptr)
+		{
+			return stream;
+		}
+		return path.empty() ? stdout : fopen(path.c_str(), mode);
+	}
+
+	void close_output(FILE* file) const
+	{
+		if(file != nullptr && file != stdout && file != stream)
+		{
+			fclose(file);
+		}
+	}
 };
 
 class DummyBackend : public Backend
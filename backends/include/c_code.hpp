@@ -1,6 +1,8 @@
 #pragma once
 
 #include "backend.hpp"
+#include "dedup.hpp"
+#include "encoder.hpp"
 
 #include <functional>
 #include <unordered_map>
@@ -18,6 +20,16 @@ class c_code_backend : public Backend
 		USE_MAGIC
 	};
 
+	enum class DmaMode
+	{
+		// Plain GIF packets
+		NONE,
+		// Every block is prefixed with an END DMAtag, making it its own chain
+		BLOCK,
+		// All blocks go into a single array joined by CNT DMAtags
+		CHAIN
+	};
+
 public:
 	c_code_backend() = default;
 	~c_code_backend();
@@ -33,10 +45,17 @@ public:
 
 	void emit(GIFBlock& block) override;
 
+	bool failed() const override
+	{
+		return too_large;
+	}
+
 	// Primitive dispatching
 	static std::string emit_primitive(c_code_backend*, const GifRegister&);
 	static std::string emit_rgbaq(c_code_backend*, const GifRegister&);
+	static std::string emit_st(c_code_backend*, const GifRegister&);
 	static std::string emit_uv(c_code_backend*, const GifRegister&);
+	static std::string emit_xyzf2(c_code_backend*, const GifRegister&);
 	static std::string emit_xyz2(c_code_backend*, const GifRegister&);
 	static std::string emit_tex0(c_code_backend*, const GifRegister&);
 	static std::string emit_fog(c_code_backend*, const GifRegister&);
@@ -46,11 +65,19 @@ public:
 	static std::string emit_finish(c_code_backend*, const GifRegister&);
 	static std::string emit_label(c_code_backend*, const GifRegister&);
 
+	std::string emit_dmatag(size_t qwc, uint64_t id) const;
+	// The patch table of a block, its offsets moved along by base qwords
+	std::string emit_patches(const std::string& name, const std::vector<Patch>& patches, size_t base);
+	// The transfer setup and IMAGE tags of a texture upload, prim_str goes in the first tag when not empty
+	std::string emit_upload(const TextureUpload& upload, const std::string& prim_str) const;
+
 	std::unordered_map<uint32_t, std::function<std::string(c_code_backend*, const GifRegister&)>> dispatch_table =
 		{
 			{0x00, c_code_backend::emit_primitive},
 			{0x01, c_code_backend::emit_rgbaq},
+			{0x02, c_code_backend::emit_st},
 			{0x03, c_code_backend::emit_uv},
+			{0x04, c_code_backend::emit_xyzf2},
 			{0x05, c_code_backend::emit_xyz2},
 			{0x06, c_code_backend::emit_tex0},
 			{0x0A, c_code_backend::emit_fog},
@@ -62,7 +89,20 @@ public:
 
 private:
 	EmitMode emit_mode = EmitMode::USE_DEFS;
+	DmaMode dma_mode = DmaMode::NONE;
+	std::string chain_name = "gifscript_chain";
+	size_t chain_qwc = 0;
+	// Written after the chain, the tables can't go inside of its array
+	std::string chain_patches;
+	// The gifscript_patch typedef is written once, before the first table
+	bool patch_type_emitted = false;
+	bool dedup_enabled = false;
+	// A block was over what one DMAtag can send
+	bool too_large = false;
+	block_dedup dedup;
 	std::string output = "";
 	FILE* file = nullptr;
 	bool first_emit = true;
+
+	void write(const std::string& buffer);
 };
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Content hash of the encoded blocks a backend has written so far.
+// Lets a backend write a payload once and alias any later identical blocks
+// to the first copy.
+class block_dedup
+{
+	struct Entry
+	{
+		std::string name;
+		std::vector<uint64_t> payload;
+	};
+
+public:
+	// Returns the name of the first block with an identical payload,
+	// or records this block as the first of its kind and returns nothing
+	std::optional<std::string> find_or_add(const std::string& name, std::span<const uint64_t> payload);
+
+	// Logs how many blocks and bytes were saved
+	void report() const;
+
+private:
+	std::unordered_multimap<uint64_t, Entry> seen;
+	size_t total_blocks = 0;
+	size_t total_bytes = 0;
+	size_t duplicate_blocks = 0;
+	size_t duplicate_bytes = 0;
+};
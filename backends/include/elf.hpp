@@ -0,0 +1,101 @@
+#pragma once
+
+#include "backend.hpp"
+#include "dedup.hpp"
+#include "encoder.hpp"
+
+#include <vector>
+
+// Writes a relocatable object that can be handed straight to the linker.
+// Every block becomes a 16 byte aligned `<name>_data` symbol in .rodata,
+// with its size in bytes stored in a u64 `<name>_data_size` symbol,
+// the same names the c_code backend declares.
+// In DMA chain mode the whole chain is also available as one symbol, with
+// the block symbols pointing at their GIF data inside of it.
+// A block with patch fields also gets a `<name>_patches` table and its
+// `<name>_patch_count`, the entries in the order the c_code backend lists them.
+// Their qwords count from the start of `<name>_data`, or from the start of
+// the chain symbol in DMA chain mode, as the c_code backend's do.
+class elf_backend : public Backend
+{
+	enum class Target
+	{
+		// 32bit little endian MIPS, for the EE toolchain
+		EE,
+		// 64bit x86, for tools and for inspecting the output on a PC
+		X86_64
+	};
+
+	enum class DmaMode
+	{
+		// Plain GIF packets
+		NONE,
+		// Every block is prefixed with an END DMAtag, making it its own chain
+		BLOCK,
+		// All blocks are joined by CNT DMAtags into one chain
+		CHAIN
+	};
+
+	struct Symbol
+	{
+		std::string name;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	// A block's patch fields, written out after all of the data
+	struct PatchTableData
+	{
+		std::string name;
+		std::vector<Patch> entries;
+		// Qwords in front of the GIF data, in the block's symbol or in the chain
+		uint32_t base;
+	};
+
+	// A 32bit absolute address of something in .rodata
+	struct Relocation
+	{
+		uint64_t offset;
+		uint64_t addend;
+	};
+
+public:
+	elf_backend() = default;
+	~elf_backend();
+
+	bool arg_parse(int argc, char** argv) override;
+
+	// Opens the output right away, the object is only written once every block is in
+	// but failed() is read before that
+	void set_output(const std::string_view& output) override;
+
+	void print_help() const override;
+
+	void emit(GIFBlock& block) override;
+
+	bool failed() const override
+	{
+		return too_large || (file == nullptr && stream == nullptr);
+	}
+
+private:
+	Target target = Target::EE;
+	// EF_MIPS_ARCH_3 | EF_MIPS_MACH_5900 | EF_MIPS_ABI2 (n32), what the current ps2dev toolchain emits
+	uint32_t ee_flags = 0x20920020;
+	DmaMode dma_mode = DmaMode::NONE;
+	std::string chain_name = "gifscript_chain";
+	std::string output = "";
+	// Opened by set_output, without one the output stream is written to
+	FILE* file = nullptr;
+	std::vector<uint8_t> rodata;
+	// The block data symbols, their _data_size counterparts are written after all of the data
+	std::vector<Symbol> blocks;
+	std::vector<Relocation> relocations;
+	std::vector<PatchTableData> patches;
+	bool dedup_enabled = false;
+	// A block was over what one DMAtag can send
+	bool too_large = false;
+	block_dedup dedup;
+
+	std::vector<uint8_t> write_object() const;
+};
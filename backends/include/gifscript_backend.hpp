@@ -1,6 +1,7 @@
 #pragma once
 
 #include "backend.hpp"
+#include "repeat_finder.hpp"
 
 #include <functional>
 #include <unordered_map>
@@ -26,7 +27,9 @@ public:
 	// Primitive dispatching
 	static std::string emit_primitive(gifscript_backend*, const GifRegister&);
 	static std::string emit_rgbaq(gifscript_backend*, const GifRegister&);
+	static std::string emit_st(gifscript_backend*, const GifRegister&);
 	static std::string emit_uv(gifscript_backend*, const GifRegister&);
+	static std::string emit_xyzf2(gifscript_backend*, const GifRegister&);
 	static std::string emit_xyz2(gifscript_backend*, const GifRegister&);
 	static std::string emit_tex0(gifscript_backend*, const GifRegister&);
 	static std::string emit_fog(gifscript_backend*, const GifRegister&);
@@ -40,7 +43,9 @@ public:
 		{
 			{0x00, gifscript_backend::emit_primitive},
 			{0x01, gifscript_backend::emit_rgbaq},
+			{0x02, gifscript_backend::emit_st},
 			{0x03, gifscript_backend::emit_uv},
+			{0x04, gifscript_backend::emit_xyzf2},
 			{0x05, gifscript_backend::emit_xyz2},
 			{0x06, gifscript_backend::emit_tex0},
 			{0x0A, gifscript_backend::emit_fog},
@@ -54,4 +59,23 @@ private:
 	std::string output = "";
 	FILE* file = nullptr;
 	bool first_emit = true;
+	// Find repeated register sequences and write them as macros, needs every block so output is deferred
+	bool extract_macros = false;
+	struct script_block
+	{
+		std::string name;
+		script_body body;
+		// Written as a repeat when the tag loops over the body, the tag PRIM goes ahead of it
+		uint32_t nloop = 1;
+		std::string prim;
+		// Comes after the body, nothing can follow it
+		std::string upload;
+	};
+	std::vector<script_block> blocks;
+	std::vector<std::string> macro_names;
+
+	script_block to_block(const GIFBlock& block);
+	std::string format_block(const script_block& block, const script_body& body) const;
+	std::string format_body(const script_body& body, std::string_view indent = "\t") const;
+	void write(const std::string& text);
 };
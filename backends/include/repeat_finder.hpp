@@ -0,0 +1,39 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <string>
+#include <vector>
+
+// One line of a block or macro body as the gifscript backend writes it
+struct script_entry
+{
+	enum class Kind
+	{
+		// Any register but XYZ2, compared by its printed text
+		LINE,
+		// XYZ2, the one register a macro insertion can offset
+		XYZ2,
+		// Insertion of an extracted macro
+		MACRO,
+		// A patch field, printed as text but never part of a macro
+		PATCH
+	};
+
+	Kind kind;
+	std::string text;
+	Vec3 xyz;
+	// MACRO only
+	size_t macro = 0;
+	bool has_offset = false;
+	Vec2 offset;
+};
+
+using script_body = std::vector<script_entry>;
+
+// Finds register sequences that repeat, within and across blocks, and
+// replaces every repeat with a macro insertion.
+// Repeats only need their XYZ2 positions to match relative to the first
+// XYZ2 of the sequence, the insertion offset moves them into place.
+// Returns the extracted macro bodies, MACRO entries index into them.
+[[nodiscard]] std::vector<script_body> extract_repeats(std::vector<script_body>& blocks);
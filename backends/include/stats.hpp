@@ -0,0 +1,44 @@
+#pragma once
+
+#include "backend.hpp"
+#include "cost.hpp"
+
+#include <optional>
+
+// Writes a JSON summary of what every block costs instead of any packet data.
+// With a budget set, blocks that go over it are reported and fail the run.
+class stats_backend : public Backend
+{
+public:
+	stats_backend() = default;
+	~stats_backend();
+
+	bool arg_parse(int argc, char** argv) override;
+
+	void set_output(const std::string_view& output) override
+	{
+		this->output = output;
+	};
+
+	void print_help() const override;
+
+	void emit(GIFBlock& block) override;
+
+	bool failed() const override
+	{
+		return over_budget;
+	}
+
+private:
+	std::string output = "";
+	// In estimated GS cycles
+	std::optional<uint64_t> budget;
+	bool over_budget = false;
+	// Blocks are written as they come in, only the running total is kept
+	FILE* file = nullptr;
+	bool first_emit = true;
+	BlockCost total;
+
+	std::string format_cost(const BlockCost& cost) const;
+	void write(const std::string& text);
+};
@@ -1,7 +1,12 @@
 #include "c_code.hpp"
 #include "registers.hpp"
 #include <fmt/core.h>
+#include <algorithm>
+#include <cstring>
 #include <functional>
+#include <vector>
+#include "encoder.hpp"
+#include "encoding.hpp"
 #include "logger.hpp"
 
 auto c_code_backend::arg_parse(int argc, char** argv) -> bool
@@ -20,6 +25,22 @@ auto c_code_backend::arg_parse(int argc, char** argv) -> bool
 			{
 				emit_mode = EmitMode::USE_MAGIC;
 			}
+			else if(arg2.compare("dedup") == 0)
+			{
+				dedup_enabled = true;
+			}
+			else if(arg2.compare("dma") == 0)
+			{
+				dma_mode = DmaMode::BLOCK;
+			}
+			else if(arg2.starts_with("dma-chain"))
+			{
+				dma_mode = DmaMode::CHAIN;
+				if(arg2.starts_with("dma-chain="))
+				{
+					chain_name = arg2.substr(10);
+				}
+			}
 			else if(arg2.compare("help") == 0)
 			{
 				print_help();
@@ -33,6 +54,11 @@ auto c_code_backend::arg_parse(int argc, char** argv) -> bool
 		}
 	}
 
+	if(dedup_enabled && dma_mode == DmaMode::CHAIN)
+	{
+		logger::warn("--bdedup does not apply to --bdma-chain in the c_code backend, the chain has to inline every block. The elf backend can REF the first copy instead\n");
+	}
+
 	return true;
 }
 
@@ -41,15 +67,39 @@ void c_code_backend::print_help() const
 	fmt::print(
 		"c_code backend options:\n"
 		"\t--bdefs\t\tUse the definitions for registers found in gs_gp.h and gif_tags.h (default)\n"
-		"\t--bmagic\tDo not use definitions and emit using raw values. (Still requires gif_tags.h currently)\n");
+		"\t--bmagic\tDo not use definitions and emit using raw values. (Still requires gif_tags.h currently)\n"
+		"\t--bdma\t\tPrefix every block with an END DMAtag, so each block can be kicked as a source chain\n"
+		"\t--bdma-chain[=<name>]\tPut all blocks in one array joined by CNT DMAtags, for a single kick (default name gifscript_chain)\n"
+		"\t--bdedup\tWrite identical blocks once, later copies become an alias of the first\n");
 }
 
 c_code_backend::~c_code_backend()
 {
-	if(file != nullptr && file != stdout)
+	if(dedup_enabled)
+	{
+		dedup.report();
+	}
+
+	if(file != nullptr && dma_mode == DmaMode::CHAIN)
 	{
-		fclose(file);
+		const std::string epilogue = fmt::format("\t{},0\n}};\nu64 {}_size = {};\n",
+			emit_dmatag(0, gs::DMA_TAG_END), chain_name, (chain_qwc + 1) * 16);
+		fwrite(epilogue.c_str(), 1, epilogue.size(), file);
+		fwrite(chain_patches.c_str(), 1, chain_patches.size(), file);
 	}
+
+	close_output(file);
+}
+
+auto c_code_backend::emit_dmatag(size_t qwc, uint64_t id) const -> std::string
+{
+	if(emit_mode == EmitMode::USE_DEFS)
+	{
+		const char* id_str = id == gs::DMA_TAG_END ? "DMA_TAG_END" : "DMA_TAG_CNT";
+		return fmt::format("DMA_SET_TAG({},0,{},0,0,0)", qwc, id_str);
+	}
+
+	return fmt::format("0x{:x}", gs::SetDMATag(qwc, 0, id, 0, 0, 0));
 }
 
 void c_code_backend::emit(GIFBlock& block)
@@ -60,80 +110,258 @@ void c_code_backend::emit(GIFBlock& block)
 		const auto& prim = dynamic_cast<const PRIM&>(*block.prim);
 		if(emit_mode == EmitMode::USE_DEFS)
 		{
-			prim_str = fmt::format("GS_SET_PRIM({},{},{},{},0,{},GS_ENABLE,0,0)", PrimTypeStrings[prim.GetType()],
+			prim_str = fmt::format("GS_SET_PRIM({},{},{},{},0,{},{},0,0)", PrimTypeStrings[prim.GetType()],
 				prim.IsGouraud() ? "GS_ENABLE" : "GS_DISABLE",
 				prim.IsTextured() ? "GS_ENABLE" : "GS_DISABLE",
 				prim.IsFogging() ? "GS_ENABLE" : "GS_DISABLE",
-				prim.IsAA1() ? "GS_ENABLE" : "GS_DISABLE");
+				prim.IsAA1() ? "GS_ENABLE" : "GS_DISABLE",
+				prim.IsUV() ? "GS_ENABLE" : "GS_DISABLE");
 		}
 		else
 		{
-			prim_str = fmt::format("GS_SET_PRIM({},{:d},{:d},{:d},0,{:d},1,0,0)", static_cast<int>(prim.GetType()),
+			prim_str = fmt::format("GS_SET_PRIM({},{:d},{:d},{:d},0,{:d},{:d},0,0)", static_cast<int>(prim.GetType()),
 				prim.IsGouraud(),
 				prim.IsTextured(),
 				prim.IsFogging(),
-				prim.IsAA1());
+				prim.IsAA1(),
+				prim.IsUV());
 		}
 	}
 
 	const size_t bytes_per_register = 16;
-	std::string buffer = fmt::format("u64 {1}_data_size = {0};\n"
-									 "u64 {1}_data[] __attribute__((aligned(16))) = {{\n\t"
-									 "GIF_SET_TAG({2},1,{3},{4},0,1),GIF_REG_AD,\n\t",
-		(block.registers.size() + 1) * bytes_per_register, block.name, block.registers.size(), block.prim ? 1 : 0, block.prim ? prim_str : "0");
-	fmt::print("Emitting block: {}\n", block.name);
-	for(const auto& reg : block.registers)
+	// A block that only uploads a texture leaves the PRIM to the upload's tag
+	const bool register_tag = !block.registers.empty() || !block.upload;
+	// Split over as many tags as NLOOP needs, the same way EncodeBlock does.
+	// A repeat loops over the whole register list, otherwise every loop is one register.
+	const bool looped = block.nloop > 1;
+	const size_t nreg = looped ? block.registers.size() : 1;
+	const size_t loops = looped ? block.nloop : block.registers.size();
+	const size_t tag_count = register_tag ? std::max<size_t>(1, (loops + gs::GIF_NLOOP_MAX - 1) / gs::GIF_NLOOP_MAX) : 0;
+	const size_t qwc = (register_tag ? block.registers.size() * block.nloop + tag_count : 0) + (block.upload ? block.upload->Qwords() : 0);
+
+	// QWC would wrap, the block is left out and the run fails rather than sending a short transfer
+	if(dma_mode != DmaMode::NONE && qwc > 0xFFFF)
 	{
-		buffer += dispatch_table[static_cast<uint32_t>(reg->GetID())](this, *reg);
-		buffer += "\n\t";
+		logger::error("Block %s is %zu qwords, too large for a single DMAtag\n", block.name.c_str(), qwc);
+		too_large = true;
+		return;
 	}
 
-	buffer.pop_back();
-	buffer.pop_back();
-	buffer += "\n};\n";
+	// Identical blocks become an alias of the first copy, unless patching one would change both
+	const auto patches = PatchTable(block);
+	if(dedup_enabled && dma_mode != DmaMode::CHAIN && patches.empty())
+	{
+		if(const auto first = dedup.find_or_add(block.name, EncodeBlock(block)))
+		{
+			const size_t size = (dma_mode == DmaMode::BLOCK ? qwc + 1 : qwc) * bytes_per_register;
+			logger::info("Emitting block: %s (alias of %s)", block.name.c_str(), first->c_str());
+			write(fmt::format("u64 {1}_data_size = {0};\n"
+							  "extern u64 {1}_data[{2}] __attribute__((alias(\"{3}_data\")));\n",
+				size, block.name, size / sizeof(uint64_t), *first));
+			return;
+		}
+	}
 
-	if(first_emit)
+	std::string buffer;
+	switch(dma_mode)
+	{
+		case DmaMode::NONE:
+			buffer = fmt::format("u64 {1}_data_size = {0};\n"
+								 "u64 {1}_data[] __attribute__((aligned(16))) = {{\n\t",
+				qwc * bytes_per_register, block.name);
+			break;
+		case DmaMode::BLOCK:
+			buffer = fmt::format("u64 {1}_data_size = {0};\n"
+								 "u64 {1}_data[] __attribute__((aligned(16))) = {{\n\t"
+								 "{2},0,\n\t",
+				(qwc + 1) * bytes_per_register, block.name, emit_dmatag(qwc, gs::DMA_TAG_END));
+			break;
+		case DmaMode::CHAIN:
+			buffer = fmt::format("\t// {}\n\t{},0,\n\t", block.name, emit_dmatag(qwc, gs::DMA_TAG_CNT));
+			// Inside of the chain the patch tables count from the start of the chain
+			chain_patches += emit_patches(block.name, patches, chain_qwc + 1);
+			chain_qwc += qwc + 1;
+			break;
+	}
+
+	logger::info("Emitting block: %s", block.name.c_str());
+	std::vector<std::string> registers;
+	registers.reserve(block.registers.size());
+	for(const auto& reg : block.registers)
+	{
+		registers.push_back(dispatch_table[static_cast<uint32_t>(reg->GetID())](this, *reg) + "\n\t");
+	}
+
+	auto reg_it = registers.cbegin();
+	size_t remaining = loops;
+	for(size_t tag = 0; tag < tag_count; tag++)
 	{
-		if(output.empty())
+		// Only the first tag carries the PRIM and only the last sets EOP
+		const bool pre = tag == 0 && block.prim;
+		const int eop = tag == tag_count - 1 && !block.upload ? 1 : 0;
+		const size_t nloop = std::min<size_t>(remaining, gs::GIF_NLOOP_MAX);
+		if(looped)
 		{
-			file = stdout;
+			// One loop sends every register, an A+D descriptor each
+			buffer += fmt::format("GIF_SET_TAG({},{},{},{},0,{}),0x{:x},\n\t",
+				nloop, eop, pre ? 1 : 0, pre ? prim_str : "0", nreg & 0xF, gs::ADRegs(nreg));
 		}
 		else
 		{
-			file = fopen(output.c_str(), "w");
+			buffer += fmt::format("GIF_SET_TAG({},{},{},{},0,1),GIF_REG_AD,\n\t",
+				nloop, eop, pre ? 1 : 0, pre ? prim_str : "0");
+		}
+
+		for(size_t i = 0; i < nloop * nreg; i++)
+		{
+			buffer += *reg_it;
+			if(++reg_it == registers.cend())
+			{
+				reg_it = registers.cbegin();
+			}
 		}
 
+		remaining -= nloop;
+	}
+
+	if(block.upload)
+	{
+		buffer += emit_upload(*block.upload, !register_tag && block.prim ? prim_str : "");
+	}
+
+	buffer.pop_back();
+	buffer.pop_back();
+	buffer += dma_mode == DmaMode::CHAIN ? "\n" : "\n};\n";
+	if(dma_mode != DmaMode::CHAIN)
+	{
+		buffer += emit_patches(block.name, patches, dma_mode == DmaMode::BLOCK ? 1 : 0);
+	}
+
+	write(buffer);
+}
+
+void c_code_backend::write(const std::string& buffer)
+{
+	if(first_emit)
+	{
+		file = open_output(output, "w");
 		if(file == nullptr)
 		{
 			logger::error("Failed to open file: %s\n", output.cbegin());
 			return;
 		}
-		const std::string prologue = "#include <tamtypes.h>\n#include <gs_gp.h>\n#include <gif_tags.h>\n";
+		std::string prologue = "#include <tamtypes.h>\n#include <gs_gp.h>\n#include <gif_tags.h>\n";
+		if(dma_mode != DmaMode::NONE)
+		{
+			prologue += "#include <dma_tags.h>\n";
+		}
+
+		if(dma_mode == DmaMode::CHAIN)
+		{
+			prologue += fmt::format("u64 {}[] __attribute__((aligned(16))) = {{\n", chain_name);
+		}
 		fwrite(prologue.c_str(), 1, prologue.size(), file);
+		first_emit = false;
 	}
 
 	fwrite(buffer.c_str(), 1, buffer.size(), file);
 }
 
+auto c_code_backend::emit_patches(const std::string& name, const std::vector<Patch>& patches, size_t base) -> std::string
+{
+	if(patches.empty())
+	{
+		return "";
+	}
+
+	std::string buffer;
+	if(!patch_type_emitted)
+	{
+		buffer += fmt::format("// Where a patch field is, qword counts from the start of {}, bit and width are within its 64bit value\n"
+							  "typedef struct {{\n\tu32 qword;\n\tu8 bit;\n\tu8 width;\n\tu16 pad;\n}} gifscript_patch;\n",
+			dma_mode == DmaMode::CHAIN ? chain_name : "the block's _data array");
+		patch_type_emitted = true;
+	}
+
+	std::string names;
+	std::string entries;
+	for(const auto& patch : patches)
+	{
+		names += fmt::format("\t{}_patch_{}_{},\n", name, patch.name, patch.field);
+		entries += fmt::format("\t{{{},{},{},0}}, // {}.{}\n", base + patch.qword, patch.bit, patch.width, patch.name, patch.field);
+	}
+
+	buffer += fmt::format("enum {{\n{0}\t{1}_patch_count\n}};\n"
+						  "const gifscript_patch {1}_patches[] = {{\n{2}}};\n",
+		names, name, entries);
+	return buffer;
+}
+
+auto c_code_backend::emit_upload(const TextureUpload& upload, const std::string& prim_str) const -> std::string
+{
+	const bool defs = emit_mode == EmitMode::USE_DEFS;
+	std::string buffer = fmt::format("GIF_SET_TAG(4,0,{},{},0,1),GIF_REG_AD,\n\t", prim_str.empty() ? 0 : 1, prim_str.empty() ? "0" : prim_str);
+
+	if(defs)
+	{
+		constexpr const char* psm_strings[] = {"GS_PSM_32", "GS_PSM_24", "GS_PSM_16"};
+		buffer += fmt::format("GS_SET_BITBLTBUF(0,0,0,0x{:x},{},{}),GS_REG_BITBLTBUF,\n\t"
+							  "GS_SET_TRXPOS(0,0,{},{},0),GS_REG_TRXPOS,\n\t"
+							  "GS_SET_TRXREG({},{}),GS_REG_TRXREG,\n\t"
+							  "GS_SET_TRXDIR(0),GS_REG_TRXDIR,\n\t",
+			upload.tbp, upload.tbw, psm_strings[static_cast<size_t>(upload.psm)],
+			upload.rect.x, upload.rect.y, upload.rect.z, upload.rect.w);
+	}
+	else
+	{
+		for(const auto& [value, addr] : upload.Registers())
+		{
+			buffer += fmt::format("0x{:x},0x{:02x},\n\t", value, addr);
+		}
+	}
+
+	// Read straight out of the mapping, the last qword is padded with zeroes
+	const auto pixels = upload.Pixels();
+	size_t remaining = upload.ImageQwords();
+	size_t offset = 0;
+	for(size_t tag = 0; tag < upload.ImageTags(); tag++)
+	{
+		const size_t nloop = std::min<size_t>(remaining, gs::GIF_NLOOP_MAX);
+		buffer += fmt::format("GIF_SET_TAG({},{},0,0,{},0),0,\n\t", nloop, tag == upload.ImageTags() - 1 ? 1 : 0, defs ? "GIF_FLG_IMAGE" : "2");
+		for(size_t i = 0; i < nloop; i++)
+		{
+			uint64_t qword[2] = {0, 0};
+			memcpy(qword, pixels.data() + offset, std::min<size_t>(16, pixels.size() - offset));
+			offset += 16;
+			buffer += fmt::format("0x{:016x},0x{:016x},\n\t", qword[0], qword[1]);
+		}
+		remaining -= nloop;
+	}
+
+	return buffer;
+}
+
 auto c_code_backend::emit_primitive(c_code_backend* inst, const GifRegister& reg) -> std::string
 {
 	const auto& prim = dynamic_cast<const PRIM&>(reg);
 	if(inst->emit_mode == EmitMode::USE_DEFS)
 	{
-		return fmt::format("GS_SET_PRIM({},{},{},{},0,{},GS_ENABLE,0,0),GS_REG_PRIM,",
+		return fmt::format("GS_SET_PRIM({},{},{},{},0,{},{},0,0),GS_REG_PRIM,",
 			PrimTypeStrings[prim.GetType()],
 			prim.IsGouraud() ? "GS_ENABLE" : "GS_DISABLE",
 			prim.IsTextured() ? "GS_ENABLE" : "GS_DISABLE",
 			prim.IsFogging() ? "GS_ENABLE" : "GS_DISABLE",
-			prim.IsAA1() ? "GS_ENABLE" : "GS_DISABLE");
+			prim.IsAA1() ? "GS_ENABLE" : "GS_DISABLE",
+			prim.IsUV() ? "GS_ENABLE" : "GS_DISABLE");
 	}
 
-	return fmt::format("GS_SET_PRIM({},{:d},{:d},{:d},0,{:d},1,0,0),0x00,",
+	return fmt::format("GS_SET_PRIM({},{:d},{:d},{:d},0,{:d},{:d},0,0),0x00,",
 		static_cast<int>(prim.GetType()),
 		prim.IsGouraud(),
 		prim.IsTextured(),
 		prim.IsFogging(),
-		prim.IsAA1());
+		prim.IsAA1(),
+		prim.IsUV());
 }
 
 auto c_code_backend::emit_rgbaq(c_code_backend* inst, const GifRegister& reg) -> std::string
@@ -146,6 +374,16 @@ auto c_code_backend::emit_rgbaq(c_code_backend* inst, const GifRegister& reg) ->
 		val.x, val.y, val.z, val.w, 0, inst->emit_mode == EmitMode::USE_DEFS ? "GS_REG_RGBAQ" : "0x01");
 }
 
+auto c_code_backend::emit_st(c_code_backend* inst, const GifRegister& reg) -> std::string
+{
+	const auto& st = dynamic_cast<const ST&>(reg);
+
+	auto val = st.GetValue();
+
+	return fmt::format("GS_SET_ST(0x{:08x},0x{:08x}),{},",
+		val.x, val.y, inst->emit_mode == EmitMode::USE_DEFS ? "GS_REG_ST" : "0x02");
+}
+
 auto c_code_backend::emit_uv(c_code_backend* inst, const GifRegister& reg) -> std::string
 {
 	const auto& uv_reg = dynamic_cast<const UV&>(reg);
@@ -156,6 +394,16 @@ auto c_code_backend::emit_uv(c_code_backend* inst, const GifRegister& reg) -> st
 		val.x, val.y, inst->emit_mode == EmitMode::USE_DEFS ? "GS_REG_UV" : "0x03");
 }
 
+auto c_code_backend::emit_xyzf2(c_code_backend* inst, const GifRegister& reg) -> std::string
+{
+	const auto& xyzf2 = dynamic_cast<const XYZF2&>(reg);
+
+	auto val = xyzf2.GetValue();
+
+	return fmt::format("GS_SET_XYZF({}<<4,{}<<4,{},0x{:02x}),{},",
+		val.x, val.y, val.z, val.w, inst->emit_mode == EmitMode::USE_DEFS ? "GS_REG_XYZF2" : "0x04");
+}
+
 auto c_code_backend::emit_xyz2(c_code_backend* inst, const GifRegister& reg) -> std::string
 {
 	const auto& xyz2 = dynamic_cast<const XYZ2&>(reg);
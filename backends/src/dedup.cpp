@@ -0,0 +1,53 @@
+#include "dedup.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+
+namespace
+{
+	// FNV-1a over the 64bit words
+	uint64_t HashPayload(std::span<const uint64_t> payload)
+	{
+		uint64_t hash = 0xcbf29ce484222325;
+		for(const auto word : payload)
+		{
+			hash ^= word;
+			hash *= 0x100000001b3;
+		}
+		return hash;
+	}
+} // namespace
+
+auto block_dedup::find_or_add(const std::string& name, std::span<const uint64_t> payload) -> std::optional<std::string>
+{
+	const size_t bytes = payload.size_bytes();
+	total_blocks++;
+	total_bytes += bytes;
+
+	const uint64_t hash = HashPayload(payload);
+	const auto [begin, end] = seen.equal_range(hash);
+	for(auto it = begin; it != end; it++)
+	{
+		if(std::ranges::equal(it->second.payload, payload))
+		{
+			duplicate_blocks++;
+			duplicate_bytes += bytes;
+			logger::info("Block %s is identical to %s", name.c_str(), it->second.name.c_str());
+			return it->second.name;
+		}
+	}
+
+	seen.emplace(hash, Entry{name, {payload.begin(), payload.end()}});
+	return std::nullopt;
+}
+
+void block_dedup::report() const
+{
+	if(total_bytes == 0)
+	{
+		return;
+	}
+
+	logger::info("Deduplicated %zu of %zu blocks, %zu of %zu bytes (%.1f%%)",
+		duplicate_blocks, total_blocks, duplicate_bytes, total_bytes, 100.0 * duplicate_bytes / total_bytes);
+}
@@ -0,0 +1,451 @@
+#include "elf.hpp"
+#include "encoder.hpp"
+#include "encoding.hpp"
+#include "registers.hpp"
+#include "logger.hpp"
+
+#include <fmt/core.h>
+#include <algorithm>
+#include <charconv>
+#include <string>
+
+namespace
+{
+	// Only the handful of ELF constants we need, <elf.h> is not available everywhere
+	constexpr uint16_t ET_REL = 1;
+	constexpr uint16_t EM_MIPS = 8;
+	constexpr uint16_t EM_X86_64 = 62;
+
+	constexpr uint32_t SHT_PROGBITS = 1;
+	constexpr uint32_t SHT_SYMTAB = 2;
+	constexpr uint32_t SHT_STRTAB = 3;
+	constexpr uint32_t SHT_RELA = 4;
+
+	constexpr uint64_t SHF_ALLOC = 0x2;
+	constexpr uint64_t SHF_INFO_LINK = 0x40;
+
+	constexpr uint32_t R_MIPS_32 = 2;
+	constexpr uint32_t R_X86_64_32 = 10;
+
+	constexpr uint8_t STB_LOCAL = 0;
+	constexpr uint8_t STB_GLOBAL = 1;
+	constexpr uint8_t STT_OBJECT = 1;
+	constexpr uint8_t STT_SECTION = 3;
+
+	struct Section
+	{
+		std::string name;
+		uint32_t type = 0;
+		uint64_t flags = 0;
+		std::vector<uint8_t> data;
+		uint32_t link = 0;
+		uint32_t info = 0;
+		uint64_t align = 1;
+		uint64_t entsize = 0;
+	};
+
+	// Little endian serializer, addresses are 4 or 8 bytes depending on the ELF class
+	struct ByteWriter
+	{
+		bool elf64;
+		std::vector<uint8_t> bytes;
+
+		void u8(uint8_t v) { bytes.push_back(v); }
+		void u16(uint16_t v) { put(v, 2); }
+		void u32(uint32_t v) { put(v, 4); }
+		void u64(uint64_t v) { put(v, 8); }
+		void addr(uint64_t v) { put(v, elf64 ? 8 : 4); }
+
+		void put(uint64_t v, size_t size)
+		{
+			for(size_t i = 0; i < size; i++)
+			{
+				bytes.push_back(static_cast<uint8_t>(v >> (i * 8)));
+			}
+		}
+
+		void align(size_t alignment)
+		{
+			while(bytes.size() % alignment)
+			{
+				bytes.push_back(0);
+			}
+		}
+	};
+
+	uint32_t AddString(std::vector<uint8_t>& table, const std::string& str)
+	{
+		const auto offset = static_cast<uint32_t>(table.size());
+		table.insert(table.end(), str.begin(), str.end());
+		table.push_back(0);
+		return offset;
+	}
+} // namespace
+
+auto elf_backend::arg_parse(int argc, char** argv) -> bool
+{
+	for(int i = 0; i < argc; i++)
+	{
+		const std::string_view arg = argv[i];
+		if(arg.starts_with("--b") && !arg.starts_with("--backend="))
+		{
+			const std::string_view arg2 = arg.substr(3);
+			if(arg2.compare("ee") == 0)
+			{
+				target = Target::EE;
+			}
+			else if(arg2.compare("x86_64") == 0)
+			{
+				target = Target::X86_64;
+			}
+			else if(arg2.starts_with("flags="))
+			{
+				// Hex like the toolchain prints them, or decimal
+				std::string_view value = arg2.substr(6);
+				int base = 10;
+				if(value.starts_with("0x") || value.starts_with("0X"))
+				{
+					value.remove_prefix(2);
+					base = 16;
+				}
+				uint32_t flags = 0;
+				const auto [end, ec] = std::from_chars(value.begin(), value.end(), flags, base);
+				if(value.empty() || ec != std::errc() || end != value.end())
+				{
+					logger::error("Invalid flags: %s\n", arg2.substr(6).cbegin());
+					return false;
+				}
+				ee_flags = flags;
+			}
+			else if(arg2.compare("dedup") == 0)
+			{
+				dedup_enabled = true;
+			}
+			else if(arg2.compare("dma") == 0)
+			{
+				dma_mode = DmaMode::BLOCK;
+			}
+			else if(arg2.starts_with("dma-chain"))
+			{
+				dma_mode = DmaMode::CHAIN;
+				if(arg2.starts_with("dma-chain="))
+				{
+					chain_name = arg2.substr(10);
+				}
+			}
+			else if(arg2.compare("help") == 0)
+			{
+				print_help();
+				return false;
+			}
+			else
+			{
+				logger::error("Invalid elf option: %s\n", arg2.cbegin());
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void elf_backend::print_help() const
+{
+	fmt::print(
+		"elf backend options:\n"
+		"\t--bee\t\tEmit a 32bit MIPS object for the EE toolchain (default)\n"
+		"\t--bx86_64\tEmit a 64bit x86 object, useful for tools and inspecting the output\n"
+		"\t--bflags=<n>\tOverride the EE e_flags, to match the ABI of your toolchain (default 0x20920020, n32)\n"
+		"\t--bdma\t\tPrefix every block with an END DMAtag, so each block can be kicked as a source chain\n"
+		"\t--bdma-chain[=<name>]\tJoin all blocks with CNT DMAtags into one chain symbol, for a single kick (default name gifscript_chain)\n"
+		"\t--bdedup\tWrite identical blocks once, later copies alias the first (in a chain, a REF DMAtag to it)\n");
+}
+
+elf_backend::~elf_backend()
+{
+	if(dedup_enabled)
+	{
+		dedup.report();
+	}
+
+	FILE* out = file != nullptr ? file : stream;
+	if(out == nullptr)
+	{
+		return;
+	}
+
+	const auto object = write_object();
+	fwrite(object.data(), 1, object.size(), out);
+	close_output(out);
+}
+
+void elf_backend::set_output(const std::string_view& output)
+{
+	this->output = output;
+	if(stream == nullptr && this->output.empty())
+	{
+		logger::error("The elf backend requires an output file\n");
+		return;
+	}
+
+	file = open_output(this->output, "wb");
+	if(file == nullptr)
+	{
+		logger::error("Failed to open file: %s\n", this->output.c_str());
+	}
+}
+
+void elf_backend::emit(GIFBlock& block)
+{
+	logger::info("Emitting block: %s", block.name.c_str());
+
+	const auto data = EncodeBlock(block);
+	const uint64_t qwc = data.size() / 2;
+
+	// QWC would wrap, the block is left out and the run fails rather than sending a short transfer
+	if(dma_mode != DmaMode::NONE && qwc > 0xFFFF)
+	{
+		logger::error("Block %s is %zu qwords, too large for a single DMAtag\n", block.name.c_str(), static_cast<size_t>(qwc));
+		too_large = true;
+		return;
+	}
+
+	ByteWriter writer{true, std::move(rodata)};
+	writer.align(16);
+
+	// Identical blocks become an alias of the first copy, a chain REFs the first copy's data.
+	// A block with patch fields keeps its own copy, patching it would change the other block too.
+	auto patch_table = PatchTable(block);
+	if(dedup_enabled && patch_table.empty())
+	{
+		if(const auto first = dedup.find_or_add(block.name, data))
+		{
+			const auto original = *std::ranges::find(blocks, *first + "_data", &Symbol::name);
+			if(dma_mode == DmaMode::CHAIN)
+			{
+				relocations.push_back({writer.bytes.size() + 4, original.offset});
+				writer.u64(gs::SetDMATag(qwc, 0, gs::DMA_TAG_REF, 0, 0, 0));
+				writer.u64(0);
+			}
+
+			blocks.push_back({block.name + "_data", original.offset, original.size});
+			rodata = std::move(writer.bytes);
+			return;
+		}
+	}
+
+	switch(dma_mode)
+	{
+		case DmaMode::NONE:
+			blocks.push_back({block.name + "_data", writer.bytes.size(), qwc * 16});
+			break;
+		case DmaMode::BLOCK:
+			blocks.push_back({block.name + "_data", writer.bytes.size(), (qwc + 1) * 16});
+			writer.u64(gs::SetDMATag(qwc, 0, gs::DMA_TAG_END, 0, 0, 0));
+			writer.u64(0);
+			break;
+		case DmaMode::CHAIN:
+			writer.u64(gs::SetDMATag(qwc, 0, gs::DMA_TAG_CNT, 0, 0, 0));
+			writer.u64(0);
+			blocks.push_back({block.name + "_data", writer.bytes.size(), qwc * 16});
+			break;
+	}
+
+	for(const auto word : data)
+	{
+		writer.u64(word);
+	}
+
+	// Inside of a chain the tables count from the start of the chain, like the c_code backend's
+	if(!patch_table.empty())
+	{
+		const uint64_t base = dma_mode == DmaMode::CHAIN ? blocks.back().offset / 16 : dma_mode == DmaMode::BLOCK ? 1 : 0;
+		patches.push_back({block.name, std::move(patch_table), static_cast<uint32_t>(base)});
+	}
+
+	rodata = std::move(writer.bytes);
+}
+
+auto elf_backend::write_object() const -> std::vector<uint8_t>
+{
+	const bool elf64 = target == Target::X86_64;
+
+	std::vector<Symbol> symbols = blocks;
+	ByteWriter data{elf64, rodata};
+	if(dma_mode == DmaMode::CHAIN)
+	{
+		data.u64(gs::SetDMATag(0, 0, gs::DMA_TAG_END, 0, 0, 0));
+		data.u64(0);
+		symbols.push_back({chain_name, 0, data.bytes.size()});
+	}
+
+	const uint64_t data_end = data.bytes.size();
+	data.align(8);
+	for(const auto& block : blocks)
+	{
+		symbols.push_back({block.name + "_size", data.bytes.size(), sizeof(uint64_t)});
+		data.u64(block.size);
+	}
+
+	if(dma_mode == DmaMode::CHAIN)
+	{
+		symbols.push_back({chain_name + "_size", data.bytes.size(), sizeof(uint64_t)});
+		data.u64(data_end);
+	}
+
+	// Laid out like the c_code backend's gifscript_patch, a u32 qword, u8 bit, u8 width and u16 of padding
+	for(const auto& table : patches)
+	{
+		data.align(4);
+		symbols.push_back({table.name + "_patches", data.bytes.size(), table.entries.size() * 8});
+		for(const auto& patch : table.entries)
+		{
+			data.u32(table.base + patch.qword);
+			data.u8(patch.bit);
+			data.u8(patch.width);
+			data.u16(0);
+		}
+		symbols.push_back({table.name + "_patch_count", data.bytes.size(), sizeof(uint32_t)});
+		data.u32(table.entries.size());
+	}
+
+	std::vector<Section> sections(1);
+
+	const uint32_t rodata_index = sections.size();
+	sections.push_back({.name = ".rodata", .type = SHT_PROGBITS, .flags = SHF_ALLOC, .data = std::move(data.bytes), .align = 16});
+
+	// The 32bit address of a DMAtag, against the .rodata section symbol
+	const uint32_t rela_index = sections.size();
+	if(!relocations.empty())
+	{
+		ByteWriter rela{elf64, {}};
+		for(const auto& relocation : relocations)
+		{
+			rela.addr(relocation.offset);
+			if(elf64)
+			{
+				rela.u64(uint64_t{1} << 32 | R_X86_64_32);
+			}
+			else
+			{
+				rela.u32(1 << 8 | R_MIPS_32);
+			}
+			rela.addr(relocation.addend);
+		}
+
+		sections.push_back({.name = ".rela.rodata", .type = SHT_RELA, .flags = SHF_INFO_LINK, .data = std::move(rela.bytes), .info = rodata_index,
+			.align = elf64 ? 8u : 4u, .entsize = elf64 ? 24u : 12u});
+	}
+
+	// Symbol table, a local section symbol first, then the block symbols
+	std::vector<uint8_t> strtab(1, 0);
+	ByteWriter symtab{elf64, {}};
+	auto add_symbol = [&](uint32_t name, uint64_t value, uint64_t size, uint8_t info, uint16_t shndx) {
+		if(elf64)
+		{
+			symtab.u32(name);
+			symtab.u8(info);
+			symtab.u8(0);
+			symtab.u16(shndx);
+			symtab.u64(value);
+			symtab.u64(size);
+		}
+		else
+		{
+			symtab.u32(name);
+			symtab.u32(value);
+			symtab.u32(size);
+			symtab.u8(info);
+			symtab.u8(0);
+			symtab.u16(shndx);
+		}
+	};
+
+	add_symbol(0, 0, 0, 0, 0);
+	add_symbol(0, 0, 0, (STB_LOCAL << 4) | STT_SECTION, rodata_index);
+	const uint32_t first_global = 2;
+	for(const auto& symbol : symbols)
+	{
+		add_symbol(AddString(strtab, symbol.name), symbol.offset, symbol.size, (STB_GLOBAL << 4) | STT_OBJECT, rodata_index);
+	}
+
+	const uint32_t symtab_index = sections.size();
+	sections.push_back({.name = ".symtab", .type = SHT_SYMTAB, .data = std::move(symtab.bytes), .link = symtab_index + 1, .info = first_global,
+		.align = elf64 ? 8u : 4u, .entsize = elf64 ? 24u : 16u});
+	sections.push_back({.name = ".strtab", .type = SHT_STRTAB, .data = std::move(strtab)});
+	if(!relocations.empty())
+	{
+		sections[rela_index].link = symtab_index;
+	}
+
+	if(elf64)
+	{
+		// Keeps GNU ld from assuming we want an executable stack
+		sections.push_back({.name = ".note.GNU-stack", .type = SHT_PROGBITS});
+	}
+
+	const uint32_t shstrtab_index = sections.size();
+	sections.push_back({.name = ".shstrtab", .type = SHT_STRTAB});
+	std::vector<uint8_t> shstrtab(1, 0);
+	std::vector<uint32_t> section_names;
+	for(const auto& section : sections)
+	{
+		section_names.push_back(section.name.empty() ? 0 : AddString(shstrtab, section.name));
+	}
+	sections[shstrtab_index].data = std::move(shstrtab);
+
+	// Lay out the file, header first, then the section contents, then the section headers
+	const size_t ehsize = elf64 ? 64 : 52;
+	const size_t shentsize = elf64 ? 64 : 40;
+	std::vector<uint64_t> section_offsets(sections.size(), 0);
+	ByteWriter body{elf64, std::vector<uint8_t>(ehsize, 0)};
+	for(size_t i = 1; i < sections.size(); i++)
+	{
+		body.align(std::max<uint64_t>(sections[i].align, 1));
+		section_offsets[i] = body.bytes.size();
+		body.bytes.insert(body.bytes.end(), sections[i].data.begin(), sections[i].data.end());
+	}
+	body.align(elf64 ? 8 : 4);
+	const uint64_t shoff = body.bytes.size();
+
+	for(size_t i = 0; i < sections.size(); i++)
+	{
+		const auto& section = sections[i];
+		body.u32(section_names[i]);
+		body.u32(section.type);
+		body.addr(section.flags);
+		body.addr(0);
+		body.addr(section_offsets[i]);
+		body.addr(section.data.size());
+		body.u32(section.link);
+		body.u32(section.info);
+		body.addr(i == 0 ? 0 : section.align);
+		body.addr(section.entsize);
+	}
+
+	ByteWriter header{elf64, {}};
+	header.u8(0x7F);
+	header.u8('E');
+	header.u8('L');
+	header.u8('F');
+	header.u8(elf64 ? 2 : 1); // EI_CLASS
+	header.u8(1); // EI_DATA, little endian
+	header.u8(1); // EI_VERSION
+	header.align(16);
+	header.u16(ET_REL);
+	header.u16(elf64 ? EM_X86_64 : EM_MIPS);
+	header.u32(1);
+	header.addr(0); // e_entry
+	header.addr(0); // e_phoff
+	header.addr(shoff);
+	header.u32(elf64 ? 0 : ee_flags);
+	header.u16(ehsize);
+	header.u16(0); // e_phentsize
+	header.u16(0); // e_phnum
+	header.u16(shentsize);
+	header.u16(sections.size());
+	header.u16(shstrtab_index);
+
+	std::copy(header.bytes.begin(), header.bytes.end(), body.bytes.begin());
+	return body.bytes;
+}
@@ -4,52 +4,211 @@
 #include "version.hpp"
 
 #include <fmt/core.h>
+#include <algorithm>
 #include <functional>
 
+namespace
+{
+	std::string FormatXYZ2(const Vec3& val)
+	{
+		return fmt::format("xyz2 0x{:x},0x{:x},0x{:x};",
+			val.x, val.y, val.z);
+	}
+
+	std::string FormatUpload(const TextureUpload& upload)
+	{
+		constexpr const char* psm_strings[] = {"CT32", "CT24", "CT16"};
+		return fmt::format("upload \"{}\" 0x{:x} 0x{:x} {} 0x{:x},0x{:x},0x{:x},0x{:x};", upload.path, upload.tbp, upload.tbw,
+			psm_strings[static_cast<size_t>(upload.psm)], upload.rect.x, upload.rect.y, upload.rect.z, upload.rect.w);
+	}
+} // namespace
+
 auto gifscript_backend::arg_parse(int argc, char** argv) -> bool
 {
+	for(int i = 0; i < argc; i++)
+	{
+		const std::string_view arg = argv[i];
+		if(arg.starts_with("--b") && !arg.starts_with("--backend="))
+		{
+			const std::string_view arg2 = arg.substr(3);
+			if(arg2.compare("macros") == 0)
+			{
+				extract_macros = true;
+			}
+			else if(arg2.compare("help") == 0)
+			{
+				print_help();
+				return false;
+			}
+			else
+			{
+				logger::error("Invalid gifscript option: %s\n", arg2.cbegin());
+				return false;
+			}
+		}
+	}
+
 	return true;
 }
 
 void gifscript_backend::print_help() const
 {
 	fmt::print(
-		"gifscript backend options: none\n");
+		"gifscript backend options:\n"
+		"\t--bmacros\tFind repeated register sequences, also ones moved by an XY offset, and write them as macros\n");
 }
 
 gifscript_backend::~gifscript_backend()
 {
-	if(file != nullptr && file != stdout)
+	if(extract_macros && !blocks.empty())
 	{
-		fclose(file);
+		std::vector<script_body> bodies;
+		size_t lines_before = 0;
+		for(auto& block : blocks)
+		{
+			lines_before += block.body.size();
+			bodies.push_back(std::move(block.body));
+		}
+
+		const auto macros = extract_repeats(bodies);
+
+		size_t lines_after = 0;
+		for(size_t i = 0; i < macros.size(); i++)
+		{
+			// Keep clear of the block names
+			std::string name = fmt::format("seq{}", i);
+			while(std::ranges::any_of(blocks, [&name](const auto& block) { return block.name == name; }))
+			{
+				name += "_";
+			}
+			macro_names.push_back(name);
+		}
+
+		for(size_t i = 0; i < macros.size(); i++)
+		{
+			lines_after += macros[i].size() + 2;
+			write(fmt::format("macro {} {{\n{}}}\n", macro_names[i], format_body(macros[i])));
+		}
+
+		for(size_t i = 0; i < blocks.size(); i++)
+		{
+			lines_after += bodies[i].size();
+			write(format_block(blocks[i], bodies[i]));
+		}
+
+		logger::info("Extracted %zu macros, %zu register lines down to %zu", macros.size(), lines_before, lines_after);
 	}
+
+	close_output(file);
 }
 
 void gifscript_backend::emit(GIFBlock& block)
 {
-	std::string buffer = fmt::format("{} {{\n\t", block.name);
-	fmt::print("Emitting block: {}\n", block.name);
-	for(const auto& reg : block.registers)
+	logger::info("Emitting block: %s", block.name.c_str());
+	if(extract_macros)
 	{
-		buffer += dispatch_table[static_cast<uint32_t>(reg->GetID())](this, *reg);
-		buffer += "\n\t";
+		blocks.push_back(to_block(block));
+		return;
 	}
 
-	buffer.pop_back();
-	buffer.pop_back();
-	buffer += "\n}\n";
+	const script_block entry = to_block(block);
+	write(format_block(entry, entry.body));
+}
 
-	if(first_emit)
+auto gifscript_backend::to_block(const GIFBlock& block) -> script_block
+{
+	script_block entry{.name = block.name, .nloop = block.nloop};
+	if(block.upload)
+	{
+		entry.upload = FormatUpload(*block.upload);
+	}
+
+	// Patch fields keep their name, and never end up in an extracted macro
+	const auto line = [](const GifRegister& reg, std::string text) -> script_entry {
+		if(reg.GetPatch().empty())
+		{
+			return {.kind = script_entry::Kind::LINE, .text = std::move(text)};
+		}
+		return {.kind = script_entry::Kind::PATCH, .text = fmt::format("patch {} {}", reg.GetPatch(), text)};
+	};
+
+	if(block.prim)
+	{
+		if(block.nloop > 1)
+		{
+			entry.prim = line(*block.prim, emit_primitive(this, *block.prim)).text;
+		}
+		else
+		{
+			entry.body.push_back(line(*block.prim, emit_primitive(this, *block.prim)));
+		}
+	}
+
+	for(const auto& reg : block.registers)
 	{
-		if(output.empty())
+		if(reg->GetID() == GifRegisterID::XYZ2 && reg->GetPatch().empty())
 		{
-			file = stdout;
+			entry.body.push_back({.kind = script_entry::Kind::XYZ2, .xyz = dynamic_cast<const XYZ2&>(*reg).GetValue()});
 		}
 		else
 		{
-			file = fopen(output.c_str(), "w");
+			entry.body.push_back(line(*reg, dispatch_table[static_cast<uint32_t>(reg->GetID())](this, *reg)));
 		}
+	}
+
+	return entry;
+}
+
+auto gifscript_backend::format_block(const script_block& block, const script_body& body) const -> std::string
+{
+	if(block.nloop == 1)
+	{
+		const std::string upload = block.upload.empty() ? "" : fmt::format("\t{}\n", block.upload);
+		return fmt::format("{} {{\n{}{}}}\n", block.name, format_body(body), upload);
+	}
+
+	const std::string prim = block.prim.empty() ? "" : fmt::format("\t{}\n", block.prim);
+	return fmt::format("{} {{\n{}\trepeat {} {{\n{}\t}}\n}}\n", block.name, prim, block.nloop, format_body(body, "\t\t"));
+}
+
+auto gifscript_backend::format_body(const script_body& body, std::string_view indent) const -> std::string
+{
+	std::string buffer;
+	for(const auto& entry : body)
+	{
+		buffer += indent;
+		switch(entry.kind)
+		{
+			case script_entry::Kind::LINE:
+			case script_entry::Kind::PATCH:
+				buffer += entry.text;
+				break;
+			case script_entry::Kind::XYZ2:
+				buffer += FormatXYZ2(entry.xyz);
+				break;
+			case script_entry::Kind::MACRO:
+				if(entry.has_offset && (entry.offset.x != 0 || entry.offset.y != 0))
+				{
+					buffer += fmt::format("macro {} 0x{:x},0x{:x};", macro_names[entry.macro], entry.offset.x, entry.offset.y);
+				}
+				else
+				{
+					buffer += fmt::format("macro {};", macro_names[entry.macro]);
+				}
+				break;
+		}
+		buffer += "\n";
+	}
+
+	return buffer;
+}
 
+void gifscript_backend::write(const std::string& text)
+{
+	if(first_emit)
+	{
+		first_emit = false;
+		file = open_output(output, "w");
 		if(file == nullptr)
 		{
 			logger::error("Failed to open file: %s\n", output.cbegin());
@@ -59,7 +218,12 @@ void gifscript_backend::emit(GIFBlock& block)
 		fwrite(prologue.c_str(), 1, prologue.size(), file);
 	}
 
-	fwrite(buffer.c_str(), 1, buffer.size(), file);
+	if(file == nullptr)
+	{
+		return;
+	}
+
+	fwrite(text.c_str(), 1, text.size(), file);
 }
 
 auto gifscript_backend::emit_primitive(gifscript_backend* inst, const GifRegister& reg) -> std::string
@@ -114,6 +278,11 @@ auto gifscript_backend::emit_primitive(gifscript_backend* inst, const GifRegiste
 		line += " aa1";
 	}
 
+	if(!prim.IsUV())
+	{
+		line += " stq";
+	}
+
 	line += ";";
 	return line;
 }
@@ -127,6 +296,16 @@ auto gifscript_backend::emit_rgbaq(gifscript_backend* inst, const GifRegister& r
 		val.x, val.y, val.z, val.w);
 }
 
+auto gifscript_backend::emit_st(gifscript_backend* inst, const GifRegister& reg) -> std::string
+{
+	const auto& st = dynamic_cast<const ST&>(reg);
+
+	// Hex keeps the exact float bits
+	auto val = st.GetValue();
+	return fmt::format("st 0x{:x},0x{:x};",
+		val.x, val.y);
+}
+
 auto gifscript_backend::emit_uv(gifscript_backend* inst, const GifRegister& reg) -> std::string
 {
 	const auto& uv_reg = dynamic_cast<const UV&>(reg);
@@ -136,13 +315,20 @@ auto gifscript_backend::emit_uv(gifscript_backend* inst, const GifRegister& reg)
 		val.x, val.y);
 }
 
+auto gifscript_backend::emit_xyzf2(gifscript_backend* inst, const GifRegister& reg) -> std::string
+{
+	const auto& xyzf2 = dynamic_cast<const XYZF2&>(reg);
+
+	auto val = xyzf2.GetValue();
+	return fmt::format("xyzf2 0x{:x},0x{:x},0x{:x},0x{:x};",
+		val.x, val.y, val.z, val.w);
+}
+
 auto gifscript_backend::emit_xyz2(gifscript_backend* inst, const GifRegister& reg) -> std::string
 {
 	const auto& xyz2 = dynamic_cast<const XYZ2&>(reg);
 
-	auto val = xyz2.GetValue();
-	return fmt::format("xyz2 0x{:x},0x{:x},0x{:x};",
-		val.x, val.y, val.z);
+	return FormatXYZ2(xyz2.GetValue());
 }
 
 auto gifscript_backend::emit_tex0(gifscript_backend* inst, const GifRegister& reg) -> std::string
@@ -0,0 +1,496 @@
+#include "repeat_finder.hpp"
+
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <queue>
+#include <tuple>
+#include <unordered_map>
+
+namespace
+{
+	// How many of the longest and most frequent repeats get a closer look each round
+	constexpr size_t MAX_CANDIDATES = 32;
+
+	// Every block back to back, with an empty slot after each block
+	using flat_body = std::vector<std::optional<script_entry>>;
+
+	struct Interval
+	{
+		size_t length;
+		size_t lb;
+		size_t rb;
+		int64_t estimate;
+
+		bool operator>(const Interval& other) const
+		{
+			return estimate > other.estimate;
+		}
+	};
+
+	struct Repeat
+	{
+		size_t length;
+		std::vector<size_t> starts;
+		int64_t gain;
+	};
+
+	// Lines saved by writing a repeat once as a macro.
+	// Every copy shrinks to one insertion, the macro itself costs its body plus two lines.
+	int64_t Gain(size_t length, size_t count)
+	{
+		return static_cast<int64_t>(count) * (static_cast<int64_t>(length) - 1) - (static_cast<int64_t>(length) + 2);
+	}
+
+	bool IsXYZ2(const flat_body& flat, size_t i)
+	{
+		return flat[i] && flat[i]->kind == script_entry::Kind::XYZ2;
+	}
+
+	// Equal tokens are interchangeable inside of a repeat.
+	// XYZ2 is tokenized by its distance to the previous XYZ2, so a moved copy of
+	// some vertices tokenizes the same apart from its first vertex.
+	// Block ends and macro insertions get a token of their own, no repeat can span them.
+	// The last token is a 0 sentinel for the suffix array.
+	std::vector<size_t> Tokenize(const flat_body& flat, size_t& alphabet)
+	{
+		std::vector<size_t> tokens(flat.size() + 1);
+		std::unordered_map<std::string, size_t> lines;
+		std::map<std::tuple<int64_t, int64_t, uint32_t>, size_t> deltas;
+		size_t next = 1;
+		Vec3 last;
+
+		for(size_t i = 0; i < flat.size(); i++)
+		{
+			if(!flat[i])
+			{
+				tokens[i] = next++;
+				last = Vec3();
+				continue;
+			}
+
+			const script_entry& entry = *flat[i];
+			switch(entry.kind)
+			{
+				case script_entry::Kind::LINE:
+				{
+					const auto [it, inserted] = lines.try_emplace(entry.text, next);
+					next += inserted;
+					tokens[i] = it->second;
+					break;
+				}
+				case script_entry::Kind::XYZ2:
+				{
+					const auto delta = std::make_tuple(static_cast<int64_t>(entry.xyz.x) - last.x, static_cast<int64_t>(entry.xyz.y) - last.y, entry.xyz.z);
+					const auto [it, inserted] = deltas.try_emplace(delta, next);
+					next += inserted;
+					tokens[i] = it->second;
+					last = entry.xyz;
+					break;
+				}
+				case script_entry::Kind::MACRO:
+				case script_entry::Kind::PATCH:
+					tokens[i] = next++;
+					break;
+			}
+		}
+
+		tokens.back() = 0;
+		alphabet = next;
+		return tokens;
+	}
+
+	// Prefix doubling with counting sorts, relies on the unique 0 sentinel so
+	// sorting the cyclic shifts sorts the suffixes
+	std::vector<size_t> SuffixArray(const std::vector<size_t>& tokens, size_t alphabet)
+	{
+		const size_t n = tokens.size();
+		std::vector<size_t> sa(n), rank(n), shifted(n), next_rank(n);
+		std::vector<size_t> count(std::max(alphabet, n), 0);
+
+		for(const auto token : tokens)
+		{
+			count[token]++;
+		}
+		for(size_t i = 1; i < alphabet; i++)
+		{
+			count[i] += count[i - 1];
+		}
+		for(size_t i = n; i-- > 0;)
+		{
+			sa[--count[tokens[i]]] = i;
+		}
+
+		size_t classes = 1;
+		rank[sa[0]] = 0;
+		for(size_t i = 1; i < n; i++)
+		{
+			classes += tokens[sa[i]] != tokens[sa[i - 1]];
+			rank[sa[i]] = classes - 1;
+		}
+
+		for(size_t k = 1; k < n && classes < n; k <<= 1)
+		{
+			for(size_t i = 0; i < n; i++)
+			{
+				shifted[i] = (sa[i] + n - k) % n;
+			}
+
+			std::fill_n(count.begin(), classes, 0);
+			for(const auto s : shifted)
+			{
+				count[rank[s]]++;
+			}
+			for(size_t i = 1; i < classes; i++)
+			{
+				count[i] += count[i - 1];
+			}
+			for(size_t i = n; i-- > 0;)
+			{
+				sa[--count[rank[shifted[i]]]] = shifted[i];
+			}
+
+			classes = 1;
+			next_rank[sa[0]] = 0;
+			for(size_t i = 1; i < n; i++)
+			{
+				const auto cur = std::make_pair(rank[sa[i]], rank[(sa[i] + k) % n]);
+				const auto prev = std::make_pair(rank[sa[i - 1]], rank[(sa[i - 1] + k) % n]);
+				classes += cur != prev;
+				next_rank[sa[i]] = classes - 1;
+			}
+			rank.swap(next_rank);
+		}
+
+		return sa;
+	}
+
+	// Kasai, lcp[i] is the common prefix of the suffixes at sa[i - 1] and sa[i]
+	std::vector<size_t> CommonPrefixes(const std::vector<size_t>& tokens, const std::vector<size_t>& sa)
+	{
+		const size_t n = tokens.size();
+		std::vector<size_t> rank(n), lcp(n, 0);
+		for(size_t i = 0; i < n; i++)
+		{
+			rank[sa[i]] = i;
+		}
+
+		size_t h = 0;
+		for(size_t i = 0; i < n; i++)
+		{
+			if(rank[i] == 0)
+			{
+				h = 0;
+				continue;
+			}
+
+			const size_t j = sa[rank[i] - 1];
+			while(i + h < n && j + h < n && tokens[i + h] == tokens[j + h])
+			{
+				h++;
+			}
+			lcp[rank[i]] = h;
+			h -= h > 0;
+		}
+
+		return lcp;
+	}
+
+	// Walks the lcp intervals, every interval is a token sequence and the suffixes starting with it.
+	// Only the most promising ones are kept, judged by their length and number of copies.
+	std::vector<Interval> BestIntervals(const std::vector<size_t>& lcp)
+	{
+		std::priority_queue<Interval, std::vector<Interval>, std::greater<>> best;
+		const auto report = [&](size_t length, size_t lb, size_t rb) {
+			if(length == 0)
+			{
+				return;
+			}
+
+			// A repeat usually grows by its first vertex once the XYZ2 offset is allowed for
+			const int64_t count = static_cast<int64_t>(rb - lb + 1);
+			const int64_t estimate = count * static_cast<int64_t>(length) - static_cast<int64_t>(length) - 3;
+			if(estimate <= 0)
+			{
+				return;
+			}
+
+			best.push(Interval{length, lb, rb, estimate});
+			if(best.size() > MAX_CANDIDATES)
+			{
+				best.pop();
+			}
+		};
+
+		const size_t n = lcp.size();
+		std::vector<std::pair<size_t, size_t>> stack = {{0, 0}};
+		for(size_t i = 1; i <= n; i++)
+		{
+			const size_t cur = i < n ? lcp[i] : 0;
+			size_t lb = i - 1;
+			while(cur < stack.back().first)
+			{
+				const auto [length, left] = stack.back();
+				stack.pop_back();
+				report(length, left, i - 1);
+				lb = left;
+			}
+
+			if(cur > stack.back().first)
+			{
+				stack.emplace_back(cur, lb);
+			}
+		}
+
+		std::vector<Interval> intervals;
+		while(!best.empty())
+		{
+			intervals.push_back(best.top());
+			best.pop();
+		}
+		return intervals;
+	}
+
+	// The suffix array only finds exact token matches, which pins the first XYZ2
+	// to the vertex before the repeat. Grows the match over a first XYZ2 that may
+	// sit anywhere (as long as Z matches) and over any other entries that match.
+	std::optional<Repeat> Grow(const flat_body& flat, const std::vector<size_t>& tokens, std::vector<size_t> starts, size_t length)
+	{
+		std::ranges::sort(starts);
+
+		const auto all = [&](const auto& pred) { return std::ranges::all_of(starts, pred); };
+
+		// Offset of the first XYZ2 if it can differ between copies
+		std::optional<size_t> free_xyz;
+		bool has_xyz = false;
+		for(size_t i = 0; i < length; i++)
+		{
+			has_xyz |= IsXYZ2(flat, starts.front() + i);
+		}
+
+		while(starts.front() > 0 && flat[starts.front() - 1])
+		{
+			const size_t ref = starts.front() - 1;
+			const script_entry& prev = *flat[ref];
+			bool ok = false;
+			if(prev.kind == script_entry::Kind::LINE)
+			{
+				ok = all([&](size_t s) { return tokens[s - 1] == tokens[ref]; });
+			}
+			else if(prev.kind == script_entry::Kind::XYZ2)
+			{
+				// The old first XYZ2 is now placed relative to this one
+				ok = all([&](size_t s) {
+					return IsXYZ2(flat, s - 1) && flat[s - 1]->xyz.z == prev.xyz.z &&
+						   (!free_xyz || tokens[s + *free_xyz] == tokens[starts.front() + *free_xyz]);
+				});
+			}
+
+			if(!ok)
+			{
+				break;
+			}
+
+			for(auto& s : starts)
+			{
+				s--;
+			}
+			length++;
+
+			if(prev.kind == script_entry::Kind::XYZ2)
+			{
+				free_xyz = 0;
+				has_xyz = true;
+			}
+			else if(free_xyz)
+			{
+				(*free_xyz)++;
+			}
+		}
+
+		while(flat[starts.front() + length])
+		{
+			const size_t ref = starts.front() + length;
+			const script_entry& next = *flat[ref];
+			bool ok = false;
+			if(next.kind == script_entry::Kind::LINE || (next.kind == script_entry::Kind::XYZ2 && has_xyz))
+			{
+				ok = all([&](size_t s) { return tokens[s + length] == tokens[ref]; });
+			}
+			else if(next.kind == script_entry::Kind::XYZ2)
+			{
+				ok = all([&](size_t s) { return IsXYZ2(flat, s + length) && flat[s + length]->xyz.z == next.xyz.z; });
+			}
+
+			if(!ok)
+			{
+				break;
+			}
+
+			has_xyz |= next.kind == script_entry::Kind::XYZ2;
+			length++;
+		}
+
+		// Copies of a periodic sequence overlap, keep the ones that don't
+		std::vector<size_t> picked;
+		for(const auto s : starts)
+		{
+			if(picked.empty() || s >= picked.back() + length)
+			{
+				picked.push_back(s);
+			}
+		}
+
+		const int64_t gain = Gain(length, picked.size());
+		if(length < 2 || picked.size() < 2 || gain <= 0)
+		{
+			return std::nullopt;
+		}
+
+		return Repeat{length, std::move(picked), gain};
+	}
+
+	// Extracts the best repeats found in the current sequence, along with any
+	// others that don't overlap them. Returns false once nothing is worth extracting.
+	bool ExtractRound(flat_body& flat, std::vector<script_body>& macros)
+	{
+		size_t alphabet = 0;
+		const auto tokens = Tokenize(flat, alphabet);
+		const auto sa = SuffixArray(tokens, alphabet);
+		const auto lcp = CommonPrefixes(tokens, sa);
+
+		std::vector<Repeat> repeats;
+		for(const auto& interval : BestIntervals(lcp))
+		{
+			std::vector<size_t> starts(sa.begin() + interval.lb, sa.begin() + interval.rb + 1);
+			if(auto repeat = Grow(flat, tokens, std::move(starts), interval.length))
+			{
+				repeats.push_back(std::move(*repeat));
+			}
+		}
+
+		std::ranges::sort(repeats, std::greater<>(), &Repeat::gain);
+
+		std::vector<bool> taken(flat.size(), false);
+		std::unordered_map<size_t, std::pair<script_entry, size_t>> insertions;
+		for(const auto& repeat : repeats)
+		{
+			std::vector<size_t> kept;
+			for(const auto s : repeat.starts)
+			{
+				if(std::none_of(taken.begin() + s, taken.begin() + s + repeat.length, [](bool t) { return t; }))
+				{
+					kept.push_back(s);
+				}
+			}
+
+			if(kept.size() < 2 || Gain(repeat.length, kept.size()) <= 0)
+			{
+				continue;
+			}
+
+			// The insertion offset moves the first XYZ2 into place. Offsets can't be
+			// negative, so the macro body sits at the lowest X and Y of all copies.
+			std::optional<size_t> anchor;
+			for(size_t i = 0; i < repeat.length; i++)
+			{
+				if(IsXYZ2(flat, kept.front() + i))
+				{
+					anchor = i;
+					break;
+				}
+			}
+
+			Vec2 base(UINT32_MAX, UINT32_MAX);
+			if(anchor)
+			{
+				for(const auto s : kept)
+				{
+					base.x = std::min(base.x, flat[s + *anchor]->xyz.x);
+					base.y = std::min(base.y, flat[s + *anchor]->xyz.y);
+				}
+			}
+
+			const auto offset_of = [&](size_t s) {
+				return anchor ? Vec2(flat[s + *anchor]->xyz.x - base.x, flat[s + *anchor]->xyz.y - base.y) : Vec2();
+			};
+
+			script_body body;
+			const Vec2 shift = offset_of(kept.front());
+			for(size_t i = 0; i < repeat.length; i++)
+			{
+				script_entry entry = *flat[kept.front() + i];
+				if(entry.kind == script_entry::Kind::XYZ2)
+				{
+					entry.xyz.x -= shift.x;
+					entry.xyz.y -= shift.y;
+				}
+				body.push_back(std::move(entry));
+			}
+
+			for(const auto s : kept)
+			{
+				std::fill_n(taken.begin() + s, repeat.length, true);
+				insertions.emplace(s, std::make_pair(script_entry{.kind = script_entry::Kind::MACRO, .macro = macros.size(), .has_offset = anchor.has_value(), .offset = offset_of(s)}, repeat.length));
+			}
+			macros.push_back(std::move(body));
+		}
+
+		if(insertions.empty())
+		{
+			return false;
+		}
+
+		flat_body rebuilt;
+		rebuilt.reserve(flat.size());
+		for(size_t i = 0; i < flat.size();)
+		{
+			const auto it = insertions.find(i);
+			if(it != insertions.end())
+			{
+				rebuilt.emplace_back(std::move(it->second.first));
+				i += it->second.second;
+			}
+			else
+			{
+				rebuilt.push_back(std::move(flat[i++]));
+			}
+		}
+		flat = std::move(rebuilt);
+		return true;
+	}
+} // namespace
+
+auto extract_repeats(std::vector<script_body>& blocks) -> std::vector<script_body>
+{
+	flat_body flat;
+	for(auto& block : blocks)
+	{
+		for(auto& entry : block)
+		{
+			flat.emplace_back(std::move(entry));
+		}
+		flat.emplace_back(std::nullopt);
+		block.clear();
+	}
+
+	std::vector<script_body> macros;
+	while(ExtractRound(flat, macros))
+	{
+	}
+
+	auto block = blocks.begin();
+	for(auto& entry : flat)
+	{
+		if(entry)
+		{
+			block->push_back(std::move(*entry));
+		}
+		else
+		{
+			++block;
+		}
+	}
+
+	return macros;
+}
@@ -0,0 +1,150 @@
+#include "stats.hpp"
+#include "logger.hpp"
+#include "version.hpp"
+
+#include <charconv>
+#include <fmt/core.h>
+
+namespace
+{
+	// Indexed by PrimType, named the way gifscript spells them
+	constexpr const char* const PrimTypeKeys[] = {
+		"point",
+		"line",
+		"linestrip",
+		"triangle",
+		"trianglestrip",
+		"trianglefan",
+		"sprite"};
+} // namespace
+
+auto stats_backend::arg_parse(int argc, char** argv) -> bool
+{
+	for(int i = 0; i < argc; i++)
+	{
+		const std::string_view arg = argv[i];
+		if(arg.starts_with("--b") && !arg.starts_with("--backend="))
+		{
+			const std::string_view arg2 = arg.substr(3);
+			if(arg2.starts_with("budget="))
+			{
+				const std::string_view value = arg2.substr(7);
+				uint64_t cycles = 0;
+				const auto [end, ec] = std::from_chars(value.begin(), value.end(), cycles);
+				if(ec != std::errc() || end != value.end())
+				{
+					logger::error("Invalid budget: %s\n", value.cbegin());
+					return false;
+				}
+				budget = cycles;
+			}
+			else if(arg2.compare("help") == 0)
+			{
+				print_help();
+				return false;
+			}
+			else
+			{
+				logger::error("Invalid stats option: %s\n", arg2.cbegin());
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void stats_backend::print_help() const
+{
+	fmt::print(
+		"stats backend options:\n"
+		"\t--bbudget=<cycles>\tFail if any block is estimated to take more GS cycles than this\n");
+}
+
+stats_backend::~stats_backend()
+{
+	write(fmt::format("\n\t],\n\t\"total\": {{{}}}\n}}\n", format_cost(total)));
+
+	close_output(file);
+}
+
+void stats_backend::emit(GIFBlock& block)
+{
+	logger::info("Emitting block: %s", block.name.c_str());
+	const bool first = first_emit;
+	const BlockCost cost = EstimateCost(block);
+
+	std::string entry = fmt::format("{}\n\t\t{{\"name\": \"{}\", {}", first ? "" : ",", block.name, format_cost(cost));
+	if(budget)
+	{
+		entry += fmt::format(", \"over_budget\": {}", cost.Cycles() > *budget);
+		if(cost.Cycles() > *budget)
+		{
+			logger::error("Block %s is estimated at %llu cycles, over the budget of %llu\n", block.name.c_str(),
+				static_cast<unsigned long long>(cost.Cycles()), static_cast<unsigned long long>(*budget));
+			over_budget = true;
+		}
+	}
+	entry += "}";
+	write(entry);
+
+	total.qwords += cost.qwords;
+	for(size_t prim = 0; prim < total.primitives.size(); prim++)
+	{
+		total.primitives[prim] += cost.primitives[prim];
+	}
+	total.state_changes += cost.state_changes;
+	total.texture_changes += cost.texture_changes;
+	total.pixels += cost.pixels;
+	total.textured_pixels += cost.textured_pixels;
+	total.transfer_cycles += cost.transfer_cycles;
+	total.setup_cycles += cost.setup_cycles;
+	total.fill_cycles += cost.fill_cycles;
+	total.texture_page_loads += cost.texture_page_loads;
+	total.texture_cycles += cost.texture_cycles;
+}
+
+void stats_backend::write(const std::string& text)
+{
+	if(first_emit)
+	{
+		first_emit = false;
+		file = open_output(output, "w");
+		if(file == nullptr)
+		{
+			logger::error("Failed to open file: %s\n", output.c_str());
+			return;
+		}
+
+		std::string prologue = fmt::format("{{\n\t\"version\": \"{}\",\n", GIT_VERSION);
+		if(budget)
+		{
+			prologue += fmt::format("\t\"budget\": {},\n", *budget);
+		}
+		prologue += "\t\"blocks\": [";
+		fwrite(prologue.c_str(), 1, prologue.size(), file);
+	}
+
+	if(file == nullptr)
+	{
+		return;
+	}
+
+	fwrite(text.c_str(), 1, text.size(), file);
+}
+
+auto stats_backend::format_cost(const BlockCost& cost) const -> std::string
+{
+	std::string primitives;
+	for(size_t prim = 0; prim < cost.primitives.size(); prim++)
+	{
+		primitives += fmt::format("{}\"{}\": {}", prim == 0 ? "" : ", ", PrimTypeKeys[prim], cost.primitives[prim]);
+	}
+
+	return fmt::format("\"qwords\": {}, \"bytes\": {}, \"primitives\": {{{}}}, \"state_changes\": {}, \"texture_changes\": {}, "
+					   "\"pixels\": {}, \"textured_pixels\": {}, \"texture_page_loads\": {}, "
+					   "\"transfer_cycles\": {}, \"setup_cycles\": {}, \"fill_cycles\": {}, \"texture_cycles\": {}, \"cycles\": {}",
+		cost.qwords, cost.Bytes(), primitives, cost.state_changes, cost.texture_changes,
+		cost.pixels, cost.textured_pixels, cost.texture_page_loads,
+		cost.transfer_cycles, cost.setup_cycles, cost.fill_cycles, cost.texture_cycles, cost.Cycles());
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Unpacks runs of A+D qwords several at a time. Each qword comes out as the
+// four 32bit fields DecodeAD pushes into its register, unused fields are 0.
+// Every level gives the same results, the scalar one is the reference.
+namespace simd
+{
+	enum class Level
+	{
+		Scalar,
+		SSE2,
+		AVX2,
+	};
+
+	// The widest level this CPU runs
+	[[nodiscard]] Level Best() noexcept;
+
+	// How many qwords from the first one write the same register address
+	[[nodiscard]] size_t ADRunLength(const uint64_t* qwords, size_t count, Level level) noexcept;
+
+	// Whether a run of this register address can be unpacked.
+	// Covers the per vertex registers, RGBAQ, ST, UV, XYZF2 and XYZ2.
+	[[nodiscard]] bool CanUnpack(uint64_t addr) noexcept;
+
+	// Unpacks count A+D qwords that all write addr, one set of fields per qword
+	void UnpackAD(const uint64_t* qwords, size_t count, uint64_t addr, uint32_t (*fields)[4], Level level) noexcept;
+} // namespace simd
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "logger.hpp"
+#include "machine.hpp"
+
+// Compiles a script inside the calling program rather than through the
+// gifscript executable. Nothing is printed and no global state is touched,
+// every call has a machine, parser and backend of its own, so calls on
+// different threads don't get in each other's way. Paths in vertices and
+// upload directives are still opened from the working directory.
+
+struct Diagnostic
+{
+	logger::Level level;
+	// The line being parsed when it was raised, 0 once the whole source is
+	// through, which is when backends that defer their output report
+	int line;
+	std::string message;
+};
+
+struct CompileOptions
+{
+	// c_code, elf, gifscript or stats
+	std::string backend = "c_code";
+	// Handed to the backend as they would be on the command line, like --bmagic
+	std::vector<std::string> backend_args;
+	std::vector<Machine::Optimization> disabled_optimizations;
+	std::vector<Machine::Optimization> enabled_optimizations;
+	// Texels per strip when splitting textured sprites, 0 leaves them whole
+	uint32_t sprite_strip_width = 0;
+	// Parse one line at a time, see Scanner
+	bool by_line = true;
+};
+
+struct CompileResult
+{
+	// The source parsed and the backend was happy with it
+	bool ok = false;
+	// What the backend would have written to its output file, text or an elf object
+	std::string output;
+	std::vector<Diagnostic> diagnostics;
+};
+
+[[nodiscard]] CompileResult CompileScript(std::string_view source, const CompileOptions& options = {});
+
+[[nodiscard]] inline CompileResult CompileScript(std::span<const uint8_t> source, const CompileOptions& options = {})
+{
+	return CompileScript(std::string_view(reinterpret_cast<const char*>(source.data()), source.size()), options);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "registers.hpp"
+
+// Ballpark figures for what a block costs the GS. Meant for comparing blocks
+// and scripts against each other, not for cycle exact numbers.
+namespace gs
+{
+	// 64bit GIF to GS bus, a qword takes two GS cycles
+	constexpr uint64_t GIF_CYCLES_PER_QWORD = 2;
+	// 75M untextured / 37.5M textured primitives a second at 150MHz
+	constexpr uint64_t SETUP_CYCLES = 2;
+	constexpr uint64_t TEXTURED_SETUP_CYCLES = 4;
+	// 16 pixel pipes, texturing halves them
+	constexpr uint64_t PIXELS_PER_CYCLE = 16;
+	constexpr uint64_t TEXTURED_PIXELS_PER_CYCLE = 8;
+	// The texture cache is modelled as holding a single CT32 page, loaded at 128 bytes a cycle
+	constexpr uint32_t TEXTURE_PAGE_WIDTH = 64;
+	constexpr uint32_t TEXTURE_PAGE_HEIGHT = 32;
+	constexpr uint64_t TEXTURE_PAGE_LOAD_CYCLES = 64;
+} // namespace gs
+
+struct BlockCost
+{
+	uint64_t qwords = 0;
+	// Indexed by PrimType
+	std::array<uint64_t, 7> primitives{};
+	// Writes to registers that hold drawing state rather than vertex data
+	uint64_t state_changes = 0;
+	uint64_t texture_changes = 0;
+	uint64_t pixels = 0;
+	uint64_t textured_pixels = 0;
+	// Only counted for sprites, the primitive big enough to thrash the cache
+	uint64_t texture_page_loads = 0;
+
+	uint64_t transfer_cycles = 0;
+	uint64_t setup_cycles = 0;
+	uint64_t fill_cycles = 0;
+	uint64_t texture_cycles = 0;
+
+	uint64_t Bytes() const noexcept
+	{
+		return qwords * 16;
+	}
+
+	// The GS draws while the next qwords come in, whichever is slower wins
+	uint64_t Cycles() const noexcept
+	{
+		return std::max(transfer_cycles, setup_cycles + fill_cycles + texture_cycles);
+	}
+};
+
+// Assembles primitives from the XYZ2 kicks of a block, the way the GS would,
+// and adds up their area. Starts from the tag PRIM, later PRIM writes switch
+// the primitive and restart the vertex queue.
+[[nodiscard]] BlockCost EstimateCost(const GIFBlock& block);
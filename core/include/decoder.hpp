@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "registers.hpp"
+
+// Turns GIF packet data back into registers without going through the
+// gifscript grammar. Decodes the same fields, and to the same values, as
+// tpircsfig does when it feeds tokens to the parser.
+
+struct GIFTag
+{
+	uint32_t NLOOP : 15;
+	uint32_t EOP : 1;
+	uint32_t : 16;
+	uint32_t : 14;
+	uint32_t PRE : 1;
+	uint32_t PRIM : 11;
+	uint32_t FLG : 2;
+	uint32_t NREG : 4;
+	uint64_t REGS;
+};
+
+static_assert(sizeof(GIFTag) == 16);
+
+// How many 64bit words of data follow a GIFtag
+[[nodiscard]] size_t TagDataWords(const GIFTag& tag) noexcept;
+
+// Whether a PACKED or REGLIST tag writes anything at all.
+// A block without registers is not a valid block.
+[[nodiscard]] bool TagHasRegisters(const GIFTag& tag) noexcept;
+
+// A register write in A+D form, nullptr if gifscript has no such register
+[[nodiscard]] std::unique_ptr<GifRegister> DecodeAD(uint64_t data, uint64_t addr);
+
+// Appends every register a PACKED or REGLIST tag writes to the block.
+// The tag data must hold TagDataWords(tag) words, offset is only used for diagnostics.
+void DecodeTag(const GIFTag& tag, const uint64_t* data, size_t offset, GIFBlock& block);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "registers.hpp"
+
+// Lays a block out in memory the same way the c_code backend does.
+// An A+D GIFtag followed by one (data, address) pair per register, two 64bit
+// words per qword. Blocks with more registers than NLOOP can hold are split
+// over several tags, only the first carries the PRIM and only the last sets EOP.
+// A block with nloop set sends its registers that many times, one loop being
+// the whole list with an A+D descriptor per register. A texture upload comes
+// last, an A+D tag for the transfer registers then IMAGE tags of pixels.
+[[nodiscard]] std::vector<uint64_t> EncodeBlock(const GIFBlock& block);
+
+// One field of a register the script marked as a patch field, where EncodeBlock put it.
+// A PRIM sent in the GIFtag is found in the tag, its fields moved up to the tag's PRIM bits.
+struct Patch
+{
+	// The name the script gave the register
+	std::string name;
+	// The field of that register, as in gs::RegisterFields
+	std::string field;
+	// From the start of the block's data
+	size_t qword;
+	uint8_t bit;
+	uint8_t width;
+};
+
+// Every field of every patch field in the block, in the order the registers are sent
+[[nodiscard]] std::vector<Patch> PatchTable(const GIFBlock& block);
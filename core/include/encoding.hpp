@@ -0,0 +1,226 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+// Bit layouts of the DMAtag, GIFtag and the GS registers gifscript knows about.
+// These mirror the DMA_SET_TAG, GIF_SET_TAG and GS_SET_* macros from ps2sdk, so
+// anything encoded here is bit for bit what the c_code backend output compiles to.
+namespace gs
+{
+	// PACKED register descriptors, the rest are plain register addresses
+	constexpr uint64_t GIF_REG_PRIM = 0x00;
+	constexpr uint64_t GIF_REG_RGBAQ = 0x01;
+	constexpr uint64_t GIF_REG_ST = 0x02;
+	constexpr uint64_t GIF_REG_UV = 0x03;
+	constexpr uint64_t GIF_REG_XYZF2 = 0x04;
+	constexpr uint64_t GIF_REG_XYZ2 = 0x05;
+	constexpr uint64_t GIF_REG_FOG = 0x0A;
+	constexpr uint64_t GIF_REG_AD = 0x0E;
+	constexpr uint64_t GIF_REG_NOP = 0x0F;
+	// Registers with no PACKED descriptor of their own, written through A+D
+	constexpr uint64_t GS_REG_TEX0_1 = 0x06;
+	constexpr uint64_t GS_REG_FOGCOL = 0x3D;
+	constexpr uint64_t GS_REG_SCISSOR_1 = 0x40;
+	constexpr uint64_t GS_REG_SIGNAL = 0x60;
+	constexpr uint64_t GS_REG_FINISH = 0x61;
+	constexpr uint64_t GS_REG_LABEL = 0x62;
+	// Host to local transfer registers, only ever written through A+D
+	constexpr uint64_t GS_REG_BITBLTBUF = 0x50;
+	constexpr uint64_t GS_REG_TRXPOS = 0x51;
+	constexpr uint64_t GS_REG_TRXREG = 0x52;
+	constexpr uint64_t GS_REG_TRXDIR = 0x53;
+	constexpr uint32_t GIF_NLOOP_MAX = 0x7FFF;
+
+	enum GifFlag : uint64_t
+	{
+		GIF_FLG_PACKED = 0,
+		GIF_FLG_REGLIST = 1,
+		GIF_FLG_IMAGE = 2,
+	};
+
+	// PRIM's primitive types
+	enum GsPrim : uint64_t
+	{
+		GS_PRIM_POINT = 0,
+		GS_PRIM_LINE = 1,
+		GS_PRIM_LINE_STRIP = 2,
+		GS_PRIM_TRIANGLE = 3,
+		GS_PRIM_TRIANGLE_STRIP = 4,
+		GS_PRIM_TRIANGLE_FAN = 5,
+		GS_PRIM_SPRITE = 6,
+	};
+
+	// Source chain tag IDs
+	enum DmaTagID : uint64_t
+	{
+		DMA_TAG_REFE = 0,
+		DMA_TAG_CNT = 1,
+		DMA_TAG_NEXT = 2,
+		DMA_TAG_REF = 3,
+		DMA_TAG_REFS = 4,
+		DMA_TAG_CALL = 5,
+		DMA_TAG_RET = 6,
+		DMA_TAG_END = 7,
+	};
+
+	constexpr uint64_t SetDMATag(uint64_t qwc, uint64_t pce, uint64_t id, uint64_t irq, uint64_t addr, uint64_t spr)
+	{
+		return (qwc & 0xFFFF) | (pce & 3) << 26 | (id & 7) << 28 | (irq & 1) << 31 | (addr & 0x7FFFFFFF) << 32 | (spr & 1) << 63;
+	}
+
+	constexpr uint64_t SetGIFTag(uint64_t nloop, uint64_t eop, uint64_t pre, uint64_t prim, uint64_t flg, uint64_t nreg)
+	{
+		return (nloop & 0x7FFF) | (eop & 1) << 15 | (pre & 1) << 46 | (prim & 0x7FF) << 47 | (flg & 3) << 58 | (nreg & 0xF) << 60;
+	}
+
+	// REGS for nreg A+D descriptors in a row, nreg from 1 to 16
+	constexpr uint64_t ADRegs(uint64_t nreg)
+	{
+		return 0xEEEEEEEEEEEEEEEEull >> ((16 - nreg) * 4);
+	}
+
+	constexpr uint64_t SetPRIM(uint64_t prim, uint64_t iip, uint64_t tme, uint64_t fge, uint64_t abe, uint64_t aa1, uint64_t fst, uint64_t ctxt, uint64_t fix)
+	{
+		return (prim & 7) | (iip & 1) << 3 | (tme & 1) << 4 | (fge & 1) << 5 | (abe & 1) << 6 | (aa1 & 1) << 7 | (fst & 1) << 8 | (ctxt & 1) << 9 | (fix & 1) << 10;
+	}
+
+	constexpr uint64_t SetRGBAQ(uint64_t r, uint64_t g, uint64_t b, uint64_t a, uint64_t q)
+	{
+		return (r & 0xFF) | (g & 0xFF) << 8 | (b & 0xFF) << 16 | (a & 0xFF) << 24 | (q & 0xFFFFFFFF) << 32;
+	}
+
+	constexpr uint64_t SetST(uint64_t s, uint64_t t)
+	{
+		return (s & 0xFFFFFFFF) | (t & 0xFFFFFFFF) << 32;
+	}
+
+	constexpr uint64_t SetUV(uint64_t u, uint64_t v)
+	{
+		return (u & 0x3FFF) | (v & 0x3FFF) << 16;
+	}
+
+	constexpr uint64_t SetXYZ(uint64_t x, uint64_t y, uint64_t z)
+	{
+		return (x & 0xFFFF) | (y & 0xFFFF) << 16 | (z & 0xFFFFFFFF) << 32;
+	}
+
+	constexpr uint64_t SetXYZF(uint64_t x, uint64_t y, uint64_t z, uint64_t f)
+	{
+		return (x & 0xFFFF) | (y & 0xFFFF) << 16 | (z & 0xFFFFFF) << 32 | (f & 0xFF) << 56;
+	}
+
+	constexpr uint64_t SetTEX0(uint64_t tbp, uint64_t tbw, uint64_t psm, uint64_t tw, uint64_t th, uint64_t tcc, uint64_t tfx,
+		uint64_t cbp, uint64_t cpsm, uint64_t csm, uint64_t csa, uint64_t cld)
+	{
+		return (tbp & 0x3FFF) | (tbw & 0x3F) << 14 | (psm & 0x3F) << 20 | (tw & 0xF) << 26 | (th & 0xF) << 30 | (tcc & 1) << 34 | (tfx & 3) << 35 |
+			   (cbp & 0x3FFF) << 37 | (cpsm & 0xF) << 51 | (csm & 1) << 55 | (csa & 0x1F) << 56 | (cld & 7) << 61;
+	}
+
+	constexpr uint64_t SetFOG(uint64_t f)
+	{
+		return (f & 0xFF) << 56;
+	}
+
+	constexpr uint64_t SetFOGCOL(uint64_t r, uint64_t g, uint64_t b)
+	{
+		return (r & 0xFF) | (g & 0xFF) << 8 | (b & 0xFF) << 16;
+	}
+
+	constexpr uint64_t SetSCISSOR(uint64_t x0, uint64_t x1, uint64_t y0, uint64_t y1)
+	{
+		return (x0 & 0x7FF) | (x1 & 0x7FF) << 16 | (y0 & 0x7FF) << 32 | (y1 & 0x7FF) << 48;
+	}
+
+	constexpr uint64_t SetSIGNAL(uint64_t id, uint64_t msk)
+	{
+		return (id & 0xFFFFFFFF) | (msk & 0xFFFFFFFF) << 32;
+	}
+
+	constexpr uint64_t SetFINISH(uint64_t a)
+	{
+		return a;
+	}
+
+	constexpr uint64_t SetBITBLTBUF(uint64_t sbp, uint64_t sbw, uint64_t spsm, uint64_t dbp, uint64_t dbw, uint64_t dpsm)
+	{
+		return (sbp & 0x3FFF) | (sbw & 0x3F) << 16 | (spsm & 0x3F) << 24 | (dbp & 0x3FFF) << 32 | (dbw & 0x3F) << 48 | (dpsm & 0x3F) << 56;
+	}
+
+	constexpr uint64_t SetTRXPOS(uint64_t ssax, uint64_t ssay, uint64_t dsax, uint64_t dsay, uint64_t dir)
+	{
+		return (ssax & 0x7FF) | (ssay & 0x7FF) << 16 | (dsax & 0x7FF) << 32 | (dsay & 0x7FF) << 48 | (dir & 3) << 59;
+	}
+
+	constexpr uint64_t SetTRXREG(uint64_t rrw, uint64_t rrh)
+	{
+		return (rrw & 0xFFF) | (rrh & 0xFFF) << 32;
+	}
+
+	constexpr uint64_t SetTRXDIR(uint64_t xdir)
+	{
+		return xdir & 3;
+	}
+
+	constexpr uint64_t SetLABEL(uint64_t id, uint64_t msk)
+	{
+		return (id & 0xFFFFFFFF) | (msk & 0xFFFFFFFF) << 32;
+	}
+
+	// A field of a register value, for patching it in place. bit is its lowest bit.
+	// Values are stored as the GS reads them, X and Y are 12.4 fixed point and UV 10.4.
+	struct Field
+	{
+		const char* name;
+		uint8_t bit;
+		uint8_t width;
+	};
+
+	constexpr Field PRIM_FIELDS[] = {{"type", 0, 3}, {"gouraud", 3, 1}, {"texture", 4, 1}, {"fogging", 5, 1}, {"aa1", 7, 1}};
+	constexpr Field RGBAQ_FIELDS[] = {{"r", 0, 8}, {"g", 8, 8}, {"b", 16, 8}, {"a", 24, 8}, {"q", 32, 32}};
+	constexpr Field ST_FIELDS[] = {{"s", 0, 32}, {"t", 32, 32}};
+	constexpr Field UV_FIELDS[] = {{"u", 0, 14}, {"v", 16, 14}};
+	constexpr Field XYZF2_FIELDS[] = {{"x", 0, 16}, {"y", 16, 16}, {"z", 32, 24}, {"f", 56, 8}};
+	constexpr Field XYZ2_FIELDS[] = {{"x", 0, 16}, {"y", 16, 16}, {"z", 32, 32}};
+	constexpr Field TEX0_FIELDS[] = {{"tbp", 0, 14}, {"tbw", 14, 6}, {"psm", 20, 6}, {"tw", 26, 4}, {"th", 30, 4}, {"tcc", 34, 1}, {"tfx", 35, 2}};
+	constexpr Field FOG_FIELDS[] = {{"f", 56, 8}};
+	constexpr Field FOGCOL_FIELDS[] = {{"r", 0, 8}, {"g", 8, 8}, {"b", 16, 8}};
+	constexpr Field SCISSOR_FIELDS[] = {{"x0", 0, 11}, {"x1", 16, 11}, {"y0", 32, 11}, {"y1", 48, 11}};
+	constexpr Field ID_MASK_FIELDS[] = {{"id", 0, 32}, {"mask", 32, 32}};
+	constexpr Field FINISH_FIELDS[] = {{"value", 0, 64}};
+
+	// The fields of the register at address, in the order patch tables list them
+	constexpr std::span<const Field> RegisterFields(uint64_t address)
+	{
+		switch(address)
+		{
+			case GIF_REG_PRIM:
+				return PRIM_FIELDS;
+			case GIF_REG_RGBAQ:
+				return RGBAQ_FIELDS;
+			case GIF_REG_ST:
+				return ST_FIELDS;
+			case GIF_REG_UV:
+				return UV_FIELDS;
+			case GIF_REG_XYZF2:
+				return XYZF2_FIELDS;
+			case GIF_REG_XYZ2:
+				return XYZ2_FIELDS;
+			case GS_REG_TEX0_1:
+				return TEX0_FIELDS;
+			case GIF_REG_FOG:
+				return FOG_FIELDS;
+			case GS_REG_FOGCOL:
+				return FOGCOL_FIELDS;
+			case GS_REG_SCISSOR_1:
+				return SCISSOR_FIELDS;
+			case GS_REG_SIGNAL:
+			case GS_REG_LABEL:
+				return ID_MASK_FIELDS;
+			case GS_REG_FINISH:
+				return FINISH_FIELDS;
+			default:
+				return {};
+		}
+	}
+}; // namespace gs
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Integer expression over macro parameters. Kept as a tree and evaluated
+// every time the macro is inserted, with that insertion's arguments.
+// Arithmetic is done in 64 bits, results wrap into the 32bit register fields.
+class Expr
+{
+public:
+	enum class Op
+	{
+		Constant,
+		Parameter,
+		Negate,
+		Add,
+		Subtract,
+		Multiply,
+		Divide,
+	};
+
+	using Bindings = std::map<std::string, int64_t>;
+
+	static Expr Constant(int64_t value);
+	static Expr Parameter(const std::string& name);
+	static Expr Unary(Op op, Expr operand);
+	static Expr Binary(Op op, Expr lhs, Expr rhs);
+
+	Op GetOp() const noexcept
+	{
+		return op;
+	}
+
+	// The name of a bare parameter, empty for anything else
+	const std::string& GetName() const noexcept
+	{
+		return name;
+	}
+
+	// std::nullopt when a parameter is not bound or there is a division by zero
+	[[nodiscard]] std::optional<int64_t> Evaluate(const Bindings& bindings) const;
+
+	// Appends the name of every parameter the expression reads
+	void CollectParameters(std::vector<std::string>& names) const;
+
+private:
+	Op op = Op::Constant;
+	int64_t value = 0;
+	std::string name;
+	std::shared_ptr<const Expr> lhs;
+	std::shared_ptr<const Expr> rhs;
+};
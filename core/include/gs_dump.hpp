@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+// Walks the packets of a GS dump as PCSX2 records them (.gs, uncompressed).
+// A dump is a header, a snapshot of the GS state and privileged registers,
+// then packets in the order the GS saw them: GIF transfers on each path,
+// vsyncs and fresh register snapshots. Only the transfers carry GIF data,
+// the rest is counted or stepped over.
+class GSDump
+{
+public:
+	// Which path a transfer came in on, as PCSX2 numbers them
+	enum class Path : uint8_t
+	{
+		Path1Old,
+		Path2,
+		Path3,
+		Path1New,
+		Dummy,
+	};
+
+	struct Transfer
+	{
+		Path path;
+		// Where the data starts in the dump
+		size_t offset;
+		std::span<const uint8_t> data;
+	};
+
+	explicit GSDump(std::span<const uint8_t> dump) noexcept
+		: dump(dump)
+	{
+	}
+
+	// Checks the header and steps over the state and register snapshot
+	[[nodiscard]] bool TryOpen();
+
+	// The next GIF transfer, std::nullopt once the packets run out or one is broken
+	[[nodiscard]] std::optional<Transfer> Next();
+
+	// Whether the packets ended in the middle of one
+	[[nodiscard]] bool Failed() const noexcept
+	{
+		return failed;
+	}
+
+	// How far into the dump the packets have been walked
+	[[nodiscard]] size_t Offset() const noexcept
+	{
+		return pos;
+	}
+
+	// Vsyncs seen so far, one per frame
+	[[nodiscard]] size_t Frames() const noexcept
+	{
+		return frames;
+	}
+
+private:
+	std::span<const uint8_t> dump;
+	size_t pos = 0;
+	size_t frames = 0;
+	bool failed = false;
+
+	// Reads a little endian field, false if the dump ends first
+	template <typename T>
+	bool TryRead(T& value);
+	// Steps over size bytes, false if the dump ends first
+	bool TrySkip(size_t size);
+};
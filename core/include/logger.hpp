@@ -2,12 +2,48 @@
 
 #include <fmt/core.h>
 #include <fmt/color.h>
+#include <functional>
 #include <source_location>
+#include <string>
 
 namespace logger
 {
 	// Primarily used to disable logging in tests
 	extern bool g_log_enabled;
+
+	enum class Level
+	{
+		Info,
+		Warn,
+		Error,
+		Debug,
+	};
+
+	// Takes the messages logged on its thread instead of stdout while it is alive,
+	// for running the compiler inside another program. Sinks nest, the innermost wins.
+	class ScopedSink
+	{
+	public:
+		using Sink = std::function<void(Level, std::string)>;
+
+		explicit ScopedSink(Sink sink);
+		~ScopedSink();
+
+		ScopedSink(const ScopedSink&) = delete;
+		ScopedSink& operator=(const ScopedSink&) = delete;
+
+		// The sink of the calling thread, nullptr if nothing took it
+		static ScopedSink* Current() noexcept;
+
+		void operator()(Level level, std::string message) const
+		{
+			sink(level, std::move(message));
+		}
+
+	private:
+		Sink sink;
+		ScopedSink* previous;
+	};
 #define CHECK_LOGGING_ENABLED() \
 	if(!g_log_enabled) \
 		return;
@@ -25,21 +61,48 @@ namespace logger
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wformat-security"
+	template <typename... Args>
+	std::string format_message(const char* format, Args&&... args)
+	{
+		const int size_s = std::snprintf(nullptr, 0, format, args...);
+		std::string buf(size_s, '\0');
+		std::snprintf(buf.data(), size_s + 1, format, args...);
+		// Some messages still end in a newline of their own
+		while(!buf.empty() && buf.back() == '\n')
+		{
+			buf.pop_back();
+		}
+		return buf;
+	}
+#pragma GCC diagnostic pop
+
 	template <typename... Args>
 	void log(fmt_location format, fmt::color fgcol, Args&&... args)
 	{
 		CHECK_LOGGING_ENABLED();
-		int size_s = std::snprintf(nullptr, 0, format.fmt, std::forward<Args>(args)...);
-		char* buf = new char[size_s + 1];
-		std::snprintf(buf, size_s + 1, format.fmt, std::forward<Args>(args)...);
-		fmt::print(fg(fgcol), "{}: {}\n", format.location.function_name(), buf);
+		fmt::print(fg(fgcol), "{}: {}\n", format.location.function_name(), format_message(format.fmt, std::forward<Args>(args)...));
+	}
 
-		delete[] buf;
+	// Hands the message to the thread's sink if it has one, true if it did
+	template <typename... Args>
+	bool sink(Level level, const fmt_location& format, Args&&... args)
+	{
+		const ScopedSink* current = ScopedSink::Current();
+		if(current == nullptr)
+		{
+			return false;
+		}
+		(*current)(level, format_message(format.fmt, std::forward<Args>(args)...));
+		return true;
 	}
-#pragma GCC diagnostic pop
+
 	template <typename... Args>
 	void info(fmt_location format, Args&&... args)
 	{
+		if(sink(Level::Info, format, args...))
+		{
+			return;
+		}
 		CHECK_LOGGING_ENABLED();
 		fmt::print(fg(fmt::color::blue), "[INFO ] ");
 		log(format, fmt::color::blue, std::forward<Args>(args)...);
@@ -48,6 +111,10 @@ namespace logger
 	template <typename... Args>
 	void warn(fmt_location format, Args&&... args)
 	{
+		if(sink(Level::Warn, format, args...))
+		{
+			return;
+		}
 		CHECK_LOGGING_ENABLED();
 		fmt::print(fg(fmt::color::yellow), "[WARN ] ");
 		log(format, fmt::color::yellow, std::forward<Args>(args)...);
@@ -56,6 +123,10 @@ namespace logger
 	template <typename... Args>
 	void error(fmt_location format, Args&&... args)
 	{
+		if(sink(Level::Error, format, args...))
+		{
+			return;
+		}
 		CHECK_LOGGING_ENABLED();
 		fmt::print(fg(fmt::color::red), "[ERROR] ");
 		log(format, fmt::color::red, std::forward<Args>(args)...);
@@ -64,6 +135,10 @@ namespace logger
 	template <typename... Args>
 	void debug(fmt_location format, Args&&... args)
 	{
+		if(sink(Level::Debug, format, args...))
+		{
+			return;
+		}
 		CHECK_LOGGING_ENABLED();
 		fmt::print(fg(fmt::color::green), "[DEBUG] ");
 		log(format, fmt::color::green, std::forward<Args>(args)...);
@@ -4,23 +4,79 @@
 #include <list>
 #include <map>
 #include <bitset>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 #include "registers.hpp"
 #include "backend.hpp"
+#include "expr.hpp"
 
 class Machine
 {
 	Backend* backend = &dummy_backend;
 
+	// Only the block being built, blocks are dropped once emitted
 	std::list<GIFBlock> blocks;
+	// Every block name so far, names stay taken after the block is gone
+	std::unordered_set<std::string> blockNames;
 	std::map<std::string, GIFBlock> macros;
 	// Do not use this to push registers
 	std::list<GIFBlock>::iterator currentBlockIt = blocks.end();
 	// Do not use this to push registers
 	std::map<std::string, GIFBlock>::iterator currentMacroIt = macros.end();
 
-	std::bitset<8> OptimizeConfig = std::bitset<8>().set();
+	// Passes that rely on assumptions about the rest of the GS state are opt in
+	std::bitset<8> OptimizeConfig = std::bitset<8>().set().reset(SCISSOR_CULLING);
+	// Texels wide the strips textured sprites are split into, 0 leaves them whole
+	uint32_t spriteStripWidth = 0;
+
+	// The open repeat, its body is every register of the current block or macro from repeatStart on.
+	// A count of 0 means no repeat is open.
+	size_t repeatStart = 0;
+	uint32_t repeatCount = 0;
+
+	// Given to the next register set, marked by a patch statement
+	std::string pendingPatch;
+
+	// One call made while a macro with parameters was open, replayed on every insertion
+	struct MacroStep
+	{
+		enum class Kind
+		{
+			SetRegister,
+			Push,
+			Modifier,
+			Insert,
+			InsertOffset,
+			StartRepeat,
+			EndRepeat,
+		};
+
+		Kind kind;
+		// SetRegister, a fresh copy is set on every replay
+		std::shared_ptr<GifRegister> reg;
+		// Push, Insert and InsertOffset, evaluated with the insertion's arguments
+		std::vector<Expr> args;
+		RegModifier mod = RegModifier::Point;
+		// Insert, InsertOffset and the count of StartRepeat
+		std::string macro;
+		uint32_t count = 0;
+	};
+
+	struct MacroTemplate
+	{
+		std::vector<std::string> params;
+		std::vector<MacroStep> steps;
+	};
+
+	// Macros with parameters, their entry in macros only keeps the name taken
+	std::map<std::string, MacroTemplate> templates;
+	// The macro with parameters being defined, its calls are recorded instead of run
+	MacroTemplate* recording = nullptr;
+	// How deep insertions of macros with parameters are nested, a macro inserting itself would never end
+	size_t insertDepth = 0;
+	static constexpr size_t MAX_INSERT_DEPTH = 64;
 
 	bool HasCurrentBlock() const noexcept { return currentBlockIt != blocks.end(); }
 	bool HasCurrentMacro() const noexcept { return currentMacroIt != macros.end(); }
@@ -55,6 +111,10 @@ public:
 	{
 		DEAD_STORE_ELIMINATION = 1,
 		USE_TAG_PRIM = 2,
+		SCISSOR_CULLING = 3,
+		DEGENERATE_REMOVAL = 4,
+		GOURAUD_DEMOTION = 5,
+		SPRITE_MERGING = 6,
 	};
 
 	~Machine()
@@ -67,9 +127,28 @@ public:
 	bool TryStartBlock(const std::string&);
 	bool TryStartMacro(const std::string&);
 	bool TryEndBlockMacro();
+	// Emits a block built outside of the machine, as if it was started, filled and ended here.
+	// The name is not checked or kept, it is on the caller to hand out unique ones.
+	bool TryEmitBlock(GIFBlock& block);
+	// Starts a repeat in the current block or macro, its registers are sent count times
+	bool TryStartRepeat(uint32_t count);
 	bool TryInsertMacro(const std::string&);
 	bool TryInsertMacro(const std::string&, Vec2);
+	// Starts a macro with named parameters, registers in it can take expressions over them
+	bool TryStartMacro(const std::string&, const std::vector<std::string>& params);
+	// Inserts a macro with parameters, one argument per parameter
+	bool TryInsertMacro(const std::string&, const std::vector<Expr>& args);
+	// Pushes one to four values computed from expressions, a parameter is only known inside a macro
+	bool TryPushReg(const std::vector<Expr>& values);
 	bool TrySetRegister(std::unique_ptr<GifRegister> reg);
+	// Names the next register set in the current block as a patch field, so backends list where its fields end up
+	bool TryMarkPatch(const std::string& name);
+	// Appends the vertices of a binary file, each one the registers of layout in order.
+	// Every register value is its fields as little endian 32bit words, as they would be pushed.
+	bool TryImportVertices(const std::string& path, const std::vector<GifRegisters>& layout);
+	// Sends the pixels of a raw file to VRAM once the current block's registers are out.
+	// The upload has to be the last thing in its block, rect is x, y, width and height.
+	bool TryUploadTexture(const std::string& path, uint32_t tbp, uint32_t tbw, PSM psm, Vec4 rect);
 	bool TryPushReg(int32_t);
 	bool TryPushReg(Vec2);
 	bool TryPushReg(Vec3);
@@ -81,8 +160,28 @@ public:
 		OptimizeConfig[op] = false;
 	}
 
+	void EnableOptimization(Optimization op)
+	{
+		OptimizeConfig[op] = true;
+	}
+
+	// Off by default, the strips take more qwords to send than the whole sprite
+	void SetSpriteStripWidth(uint32_t width) noexcept
+	{
+		spriteStripWidth = width;
+	}
+
 private:
-	void FirstPassOptimize();
+	void FirstPassOptimize(GIFBlock& block);
+	bool TryEndRepeat();
+	// Checks the expressions only read parameters of the macro being recorded
+	bool TryCheckParameters(const std::vector<Expr>& exprs) const;
+	// A texture upload has to come last in its block, logs an error if the current one has one
+	bool TryCheckNoUpload();
+	bool TryReplay(const std::string& name, const MacroTemplate& macro, const Expr::Bindings& bindings);
+	bool TryPushValues(const std::vector<int64_t>& values);
+	void Record(MacroStep step);
+	// Writes out a block sent by a single repeat, so more registers can follow it
+	void Unroll(GIFBlock& block);
 };
 
-extern Machine machine;
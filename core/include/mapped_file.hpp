@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+// Read only view of a whole file, mapped rather than read so that inputs far
+// larger than memory can be walked in place.
+class MappedFile
+{
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	// Everything before this has been handed back with Release
+	size_t released = 0;
+
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool TryOpen(const std::string& path);
+
+	const uint8_t* Data() const noexcept
+	{
+		return data;
+	}
+
+	size_t Size() const noexcept
+	{
+		return size;
+	}
+
+	// The file as an array of T, any trailing bytes that don't fill a T are left out.
+	// Mappings start on a page boundary, so any T up to that alignment is safe.
+	template <typename T>
+	std::span<const T> As() const noexcept
+	{
+		return {reinterpret_cast<const T*>(data), size / sizeof(T)};
+	}
+
+	// Drops the pages before offset from memory. Reading them again still works,
+	// they just come back from the file. Keeps a single pass over a huge file
+	// from growing the resident set.
+	void Release(size_t offset) noexcept;
+};
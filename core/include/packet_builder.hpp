@@ -0,0 +1,166 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "encoding.hpp"
+
+// Builds GIF packets at runtime, for geometry that changes every frame.
+// Registers are appended as A+D pairs into a buffer the caller owns, laid out
+// like EncodeBlock does, so nothing is allocated and a frame's packet can be
+// rebuilt in place. The GIFtag in front of them is filled in as it closes:
+// a PRIM pushed before anything else goes in the tag, a tag that reaches
+// GIF_NLOOP_MAX is closed and a new one opened, and Finish sets EOP on the last.
+// Coordinates are in the same units as gifscript, whole pixels and texels.
+//
+// Header only and depending on nothing but encoding.hpp, so it can be dropped
+// into the program that sends the packets.
+class PacketBuilder
+{
+public:
+	// The buffer should be 16 byte aligned for DMA, it is filled two words to a qword
+	explicit PacketBuilder(std::span<uint64_t> buffer) noexcept
+		: buffer(buffer.first(buffer.size() & ~size_t{1}))
+	{
+	}
+
+	void PushPrim(gs::GsPrim type, bool gouraud = false, bool textured = false, bool fogging = false, bool aa1 = false) noexcept
+	{
+		const uint64_t prim = gs::SetPRIM(type, gouraud, textured, fogging, 0, aa1, 1, 0, 0);
+		if(tag == NO_TAG && !TryOpen())
+		{
+			return;
+		}
+
+		// Nothing has been written behind the tag yet, it can carry the PRIM
+		if(nloop == 0 && !pre)
+		{
+			pre = true;
+			tagPrim = prim;
+			return;
+		}
+
+		PushAD(prim, gs::GIF_REG_PRIM);
+	}
+
+	// Q is written as the float the GS reads, gifscript leaves it at 0
+	void PushRGBAQ(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 0xFF, float q = 0.0f) noexcept
+	{
+		PushAD(gs::SetRGBAQ(r, g, b, a, std::bit_cast<uint32_t>(q)), gs::GIF_REG_RGBAQ);
+	}
+
+	void PushST(float s, float t) noexcept
+	{
+		PushAD(gs::SetST(std::bit_cast<uint32_t>(s), std::bit_cast<uint32_t>(t)), gs::GIF_REG_ST);
+	}
+
+	void PushUV(uint32_t u, uint32_t v) noexcept
+	{
+		PushAD(gs::SetUV(uint64_t{u} << 4, uint64_t{v} << 4), gs::GIF_REG_UV);
+	}
+
+	void PushXYZ2(uint32_t x, uint32_t y, uint32_t z) noexcept
+	{
+		PushAD(gs::SetXYZ(uint64_t{x} << 4, uint64_t{y} << 4, z), gs::GIF_REG_XYZ2);
+	}
+
+	void PushXYZF2(uint32_t x, uint32_t y, uint32_t z, uint8_t f) noexcept
+	{
+		PushAD(gs::SetXYZF(uint64_t{x} << 4, uint64_t{y} << 4, z, f), gs::GIF_REG_XYZF2);
+	}
+
+	// Any other register, or coordinates that need the 4 fractional bits
+	void PushAD(uint64_t value, uint64_t address) noexcept
+	{
+		if((tag == NO_TAG || nloop == gs::GIF_NLOOP_MAX) && !TryOpen())
+		{
+			return;
+		}
+
+		if(buffer.size() - pos < 2)
+		{
+			overflowed = true;
+			return;
+		}
+
+		buffer[pos++] = value;
+		buffer[pos++] = address;
+		nloop++;
+	}
+
+	// Sets EOP on the open tag and returns everything written so far.
+	// Anything pushed afterwards starts a new packet behind it.
+	std::span<const uint64_t> Finish() noexcept
+	{
+		Close(true);
+		return Data();
+	}
+
+	std::span<const uint64_t> Data() const noexcept
+	{
+		return buffer.first(pos);
+	}
+
+	// The size for the DMA transfer
+	size_t Qwords() const noexcept
+	{
+		return pos / 2;
+	}
+
+	// Starts over at the front of the buffer
+	void Reset() noexcept
+	{
+		pos = 0;
+		tag = NO_TAG;
+		overflowed = false;
+	}
+
+	// Whether a push did not fit, the packet is cut short and should not be sent
+	bool Overflowed() const noexcept
+	{
+		return overflowed;
+	}
+
+private:
+	static constexpr size_t NO_TAG = SIZE_MAX;
+
+	std::span<uint64_t> buffer;
+	size_t pos = 0;
+	// Where the open tag is, its NLOOP and PRIM are written when it closes
+	size_t tag = NO_TAG;
+	size_t nloop = 0;
+	uint64_t tagPrim = 0;
+	bool pre = false;
+	bool overflowed = false;
+
+	void Close(bool eop) noexcept
+	{
+		if(tag == NO_TAG)
+		{
+			return;
+		}
+
+		buffer[tag] = gs::SetGIFTag(nloop, eop, pre, tagPrim, gs::GIF_FLG_PACKED, 1);
+		buffer[tag + 1] = gs::ADRegs(1);
+		tag = NO_TAG;
+	}
+
+	bool TryOpen() noexcept
+	{
+		Close(false);
+		if(overflowed || buffer.size() - pos < 2)
+		{
+			overflowed = true;
+			return false;
+		}
+
+		tag = pos;
+		pos += 2;
+		nloop = 0;
+		tagPrim = 0;
+		pre = false;
+		return true;
+	}
+};
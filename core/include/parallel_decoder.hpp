@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "decoder.hpp"
+
+// Decodes windows of GIFtags on a pool of threads.
+// A window is handed over with Submit and picked back up with Wait, so the
+// caller can emit the previous window while the next one decodes. Each tag
+// decodes into the block at the same index, stream order is kept that way.
+class ParallelDecoder
+{
+public:
+	explicit ParallelDecoder(size_t threads);
+	~ParallelDecoder();
+
+	ParallelDecoder(const ParallelDecoder&) = delete;
+	ParallelDecoder& operator=(const ParallelDecoder&) = delete;
+
+	// Starts decoding the tags at the given word positions of the input.
+	// blocks must be as large as tags, both stay untouched until Wait returns.
+	void Submit(const uint64_t* words, std::span<const size_t> tags, std::span<GIFBlock> blocks);
+	// Blocks until the submitted window is decoded
+	void Wait();
+
+private:
+	// Tags a worker takes at a time
+	static constexpr size_t CHUNK_TAGS = 256;
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	// Bumped for every window, a worker picks up each one once
+	size_t generation = 0;
+	// Workers that have not finished the current window yet
+	size_t busy = 0;
+	bool stopping = false;
+
+	const uint64_t* words = nullptr;
+	std::span<const size_t> tags;
+	std::span<GIFBlock> blocks;
+	std::atomic<size_t> next = 0;
+
+	void Work();
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "registers.hpp"
+
+// Rewrites of a block's registers that leave what the GS draws the same but
+// change what it costs to draw. Each one returns how much it changed, blocks
+// sent with an NLOOP are left alone.
+
+// Splits textured sprites into strips at every multiple of width in U, so each
+// strip reads its texels from a single column of texture pages. Only sprites
+// written as UV XYZ2 UV XYZ2 are split, and only where every cut lands on a
+// whole pixel. Returns how many sprites were split.
+[[nodiscard]] size_t SplitSprites(GIFBlock& block, uint32_t width);
+
+// Removes primitives whose bounding box is entirely outside the SCISSOR they
+// are drawn with. Only a SCISSOR set earlier in the block is known, and the
+// vertices are taken to be window coordinates, as with an XYOFFSET of 0.
+// Returns how many primitives were removed.
+[[nodiscard]] size_t CullOutsideScissor(GIFBlock& block);
+
+// Removes zero area triangles and zero size sprites, which includes every one
+// with a vertex repeated. Triangle strips keep the winding of the triangles
+// left after a restart. Returns how many vertices were dropped.
+[[nodiscard]] size_t RemoveDegenerates(GIFBlock& block);
+
+// Clears the gouraud bit of PRIM writes whose vertices all have the same
+// color and drops the RGBAQ writes left repeating it. The color at each
+// vertex has to be set in the block. The block's last PRIM is left alone,
+// blocks after it that don't write their own draw with it.
+// Returns how many PRIM writes changed.
+[[nodiscard]] size_t DemoteGouraud(GIFBlock& block);
+
+// Merges untextured sprites of the same color and depth that share an edge,
+// first along rows and then along columns. Only sprites written back to back
+// with nothing but their colors in between are merged, and only when none of
+// them overlap, as they may be redrawn in another order. Returns how many
+// sprites were merged away.
+[[nodiscard]] size_t MergeSprites(GIFBlock& block);
@@ -2,9 +2,12 @@
 
 #include "types.hpp"
 #include "logger.hpp"
+#include "encoding.hpp"
+#include "mapped_file.hpp"
 #include <optional>
 #include <iostream>
 #include <algorithm>
+#include <array>
 #include <memory>
 #include <fmt/core.h>
 #include <list>
@@ -14,7 +17,9 @@ enum class GifRegisters
 {
 	PRIM,
 	RGBAQ,
+	ST,
 	UV,
+	XYZF2,
 	XYZ2,
 	TEX0,
 	FOG,
@@ -29,7 +34,9 @@ enum class GifRegisterID
 {
 	PRIM = 0x00,
 	RGBAQ = 0x01,
+	ST = 0x02,
 	UV = 0x03,
+	XYZF2 = 0x04,
 	XYZ2 = 0x05,
 	TEX0 = 0x06,
 	FOG = 0x0A,
@@ -43,7 +50,9 @@ enum class GifRegisterID
 constexpr const char* const GifRegisterStrings[] = {
 	"PRIM",
 	"RGBAQ",
+	"ST",
 	"UV",
+	"XYZF2",
 	"XYZ2",
 	"TEX0",
 	"FOG",
@@ -68,6 +77,8 @@ enum RegModifier : uint32_t
 	Fogging,
 	AA1,
 	Texture,
+	// Textures are addressed with ST and Q rather than UV, clears FST
+	STQ,
 
 	// TEX0
 	CT32,
@@ -112,6 +123,8 @@ class GifRegister
 	std::string name;
 	RAT rat;
 	bool sideEffects;
+	// Set when the script marks the register as a patch field
+	std::string patch;
 
 public:
 	// Set sideEffects to true if the register should not be considered for dead store elimination
@@ -145,6 +158,17 @@ public:
 		return name;
 	}
 
+	// The name the runtime patches this register's fields by, empty for most registers
+	const std::string& GetPatch() const noexcept
+	{
+		return patch;
+	}
+
+	void SetPatch(const std::string& name)
+	{
+		patch = name;
+	}
+
 	virtual bool Ready() const noexcept = 0;
 
 	virtual bool Push(uint32_t) = 0;
@@ -154,6 +178,9 @@ public:
 
 	virtual bool ApplyModifier(RegModifier) = 0;
 
+	// The 64bit value written to the GS register, as it appears in A+D data
+	virtual uint64_t Encode() const = 0;
+
 	[[nodiscard]] virtual std::unique_ptr<GifRegister> Clone() = 0;
 };
 
@@ -184,6 +211,7 @@ struct PRIM : public GifRegister
 	bool aa1 = false;
 	bool fogging = false;
 	bool texture = false;
+	bool fst = true;
 
 public:
 	PRIM()
@@ -253,6 +281,9 @@ public:
 			case Texture:
 				texture = true;
 				break;
+			case STQ:
+				fst = false;
+				break;
 			default:
 				return false;
 		}
@@ -285,6 +316,17 @@ public:
 		return texture;
 	}
 
+	// Whether texture coordinates come from UV, otherwise from ST and Q
+	bool IsUV() const noexcept
+	{
+		return fst;
+	}
+
+	uint64_t Encode() const override
+	{
+		return gs::SetPRIM(static_cast<uint64_t>(GetType()), gouraud, texture, fogging, 0, aa1, fst, 0, 0);
+	}
+
 	std::unique_ptr<GifRegister> Clone() override
 	{
 		return std::make_unique<std::decay_t<decltype(*this)>>(*this);
@@ -324,7 +366,6 @@ public:
 
 	bool Push(Vec4 v4) override
 	{
-		std::cout << "!!!! RGBAQ PUSHED " << v4.x << " " << v4.y << " " << v4.z << " " << v4.w << std::endl;
 		value = v4;
 		return true;
 	}
@@ -339,6 +380,69 @@ public:
 		return value.value();
 	}
 
+	uint64_t Encode() const override
+	{
+		return gs::SetRGBAQ(value->x, value->y, value->z, value->w, 0);
+	}
+
+	std::unique_ptr<GifRegister> Clone() override
+	{
+		return std::make_unique<std::decay_t<decltype(*this)>>(*this);
+	}
+};
+
+struct ST : public GifRegister
+{
+	// S and T are floats, kept as their bit patterns
+	std::optional<Vec2> value;
+
+public:
+	ST()
+		: GifRegister(GifRegisterID::ST, "ST", RAT::ADP)
+	{
+	}
+
+	bool Ready() const noexcept override
+	{
+		return value.has_value();
+	}
+
+	bool Push(uint32_t) override
+	{
+		return false;
+	}
+
+	bool Push(Vec2 v2) override
+	{
+		value = v2;
+		return true;
+	}
+
+	bool Push(Vec3) override
+	{
+		return false;
+	}
+
+	bool Push(Vec4) override
+	{
+		return false;
+	}
+
+	bool ApplyModifier(RegModifier) override
+	{
+		return false;
+	}
+
+	Vec2 GetValue() const noexcept
+	{
+		return value.value();
+	}
+
+	uint64_t Encode() const override
+	{
+		return gs::SetST(value->x, value->y);
+	}
+
 	std::unique_ptr<GifRegister> Clone() override
 	{
 		return std::make_unique<std::decay_t<decltype(*this)>>(*this);
@@ -391,6 +495,68 @@ public:
 		return value.value();
 	}
 
+	uint64_t Encode() const override
+	{
+		return gs::SetUV(value->x << 4, value->y << 4);
+	}
+
+	std::unique_ptr<GifRegister> Clone() override
+	{
+		return std::make_unique<std::decay_t<decltype(*this)>>(*this);
+	}
+};
+
+struct XYZF2 : public GifRegister
+{
+	// x, y, z (24bit) and the fog coefficient
+	std::optional<Vec4> value;
+
+	XYZF2()
+		: GifRegister(GifRegisterID::XYZF2, "XYZF2", RAT::ADP, true)
+	{
+	}
+
+	bool Ready() const noexcept override
+	{
+		return value.has_value();
+	}
+
+	bool Push(uint32_t) override
+	{
+		return false;
+	}
+
+	bool Push(Vec2) override
+	{
+		return false;
+	}
+
+	bool Push(Vec3) override
+	{
+		return false;
+	}
+
+	bool Push(Vec4 v4) override
+	{
+		value = v4;
+		return true;
+	}
+
+	bool ApplyModifier(RegModifier) override
+	{
+		return false;
+	}
+
+	Vec4 GetValue() const noexcept
+	{
+		return value.value();
+	}
+
+	uint64_t Encode() const override
+	{
+		return gs::SetXYZF(value->x << 4, value->y << 4, value->z, value->w);
+	}
+
 	std::unique_ptr<GifRegister> Clone() override
 	{
 		return std::make_unique<std::decay_t<decltype(*this)>>(*this);
@@ -442,6 +608,11 @@ struct XYZ2 : public GifRegister
 		return value.value();
 	}
 
+	uint64_t Encode() const override
+	{
+		return gs::SetXYZ(value->x << 4, value->y << 4, value->z);
+	}
+
 	std::unique_ptr<GifRegister> Clone() override
 	{
 		return std::make_unique<std::decay_t<decltype(*this)>>(*this);
@@ -590,6 +761,11 @@ struct TEX0 : public GifRegister
 		return tfx;
 	}
 
+	uint64_t Encode() const override
+	{
+		return gs::SetTEX0(GetTBP(), GetTBW(), static_cast<uint64_t>(GetPSM()), GetTW(), GetTH(), tcc, static_cast<uint64_t>(tfx), 0, 0, 0, 0, 0);
+	}
+
 	std::unique_ptr<GifRegister> Clone() override
 	{
 		return std::make_unique<std::decay_t<decltype(*this)>>(*this);
@@ -642,6 +818,11 @@ public:
 		return value.value();
 	}
 
+	uint64_t Encode() const override
+	{
+		return gs::SetFOG(value.value());
+	}
+
 	std::unique_ptr<GifRegister> Clone() override
 	{
 		return std::make_unique<std::decay_t<decltype(*this)>>(*this);
@@ -694,6 +875,11 @@ public:
 		return value.value();
 	}
 
+	uint64_t Encode() const override
+	{
+		return gs::SetFOGCOL(value->x, value->y, value->z);
+	}
+
 	std::unique_ptr<GifRegister> Clone() override
 	{
 		return std::make_unique<std::decay_t<decltype(*this)>>(*this);
@@ -746,6 +932,11 @@ public:
 		return value.value();
 	}
 
+	uint64_t Encode() const override
+	{
+		return gs::SetSCISSOR(value->x, value->y, value->z, value->w);
+	}
+
 	std::unique_ptr<GifRegister> Clone() override
 	{
 		return std::make_unique<std::decay_t<decltype(*this)>>(*this);
@@ -800,6 +991,11 @@ public:
 		return value.value();
 	}
 
+	uint64_t Encode() const override
+	{
+		return gs::SetSIGNAL(value->x, value->y);
+	}
+
 	std::unique_ptr<GifRegister> Clone() override
 	{
 		return std::make_unique<std::decay_t<decltype(*this)>>(*this);
@@ -854,6 +1050,11 @@ public:
 		return value;
 	}
 
+	uint64_t Encode() const override
+	{
+		return gs::SetFINISH(value);
+	}
+
 	std::unique_ptr<GifRegister> Clone() override
 	{
 		return std::make_unique<std::decay_t<decltype(*this)>>(*this);
@@ -908,17 +1109,87 @@ public:
 		return value.value();
 	}
 
+	uint64_t Encode() const override
+	{
+		return gs::SetLABEL(value->x, value->y);
+	}
+
 	std::unique_ptr<GifRegister> Clone() override
 	{
 		return std::make_unique<std::decay_t<decltype(*this)>>(*this);
 	}
 };
 
+// Pixels for VRAM, sent after the registers of a block. BITBLTBUF, TRXPOS,
+// TRXREG and TRXDIR set up a host to local transfer, then IMAGE GIFtags carry
+// the pixels straight out of the mapped file.
+struct TextureUpload
+{
+	std::string path;
+	// Shared by every copy of the block, the file stays mapped until the last one goes
+	std::shared_ptr<const MappedFile> file;
+	uint32_t tbp;
+	uint32_t tbw;
+	PSM psm;
+	// x, y, width and height of the destination rectangle
+	Vec4 rect;
+
+	static constexpr size_t BytesPerPixel(PSM psm) noexcept
+	{
+		switch(psm)
+		{
+			case PSM::CT32:
+				return 4;
+			case PSM::CT24:
+				return 3;
+			default:
+				return 2;
+		}
+	}
+
+	std::span<const uint8_t> Pixels() const noexcept
+	{
+		return {file->Data(), file->Size()};
+	}
+
+	// The last qword is padded with zeroes
+	size_t ImageQwords() const noexcept
+	{
+		return (file->Size() + 15) / 16;
+	}
+
+	size_t ImageTags() const noexcept
+	{
+		return (ImageQwords() + gs::GIF_NLOOP_MAX - 1) / gs::GIF_NLOOP_MAX;
+	}
+
+	// The A+D tag setting up the transfer, its four registers and the IMAGE tags with their data
+	size_t Qwords() const noexcept
+	{
+		return 1 + 4 + ImageTags() + ImageQwords();
+	}
+
+	// The transfer setup as (data, address) pairs, in the order they are written
+	std::array<std::pair<uint64_t, uint64_t>, 4> Registers() const noexcept
+	{
+		return {{
+			{gs::SetBITBLTBUF(0, 0, 0, tbp, tbw, static_cast<uint64_t>(psm)), gs::GS_REG_BITBLTBUF},
+			{gs::SetTRXPOS(0, 0, rect.x, rect.y, 0), gs::GS_REG_TRXPOS},
+			{gs::SetTRXREG(rect.z, rect.w), gs::GS_REG_TRXREG},
+			{gs::SetTRXDIR(0), gs::GS_REG_TRXDIR},
+		}};
+	}
+};
+
 struct GIFBlock
 {
 	std::string name;
 	std::unique_ptr<GifRegister> prim;
 	std::list<std::unique_ptr<GifRegister>> registers;
+	// How many times the GIFtag sends the registers, more than one when a repeat makes up the whole block
+	uint32_t nloop = 1;
+	// Nothing can be added to the block once it has one, the transfer has to come last
+	std::optional<TextureUpload> upload;
 
 	GIFBlock(const std::string name)
 		: name(name)
@@ -930,6 +1201,8 @@ struct GIFBlock
 	GIFBlock(const GIFBlock& src)
 	{
 		this->name = src.name;
+		this->nloop = src.nloop;
+		this->upload = src.upload;
 		if(src.prim)
 		{
 			this->prim = src.prim->Clone();
@@ -947,6 +1220,12 @@ struct GIFBlock
 		return !registers.empty();
 	}
 
+	bool HasPatches() const
+	{
+		return (prim && !prim->GetPatch().empty()) ||
+			   std::ranges::any_of(registers, [](const auto& reg) { return !reg->GetPatch().empty(); });
+	}
+
 	GifRegister& CurrentRegister()
 	{
 		return *registers.back();
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string_view>
+
+#include "machine.hpp"
+
+// What every parser rule works on
+struct ParseState
+{
+	Machine& machine;
+	// Cleared by the first rule that fails
+	bool valid = true;
+};
+
+// Splits gifscript source into tokens and feeds them to the parser, which
+// drives the machine. All of the lexer and parser state lives here, so any
+// number of scanners can run side by side on machines of their own.
+class Scanner
+{
+public:
+	// by_line hands the parser one line at a time, so errors stop the scan at the line they are on
+	explicit Scanner(Machine& machine, bool by_line = true);
+	~Scanner();
+
+	Scanner(const Scanner&) = delete;
+	Scanner& operator=(const Scanner&) = delete;
+
+	// Runs the source through the parser, false once a line fails to parse
+	[[nodiscard]] bool TryExecute(std::string_view source);
+
+	// The line being scanned, counted from 1
+	[[nodiscard]] int Line() const noexcept
+	{
+		return line;
+	}
+
+private:
+	ParseState state;
+	void* lparser = nullptr;
+	bool by_line;
+	int line = 1;
+	// Open parentheses, the expression scanner hands back to main once they are all closed
+	int paren_depth = 0;
+
+	// Ragel's state
+	int cs = 0;
+	int act = 0;
+	const char* ts = nullptr;
+	const char* te = nullptr;
+
+	void FailError(const char* ts, const char* te) const;
+};
@@ -0,0 +1,570 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "encoding.hpp"
+
+// Compiles gifscript at compile time, with nothing but this header:
+//
+//	constexpr const auto& quad = gs::StaticPacket<R"(
+//		quad {
+//			prim sprite;
+//			rgbaq 255,0,0;
+//			xyz2 0,0,0;
+//			xyz2 64,64,0;
+//		}
+//	)">;
+//
+// The packet is a 16 byte aligned std::array<uint64_t, N>, ready to be sent by DMA.
+// Each block is laid out like EncodeBlock does, an A+D GIFtag followed by a
+// (data, address) pair per register, concatenated in the order they appear.
+// The first PRIM of a block is packed into its tag, as the compiler does by default,
+// nothing else is optimised away. Only plain register writes are understood,
+// macros, repeats, expressions and uploads need the full compiler.
+// A script that does not parse stops the build at the ScriptError call naming the problem.
+namespace gs
+{
+	namespace static_packet
+	{
+		// Not constexpr, so reaching it during constant evaluation is a compile error
+		inline void ScriptError(const char*)
+		{
+		}
+
+		// A string literal that can be passed as a template argument
+		template <size_t N>
+		struct Script
+		{
+			char text[N] = {};
+
+			consteval Script(const char (&literal)[N])
+			{
+				std::copy_n(literal, N, text);
+			}
+
+			consteval std::string_view View() const
+			{
+				return std::string_view(text, N - 1);
+			}
+		};
+
+		// Keywords are case insensitive like the scanner's
+		consteval bool Is(std::string_view word, std::string_view keyword)
+		{
+			if(word.size() != keyword.size())
+			{
+				return false;
+			}
+
+			for(size_t i = 0; i < word.size(); i++)
+			{
+				const char c = word[i] >= 'A' && word[i] <= 'Z' ? word[i] - 'A' + 'a' : word[i];
+				if(c != keyword[i])
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		consteval bool IsDigit(char c)
+		{
+			return c >= '0' && c <= '9';
+		}
+
+		consteval bool IsHexDigit(char c)
+		{
+			return IsDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+		}
+
+		consteval bool IsWordChar(char c)
+		{
+			return IsDigit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+		}
+
+		consteval uint32_t HexValue(char c)
+		{
+			return IsDigit(c) ? c - '0' : (c | 0x20) - 'a' + 10;
+		}
+
+		struct Token
+		{
+			enum class Kind
+			{
+				End,
+				Word,
+				Number,
+				BlockBegin,
+				BlockEnd,
+				Semi,
+			};
+
+			Kind kind = Kind::End;
+			std::string_view text;
+			// One to four comma separated numbers, as the scanner's int, vec2, vec3 and vec4
+			uint32_t values[4] = {};
+			size_t count = 0;
+		};
+
+		class Lexer
+		{
+			std::string_view source;
+			size_t pos = 0;
+
+			consteval void SkipSpace()
+			{
+				while(pos < source.size())
+				{
+					if(source[pos] == ' ' || source[pos] == '\t' || source[pos] == '\n' || source[pos] == '\r')
+					{
+						pos++;
+					}
+					else if(source.substr(pos, 2) == "//")
+					{
+						pos = std::min(source.find('\n', pos), source.size());
+					}
+					else if(source.substr(pos, 2) == "/*")
+					{
+						const size_t end = source.find("*/", pos + 2);
+						if(end == std::string_view::npos)
+						{
+							ScriptError("Unterminated comment");
+						}
+						pos = end + 2;
+					}
+					else
+					{
+						break;
+					}
+				}
+			}
+
+			// hex_const is ([0])? [xX] xdigit+, so x80 is a number rather than a name
+			consteval bool AtHex() const
+			{
+				size_t i = pos;
+				if(i < source.size() && source[i] == '0')
+				{
+					i++;
+				}
+				if(i >= source.size() || (source[i] != 'x' && source[i] != 'X'))
+				{
+					return false;
+				}
+				i++;
+				const size_t start = i;
+				while(i < source.size() && IsHexDigit(source[i]))
+				{
+					i++;
+				}
+				return i > start && (i == source.size() || !IsWordChar(source[i]));
+			}
+
+			// Integers and hex as they are, floats as their bit pattern
+			consteval uint32_t ReadNumber()
+			{
+				if(AtHex())
+				{
+					pos = source.find_first_of("xX", pos) + 1;
+					uint64_t value = 0;
+					while(pos < source.size() && IsHexDigit(source[pos]))
+					{
+						value = value << 4 | HexValue(source[pos++]);
+					}
+					return static_cast<uint32_t>(value);
+				}
+
+				uint64_t value = 0;
+				while(pos < source.size() && IsDigit(source[pos]))
+				{
+					value = value * 10 + (source[pos++] - '0');
+				}
+
+				if(pos + 1 < source.size() && source[pos] == '.' && IsDigit(source[pos + 1]))
+				{
+					pos++;
+					uint64_t fraction = 0;
+					double scale = 1;
+					while(pos < source.size() && IsDigit(source[pos]))
+					{
+						fraction = fraction * 10 + (source[pos++] - '0');
+						scale *= 10;
+					}
+					if(pos < source.size() && (source[pos] == 'f' || source[pos] == 'F'))
+					{
+						pos++;
+					}
+					return std::bit_cast<uint32_t>(static_cast<float>(static_cast<double>(value) + static_cast<double>(fraction) / scale));
+				}
+
+				return static_cast<uint32_t>(value);
+			}
+
+		public:
+			consteval explicit Lexer(std::string_view source)
+				: source(source)
+			{
+			}
+
+			consteval Token Next()
+			{
+				SkipSpace();
+				Token token;
+				if(pos >= source.size())
+				{
+					return token;
+				}
+
+				const size_t start = pos;
+				const char c = source[pos];
+				if(c == '{' || c == '}' || c == ';')
+				{
+					pos++;
+					token.kind = c == '{' ? Token::Kind::BlockBegin : c == '}' ? Token::Kind::BlockEnd : Token::Kind::Semi;
+				}
+				else if(IsDigit(c) || AtHex())
+				{
+					token.kind = Token::Kind::Number;
+					token.values[token.count++] = ReadNumber();
+					while(pos < source.size() && source[pos] == ',')
+					{
+						pos++;
+						if(token.count == 4 || pos >= source.size() || !(IsDigit(source[pos]) || AtHex()))
+						{
+							ScriptError("Malformed vector");
+						}
+						token.values[token.count++] = ReadNumber();
+					}
+				}
+				else if(IsWordChar(c))
+				{
+					token.kind = Token::Kind::Word;
+					while(pos < source.size() && IsWordChar(source[pos]))
+					{
+						pos++;
+					}
+				}
+				else
+				{
+					ScriptError("Unexpected character");
+				}
+
+				token.text = source.substr(start, pos - start);
+				return token;
+			}
+		};
+
+		// Everything one register statement was given before its semicolon
+		struct Statement
+		{
+			std::string_view reg;
+			Token args[8];
+			size_t count = 0;
+
+			consteval const Token* Single(size_t components) const
+			{
+				if(count != 1 || args[0].kind != Token::Kind::Number || args[0].count != components)
+				{
+					ScriptError("Wrong arguments for register");
+				}
+				return &args[0];
+			}
+		};
+
+		struct Block
+		{
+			uint64_t prim = 0;
+			bool hasPrim = false;
+			// (data, address) pairs
+			std::vector<uint64_t> registers;
+		};
+
+		consteval uint64_t EncodePrim(const Statement& statement)
+		{
+			int type = -1;
+			bool gouraud = false;
+			bool fogging = false;
+			bool aa1 = false;
+			bool texture = false;
+			bool fst = true;
+			for(size_t i = 0; i < statement.count; i++)
+			{
+				const std::string_view mod = statement.args[i].text;
+				if(statement.args[i].kind != Token::Kind::Word)
+					ScriptError("PRIM only takes modifiers");
+				else if(Is(mod, "point"))
+					type = 0;
+				else if(Is(mod, "line"))
+					type = 1;
+				else if(Is(mod, "linestrip"))
+					type = 2;
+				else if(Is(mod, "triangle") || Is(mod, "tri"))
+					type = 3;
+				else if(Is(mod, "trianglestrip") || Is(mod, "tristrip"))
+					type = 4;
+				else if(Is(mod, "trianglefan") || Is(mod, "trifan"))
+					type = 5;
+				else if(Is(mod, "sprite") || Is(mod, "rect") || Is(mod, "quad"))
+					type = 6;
+				else if(Is(mod, "gouraud"))
+					gouraud = true;
+				else if(Is(mod, "fogging") || Is(mod, "fog"))
+					fogging = true;
+				else if(Is(mod, "aa1"))
+					aa1 = true;
+				else if(Is(mod, "texture") || Is(mod, "textured"))
+					texture = true;
+				else if(Is(mod, "stq"))
+					fst = false;
+				else
+					ScriptError("Unknown PRIM modifier");
+			}
+
+			if(type < 0)
+			{
+				ScriptError("PRIM needs a primitive type");
+			}
+
+			return SetPRIM(type, gouraud, texture, fogging, 0, aa1, fst, 0, 0);
+		}
+
+		// TEX0 takes TBP, TBW, TW and TH as single numbers in that order, or TW,TH as a vec2
+		consteval uint64_t EncodeTEX0(const Statement& statement)
+		{
+			uint32_t fields[4] = {};
+			size_t filled = 0;
+			int psm = -1;
+			int tfx = 1;
+			for(size_t i = 0; i < statement.count; i++)
+			{
+				const Token& arg = statement.args[i];
+				if(arg.kind == Token::Kind::Number && arg.count == 1 && filled < 4)
+					fields[filled++] = arg.values[0];
+				else if(arg.kind == Token::Kind::Number && arg.count == 2 && filled <= 2)
+				{
+					fields[2] = arg.values[0];
+					fields[3] = arg.values[1];
+					filled = 4;
+				}
+				else if(arg.kind != Token::Kind::Word)
+					ScriptError("Wrong arguments for TEX0");
+				else if(Is(arg.text, "ct32") || Is(arg.text, "psmct32"))
+					psm = 0;
+				else if(Is(arg.text, "ct24") || Is(arg.text, "psmct24"))
+					psm = 1;
+				else if(Is(arg.text, "ct16") || Is(arg.text, "psmct16"))
+					psm = 2;
+				else if(Is(arg.text, "modulate"))
+					tfx = 0;
+				else if(Is(arg.text, "decal"))
+					tfx = 1;
+				else if(Is(arg.text, "highlight"))
+					tfx = 2;
+				else if(Is(arg.text, "highlight2"))
+					tfx = 3;
+				else
+					ScriptError("Unknown TEX0 modifier");
+			}
+
+			if(filled != 4 || psm < 0)
+			{
+				ScriptError("TEX0 needs TBP, TBW, a PSM and TW,TH");
+			}
+
+			return SetTEX0(fields[0], fields[1], psm, fields[2], fields[3], 0, tfx, 0, 0, 0, 0, 0);
+		}
+
+		// SIGNAL and LABEL take an ID, with every bit of the mask set, or an ID,mask pair
+		consteval uint64_t EncodeIDMask(const Statement& statement)
+		{
+			if(statement.count != 1 || statement.args[0].kind != Token::Kind::Number || statement.args[0].count > 2)
+			{
+				ScriptError("Wrong arguments for register");
+			}
+
+			const Token& arg = statement.args[0];
+			return SetSIGNAL(arg.values[0], arg.count == 2 ? arg.values[1] : 0xFFFFFFFF);
+		}
+
+		consteval void EncodeStatement(const Statement& statement, Block& block)
+		{
+			const std::string_view reg = statement.reg;
+			uint64_t value = 0;
+			uint64_t address = 0;
+			if(Is(reg, "prim"))
+			{
+				value = EncodePrim(statement);
+				address = GIF_REG_PRIM;
+				if(!block.hasPrim)
+				{
+					block.prim = value;
+					block.hasPrim = true;
+					return;
+				}
+			}
+			else if(Is(reg, "rgbaq") || Is(reg, "rgba"))
+			{
+				const bool alpha = statement.count == 1 && statement.args[0].count == 4;
+				const Token* arg = statement.Single(alpha ? 4 : 3);
+				value = SetRGBAQ(arg->values[0], arg->values[1], arg->values[2], alpha ? arg->values[3] : 0xFF, 0);
+				address = GIF_REG_RGBAQ;
+			}
+			else if(Is(reg, "st"))
+			{
+				const Token* arg = statement.Single(2);
+				value = SetST(arg->values[0], arg->values[1]);
+				address = GIF_REG_ST;
+			}
+			else if(Is(reg, "uv"))
+			{
+				const Token* arg = statement.Single(2);
+				value = SetUV(uint64_t{arg->values[0]} << 4, uint64_t{arg->values[1]} << 4);
+				address = GIF_REG_UV;
+			}
+			else if(Is(reg, "xyzf2"))
+			{
+				const Token* arg = statement.Single(4);
+				value = SetXYZF(uint64_t{arg->values[0]} << 4, uint64_t{arg->values[1]} << 4, arg->values[2], arg->values[3]);
+				address = GIF_REG_XYZF2;
+			}
+			else if(Is(reg, "xyz2"))
+			{
+				const Token* arg = statement.Single(3);
+				value = SetXYZ(uint64_t{arg->values[0]} << 4, uint64_t{arg->values[1]} << 4, arg->values[2]);
+				address = GIF_REG_XYZ2;
+			}
+			else if(Is(reg, "tex0"))
+			{
+				value = EncodeTEX0(statement);
+				address = GS_REG_TEX0_1;
+			}
+			else if(Is(reg, "fog"))
+			{
+				value = SetFOG(statement.Single(1)->values[0]);
+				address = GIF_REG_FOG;
+			}
+			else if(Is(reg, "fogcol"))
+			{
+				const Token* arg = statement.Single(3);
+				value = SetFOGCOL(arg->values[0], arg->values[1], arg->values[2]);
+				address = GS_REG_FOGCOL;
+			}
+			else if(Is(reg, "scissor"))
+			{
+				const Token* arg = statement.Single(4);
+				value = SetSCISSOR(arg->values[0], arg->values[1], arg->values[2], arg->values[3]);
+				address = GS_REG_SCISSOR_1;
+			}
+			else if(Is(reg, "signal"))
+			{
+				value = EncodeIDMask(statement);
+				address = GS_REG_SIGNAL;
+			}
+			else if(Is(reg, "finish"))
+			{
+				value = statement.count == 0 ? 0 : SetFINISH(statement.Single(1)->values[0]);
+				address = GS_REG_FINISH;
+			}
+			else if(Is(reg, "label"))
+			{
+				value = EncodeIDMask(statement);
+				address = GS_REG_LABEL;
+			}
+			else
+			{
+				ScriptError("Unknown register, or a statement only the full compiler supports");
+			}
+
+			block.registers.push_back(value);
+			block.registers.push_back(address);
+		}
+
+		// The same layout as EncodeBlock gives a block without a repeat or upload
+		consteval void EmitBlock(const Block& block, std::vector<uint64_t>& data)
+		{
+			const size_t loops = block.registers.size() / 2;
+			const size_t tags = std::max<size_t>(1, (loops + GIF_NLOOP_MAX - 1) / GIF_NLOOP_MAX);
+			size_t remaining = loops;
+			size_t next = 0;
+			for(size_t tag = 0; tag < tags; tag++)
+			{
+				const bool first = tag == 0;
+				const size_t nloop = std::min<size_t>(remaining, GIF_NLOOP_MAX);
+				data.push_back(SetGIFTag(nloop, tag == tags - 1, first && block.hasPrim, first ? block.prim : 0, GIF_FLG_PACKED, 1));
+				data.push_back(ADRegs(1));
+				data.insert(data.end(), block.registers.begin() + next, block.registers.begin() + next + nloop * 2);
+				next += nloop * 2;
+				remaining -= nloop;
+			}
+		}
+
+		consteval std::vector<uint64_t> Compile(std::string_view source)
+		{
+			std::vector<uint64_t> data;
+			Lexer lexer(source);
+			for(Token name = lexer.Next(); name.kind != Token::Kind::End; name = lexer.Next())
+			{
+				if(name.kind != Token::Kind::Word || lexer.Next().kind != Token::Kind::BlockBegin)
+				{
+					ScriptError("Expected a block, name {");
+				}
+
+				Block block;
+				for(Token token = lexer.Next(); token.kind != Token::Kind::BlockEnd; token = lexer.Next())
+				{
+					if(token.kind != Token::Kind::Word)
+					{
+						ScriptError("Expected a register or }");
+					}
+
+					Statement statement{.reg = token.text};
+					for(Token arg = lexer.Next(); arg.kind != Token::Kind::Semi; arg = lexer.Next())
+					{
+						if((arg.kind != Token::Kind::Word && arg.kind != Token::Kind::Number) || statement.count == std::size(statement.args))
+						{
+							ScriptError("Expected arguments then ;");
+						}
+						statement.args[statement.count++] = arg;
+					}
+
+					EncodeStatement(statement, block);
+				}
+
+				if(block.registers.empty() && !block.hasPrim)
+				{
+					ScriptError("Empty block");
+				}
+
+				EmitBlock(block, data);
+			}
+
+			if(data.empty())
+			{
+				ScriptError("No blocks in the script");
+			}
+
+			return data;
+		}
+
+		template <Script S>
+		consteval auto Encode()
+		{
+			constexpr size_t size = Compile(S.View()).size();
+			const std::vector<uint64_t> data = Compile(S.View());
+			std::array<uint64_t, size> packet = {};
+			std::copy(data.begin(), data.end(), packet.begin());
+			return packet;
+		}
+	} // namespace static_packet
+
+	// The encoded script, 64bit words two to a qword
+	template <static_packet::Script S>
+	alignas(16) inline constexpr auto StaticPacket = static_packet::Encode<S>();
+} // namespace gs
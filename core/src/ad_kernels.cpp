@@ -0,0 +1,262 @@
+#include "ad_kernels.hpp"
+#include "registers.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GIFSCRIPT_X86 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+	// Every field is (half >> shift) & mask, half being the low or high 32 bits of the data
+	struct FieldLayout
+	{
+		uint32_t half[4];
+		uint32_t shift[4];
+		uint32_t mask[4];
+	};
+
+	constexpr FieldLayout RGBAQ_LAYOUT = {{0, 0, 0, 0}, {0, 8, 16, 24}, {0xFF, 0xFF, 0xFF, 0xFF}};
+	constexpr FieldLayout ST_LAYOUT = {{0, 1, 0, 0}, {0, 0, 0, 0}, {0xFFFFFFFF, 0xFFFFFFFF, 0, 0}};
+	constexpr FieldLayout UV_LAYOUT = {{0, 0, 0, 0}, {4, 20, 0, 0}, {0x3FF, 0x3FF, 0, 0}};
+	constexpr FieldLayout XYZF2_LAYOUT = {{0, 0, 1, 1}, {4, 20, 0, 24}, {0xFFF, 0xFFF, 0xFFFFFF, 0xFF}};
+	constexpr FieldLayout XYZ2_LAYOUT = {{0, 0, 1, 0}, {4, 20, 0, 0}, {0xFFF, 0xFFF, 0xFFFFFFFF, 0}};
+
+	const FieldLayout* LayoutOf(uint64_t addr) noexcept
+	{
+		switch(static_cast<GifRegisterID>(addr))
+		{
+			case GifRegisterID::RGBAQ:
+				return &RGBAQ_LAYOUT;
+			case GifRegisterID::ST:
+				return &ST_LAYOUT;
+			case GifRegisterID::UV:
+				return &UV_LAYOUT;
+			case GifRegisterID::XYZF2:
+				return &XYZF2_LAYOUT;
+			case GifRegisterID::XYZ2:
+				return &XYZ2_LAYOUT;
+			default:
+				return nullptr;
+		}
+	}
+
+	constexpr uint64_t Address(const uint64_t* qword) noexcept
+	{
+		return qword[1] & 0xFF;
+	}
+
+	size_t RunLengthScalar(const uint64_t* qwords, size_t first, size_t count) noexcept
+	{
+		const uint64_t addr = Address(qwords);
+		size_t i = first;
+		while(i < count && Address(qwords + i * 2) == addr)
+		{
+			i++;
+		}
+		return i;
+	}
+
+	void UnpackScalar(const uint64_t* qwords, size_t first, size_t count, const FieldLayout& layout, uint32_t (*fields)[4]) noexcept
+	{
+		for(size_t i = first; i < count; i++)
+		{
+			const uint32_t halves[2] = {static_cast<uint32_t>(qwords[i * 2]), static_cast<uint32_t>(qwords[i * 2] >> 32)};
+			for(size_t k = 0; k < 4; k++)
+			{
+				fields[i][k] = (halves[layout.half[k]] >> layout.shift[k]) & layout.mask[k];
+			}
+		}
+	}
+
+#ifdef GIFSCRIPT_X86
+	__attribute__((target("sse2"))) size_t RunLengthSSE2(const uint64_t* qwords, size_t count) noexcept
+	{
+		const __m128i addr = _mm_set1_epi64x(static_cast<int64_t>(Address(qwords)));
+		const __m128i byte = _mm_set1_epi64x(0xFF);
+		size_t i = 0;
+		for(; i + 2 <= count; i += 2)
+		{
+			const __m128i q0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(qwords + i * 2));
+			const __m128i q1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(qwords + i * 2 + 2));
+			const __m128i addrs = _mm_and_si128(_mm_unpackhi_epi64(q0, q1), byte);
+			if(_mm_movemask_epi8(_mm_cmpeq_epi32(addrs, addr)) != 0xFFFF)
+			{
+				break;
+			}
+		}
+		return RunLengthScalar(qwords, i, count);
+	}
+
+	// Four qwords: the low and high halves of their data, one qword per 32bit lane
+	__attribute__((target("sse2"))) void UnpackSSE2(const uint64_t* qwords, size_t count, const FieldLayout& layout, uint32_t (*fields)[4]) noexcept
+	{
+		if(count < 4)
+		{
+			UnpackScalar(qwords, 0, count, layout, fields);
+			return;
+		}
+
+		__m128i shifts[4];
+		__m128i masks[4];
+		for(size_t k = 0; k < 4; k++)
+		{
+			shifts[k] = _mm_cvtsi32_si128(static_cast<int>(layout.shift[k]));
+			masks[k] = _mm_set1_epi32(static_cast<int>(layout.mask[k]));
+		}
+
+		size_t i = 0;
+		for(; i + 4 <= count; i += 4)
+		{
+			const auto* src = reinterpret_cast<const __m128i*>(qwords + i * 2);
+			const __m128i lo01 = _mm_unpacklo_epi32(_mm_loadu_si128(src), _mm_loadu_si128(src + 1));
+			const __m128i lo23 = _mm_unpacklo_epi32(_mm_loadu_si128(src + 2), _mm_loadu_si128(src + 3));
+			const __m128i halves[2] = {_mm_unpacklo_epi64(lo01, lo23), _mm_unpackhi_epi64(lo01, lo23)};
+
+			__m128i f[4];
+			for(size_t k = 0; k < 4; k++)
+			{
+				f[k] = _mm_and_si128(_mm_srl_epi32(halves[layout.half[k]], shifts[k]), masks[k]);
+			}
+
+			// Back to one row of fields per qword
+			const __m128i t0 = _mm_unpacklo_epi32(f[0], f[1]);
+			const __m128i t1 = _mm_unpacklo_epi32(f[2], f[3]);
+			const __m128i t2 = _mm_unpackhi_epi32(f[0], f[1]);
+			const __m128i t3 = _mm_unpackhi_epi32(f[2], f[3]);
+			auto* dst = reinterpret_cast<__m128i*>(fields + i);
+			_mm_storeu_si128(dst, _mm_unpacklo_epi64(t0, t1));
+			_mm_storeu_si128(dst + 1, _mm_unpackhi_epi64(t0, t1));
+			_mm_storeu_si128(dst + 2, _mm_unpacklo_epi64(t2, t3));
+			_mm_storeu_si128(dst + 3, _mm_unpackhi_epi64(t2, t3));
+		}
+		UnpackScalar(qwords, i, count, layout, fields);
+	}
+
+	__attribute__((target("avx2"))) size_t RunLengthAVX2(const uint64_t* qwords, size_t count) noexcept
+	{
+		const __m256i addr = _mm256_set1_epi64x(static_cast<int64_t>(Address(qwords)));
+		const __m256i byte = _mm256_set1_epi64x(0xFF);
+		size_t i = 0;
+		for(; i + 4 <= count; i += 4)
+		{
+			const __m256i q01 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(qwords + i * 2));
+			const __m256i q23 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(qwords + i * 2 + 4));
+			const __m256i addrs = _mm256_and_si256(_mm256_unpackhi_epi64(q01, q23), byte);
+			if(_mm256_movemask_epi8(_mm256_cmpeq_epi64(addrs, addr)) != -1)
+			{
+				break;
+			}
+		}
+		return RunLengthScalar(qwords, i, count);
+	}
+
+	// Eight qwords at a time. The in lane unpacks leave the even qwords in the
+	// low lane and the odd ones in the high lane, which transposes back in order.
+	__attribute__((target("avx2"))) void UnpackAVX2(const uint64_t* qwords, size_t count, const FieldLayout& layout, uint32_t (*fields)[4]) noexcept
+	{
+		// Most runs in a block are a qword or two, not worth dirtying the upper halves for
+		if(count < 8)
+		{
+			UnpackScalar(qwords, 0, count, layout, fields);
+			return;
+		}
+
+		__m128i shifts[4];
+		__m256i masks[4];
+		for(size_t k = 0; k < 4; k++)
+		{
+			shifts[k] = _mm_cvtsi32_si128(static_cast<int>(layout.shift[k]));
+			masks[k] = _mm256_set1_epi32(static_cast<int>(layout.mask[k]));
+		}
+
+		size_t i = 0;
+		for(; i + 8 <= count; i += 8)
+		{
+			const auto* src = reinterpret_cast<const __m256i*>(qwords + i * 2);
+			const __m256i lo0 = _mm256_unpacklo_epi32(_mm256_loadu_si256(src), _mm256_loadu_si256(src + 1));
+			const __m256i lo1 = _mm256_unpacklo_epi32(_mm256_loadu_si256(src + 2), _mm256_loadu_si256(src + 3));
+			const __m256i halves[2] = {_mm256_unpacklo_epi64(lo0, lo1), _mm256_unpackhi_epi64(lo0, lo1)};
+
+			__m256i f[4];
+			for(size_t k = 0; k < 4; k++)
+			{
+				f[k] = _mm256_and_si256(_mm256_srl_epi32(halves[layout.half[k]], shifts[k]), masks[k]);
+			}
+
+			const __m256i t0 = _mm256_unpacklo_epi32(f[0], f[1]);
+			const __m256i t1 = _mm256_unpacklo_epi32(f[2], f[3]);
+			const __m256i t2 = _mm256_unpackhi_epi32(f[0], f[1]);
+			const __m256i t3 = _mm256_unpackhi_epi32(f[2], f[3]);
+			auto* dst = reinterpret_cast<__m256i*>(fields + i);
+			_mm256_storeu_si256(dst, _mm256_unpacklo_epi64(t0, t1));
+			_mm256_storeu_si256(dst + 1, _mm256_unpackhi_epi64(t0, t1));
+			_mm256_storeu_si256(dst + 2, _mm256_unpacklo_epi64(t2, t3));
+			_mm256_storeu_si256(dst + 3, _mm256_unpackhi_epi64(t2, t3));
+		}
+
+		// GCC leaves out the vzeroupper when the tail is a jump, the SSE code after it would pay for the transition
+		_mm256_zeroupper();
+		UnpackScalar(qwords, i, count, layout, fields);
+	}
+#endif
+} // namespace
+
+auto simd::Best() noexcept -> Level
+{
+#ifdef GIFSCRIPT_X86
+	static const Level best = __builtin_cpu_supports("avx2") ? Level::AVX2 : __builtin_cpu_supports("sse2") ? Level::SSE2 : Level::Scalar;
+	return best;
+#else
+	return Level::Scalar;
+#endif
+}
+
+auto simd::ADRunLength(const uint64_t* qwords, size_t count, Level level) noexcept -> size_t
+{
+	if(count == 0)
+	{
+		return 0;
+	}
+
+	switch(level)
+	{
+#ifdef GIFSCRIPT_X86
+		case Level::AVX2:
+			return RunLengthAVX2(qwords, count);
+		case Level::SSE2:
+			return RunLengthSSE2(qwords, count);
+#endif
+		default:
+			return RunLengthScalar(qwords, 1, count);
+	}
+}
+
+auto simd::CanUnpack(uint64_t addr) noexcept -> bool
+{
+	return LayoutOf(addr) != nullptr;
+}
+
+void simd::UnpackAD(const uint64_t* qwords, size_t count, uint64_t addr, uint32_t (*fields)[4], Level level) noexcept
+{
+	const FieldLayout* layout = LayoutOf(addr);
+	if(layout == nullptr)
+	{
+		return;
+	}
+
+	switch(level)
+	{
+#ifdef GIFSCRIPT_X86
+		case Level::AVX2:
+			UnpackAVX2(qwords, count, *layout, fields);
+			break;
+		case Level::SSE2:
+			UnpackSSE2(qwords, count, *layout, fields);
+			break;
+#endif
+		default:
+			UnpackScalar(qwords, 0, count, *layout, fields);
+			break;
+	}
+}
@@ -0,0 +1,107 @@
+#include "compiler.hpp"
+#include "scanner.hpp"
+
+#include "c_code.hpp"
+#include "elf.hpp"
+#include "gifscript_backend.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+namespace
+{
+	std::unique_ptr<Backend> MakeBackend(std::string_view name)
+	{
+		if(name == "c_code")
+		{
+			return std::make_unique<c_code_backend>();
+		}
+		if(name == "elf")
+		{
+			return std::make_unique<elf_backend>();
+		}
+		if(name == "gifscript")
+		{
+			return std::make_unique<gifscript_backend>();
+		}
+		if(name == "stats")
+		{
+			return std::make_unique<stats_backend>();
+		}
+		return nullptr;
+	}
+} // namespace
+
+auto CompileScript(std::string_view source, const CompileOptions& options) -> CompileResult
+{
+	CompileResult result;
+	const Scanner* scanning = nullptr;
+	const logger::ScopedSink sink([&](logger::Level level, std::string message) {
+		result.diagnostics.push_back({level, scanning ? scanning->Line() : 0, std::move(message)});
+	});
+
+	auto backend = MakeBackend(options.backend);
+	if(!backend)
+	{
+		logger::error("Unknown backend: %s", options.backend.c_str());
+		return result;
+	}
+
+	// Laid out like the command line, the backends skip what isn't theirs
+	std::vector<char*> argv;
+	argv.push_back(const_cast<char*>("gifscript"));
+	for(const std::string& arg : options.backend_args)
+	{
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	}
+	if(!backend->arg_parse(static_cast<int>(argv.size()), argv.data()))
+	{
+		logger::error("Invalid arguments for the %s backend", options.backend.c_str());
+		return result;
+	}
+
+	char* buffer = nullptr;
+	size_t size = 0;
+	FILE* stream = open_memstream(&buffer, &size);
+	if(stream == nullptr)
+	{
+		logger::error("Failed to open an output buffer");
+		return result;
+	}
+	backend->set_output_stream(stream);
+
+	bool parsed = false;
+	{
+		Machine machine;
+		for(const auto op : options.disabled_optimizations)
+		{
+			machine.DisableOptimization(op);
+		}
+		for(const auto op : options.enabled_optimizations)
+		{
+			machine.EnableOptimization(op);
+		}
+		machine.SetSpriteStripWidth(options.sprite_strip_width);
+		machine.SetBackend(backend.get());
+
+		Scanner scanner(machine, options.by_line);
+		scanning = &scanner;
+		parsed = scanner.TryExecute(source);
+		scanning = nullptr;
+	}
+
+	// Some backends only write once they are done with every block
+	const bool failed = backend->failed();
+	backend.reset();
+	fclose(stream);
+	result.output.assign(buffer, size);
+	free(buffer);
+
+	result.ok = parsed && !failed && std::ranges::none_of(result.diagnostics, [](const Diagnostic& diagnostic) {
+		return diagnostic.level == logger::Level::Error;
+	});
+	return result;
+}
@@ -0,0 +1,185 @@
+#include "cost.hpp"
+#include "encoder.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+	struct Vertex
+	{
+		Vec3 xyz;
+		Vec2 uv;
+	};
+
+	uint64_t TriangleArea(const Vec3& a, const Vec3& b, const Vec3& c)
+	{
+		const int64_t cross = (static_cast<int64_t>(b.x) - a.x) * (static_cast<int64_t>(c.y) - a.y) -
+							  (static_cast<int64_t>(c.x) - a.x) * (static_cast<int64_t>(b.y) - a.y);
+		return static_cast<uint64_t>(std::llabs(cross) / 2);
+	}
+
+	uint64_t LineLength(const Vec3& a, const Vec3& b)
+	{
+		const int64_t dx = std::llabs(static_cast<int64_t>(b.x) - a.x);
+		const int64_t dy = std::llabs(static_cast<int64_t>(b.y) - a.y);
+		return static_cast<uint64_t>(std::max(dx, dy) + 1);
+	}
+
+	// The GS leaves out the right and bottom edge of a sprite
+	uint64_t SpriteArea(const Vec3& a, const Vec3& b)
+	{
+		return static_cast<uint64_t>(std::llabs(static_cast<int64_t>(b.x) - a.x) * std::llabs(static_cast<int64_t>(b.y) - a.y));
+	}
+
+	// A sprite within one column of pages loads each of them once. A wider one
+	// crosses from page to page on every row, and reloads them row by row.
+	uint64_t SpritePageLoads(const Vec2& a, const Vec2& b)
+	{
+		const uint32_t u0 = std::min(a.x, b.x);
+		const uint32_t u1 = std::max(a.x, b.x);
+		const uint32_t v0 = std::min(a.y, b.y);
+		const uint32_t v1 = std::max(a.y, b.y);
+		if(u0 == u1 || v0 == v1)
+		{
+			return 0;
+		}
+
+		const uint64_t columns = (u1 - 1) / gs::TEXTURE_PAGE_WIDTH - u0 / gs::TEXTURE_PAGE_WIDTH + 1;
+		const uint64_t rows = (v1 - 1) / gs::TEXTURE_PAGE_HEIGHT - v0 / gs::TEXTURE_PAGE_HEIGHT + 1;
+		return columns == 1 ? rows : columns * (v1 - v0);
+	}
+
+	void AddPrimitive(BlockCost& cost, const PRIM& prim, uint64_t pixels)
+	{
+		const bool textured = prim.IsTextured();
+		const uint64_t rate = textured ? gs::TEXTURED_PIXELS_PER_CYCLE : gs::PIXELS_PER_CYCLE;
+
+		cost.primitives[static_cast<size_t>(prim.GetType())]++;
+		cost.pixels += pixels;
+		cost.textured_pixels += textured ? pixels : 0;
+		cost.setup_cycles += textured ? gs::TEXTURED_SETUP_CYCLES : gs::SETUP_CYCLES;
+		// Even a one pixel primitive keeps the pipes busy for a cycle
+		cost.fill_cycles += std::max<uint64_t>(1, (pixels + rate - 1) / rate);
+	}
+
+	void Kick(BlockCost& cost, const PRIM& prim, std::vector<Vertex>& queue, const Vertex& vertex)
+	{
+		queue.push_back(vertex);
+		switch(prim.GetType())
+		{
+			case PrimType::Point:
+				AddPrimitive(cost, prim, 1);
+				queue.clear();
+				break;
+			case PrimType::Line:
+				if(queue.size() == 2)
+				{
+					AddPrimitive(cost, prim, LineLength(queue[0].xyz, queue[1].xyz));
+					queue.clear();
+				}
+				break;
+			case PrimType::LineStrip:
+				if(queue.size() == 2)
+				{
+					AddPrimitive(cost, prim, LineLength(queue[0].xyz, queue[1].xyz));
+					queue.erase(queue.begin());
+				}
+				break;
+			case PrimType::Triangle:
+				if(queue.size() == 3)
+				{
+					AddPrimitive(cost, prim, TriangleArea(queue[0].xyz, queue[1].xyz, queue[2].xyz));
+					queue.clear();
+				}
+				break;
+			case PrimType::TriangleStrip:
+				if(queue.size() == 3)
+				{
+					AddPrimitive(cost, prim, TriangleArea(queue[0].xyz, queue[1].xyz, queue[2].xyz));
+					queue.erase(queue.begin());
+				}
+				break;
+			case PrimType::TriangleFan:
+				if(queue.size() == 3)
+				{
+					AddPrimitive(cost, prim, TriangleArea(queue[0].xyz, queue[1].xyz, queue[2].xyz));
+					queue.erase(queue.begin() + 1);
+				}
+				break;
+			case PrimType::Sprite:
+				if(queue.size() == 2)
+				{
+					AddPrimitive(cost, prim, SpriteArea(queue[0].xyz, queue[1].xyz));
+					if(prim.IsTextured())
+					{
+						const uint64_t loads = SpritePageLoads(queue[0].uv, queue[1].uv);
+						cost.texture_page_loads += loads;
+						cost.texture_cycles += loads * gs::TEXTURE_PAGE_LOAD_CYCLES;
+					}
+					queue.clear();
+				}
+				break;
+		}
+	}
+} // namespace
+
+auto EstimateCost(const GIFBlock& block) -> BlockCost
+{
+	BlockCost cost;
+	cost.qwords = EncodeBlock(block).size() / 2;
+	cost.transfer_cycles = cost.qwords * gs::GIF_CYCLES_PER_QWORD;
+
+	std::optional<PRIM> prim;
+	if(block.prim)
+	{
+		prim = dynamic_cast<const PRIM&>(*block.prim);
+	}
+
+	std::vector<Vertex> queue;
+	Vec2 uv;
+	for(uint32_t loop = 0; loop < block.nloop; loop++)
+	{
+		for(const auto& reg : block.registers)
+		{
+			switch(reg->GetID())
+			{
+				case GifRegisterID::PRIM:
+					prim = dynamic_cast<const PRIM&>(*reg);
+					queue.clear();
+					cost.state_changes++;
+					break;
+				case GifRegisterID::TEX0:
+					cost.texture_changes++;
+					cost.state_changes++;
+					break;
+				case GifRegisterID::UV:
+					uv = dynamic_cast<const UV&>(*reg).GetValue();
+					break;
+				case GifRegisterID::FOGCOL:
+				case GifRegisterID::SCISSOR:
+					cost.state_changes++;
+					break;
+				// Without a PRIM the GS draws with whatever was set before this block, nothing to count
+				case GifRegisterID::XYZ2:
+					if(prim)
+					{
+						Kick(cost, *prim, queue, {dynamic_cast<const XYZ2&>(*reg).GetValue(), uv});
+					}
+					break;
+				case GifRegisterID::XYZF2:
+					if(prim)
+					{
+						const Vec4 xyzf = dynamic_cast<const XYZF2&>(*reg).GetValue();
+						Kick(cost, *prim, queue, {Vec3(xyzf.x, xyzf.y, xyzf.z), uv});
+					}
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+	return cost;
+}
@@ -0,0 +1,299 @@
+#include "decoder.hpp"
+#include "ad_kernels.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+	// Set in the packed XYZF2/XYZ2 forms to write XYZF3/XYZ3 instead
+	constexpr uint64_t PACKED_ADC = 1ull << 47;
+
+	std::unique_ptr<GifRegister> DecodePRIM(uint64_t prim)
+	{
+		constexpr RegModifier types[] = {Point, Line, LineStrip, Triangle, TriangleStrip, TriangleFan, Sprite};
+		if((prim & 0x7) == 7)
+		{
+			logger::error("Invalid PRIM type: 7");
+			return nullptr;
+		}
+
+		auto reg = std::make_unique<PRIM>();
+		reg->ApplyModifier(types[prim & 0x7]);
+		if(prim & 0x8)
+		{
+			reg->ApplyModifier(Gouraud);
+		}
+
+		if(prim & 0x10)
+		{
+			reg->ApplyModifier(Texture);
+		}
+
+		if(prim & 0x20)
+		{
+			reg->ApplyModifier(Fogging);
+		}
+
+		if(prim & 0x80)
+		{
+			reg->ApplyModifier(AA1);
+		}
+
+		if(!(prim & 0x100))
+		{
+			reg->ApplyModifier(STQ);
+		}
+
+		return reg;
+	}
+
+	std::unique_ptr<GifRegister> DecodeTEX0(uint64_t tex0)
+	{
+		constexpr RegModifier functions[] = {Modulate, Decal, Highlight, Highlight2};
+		constexpr RegModifier formats[] = {CT32, CT24, CT16};
+		const uint64_t psm = tex0 >> 20 & 0x3F;
+		if(psm >= std::size(formats))
+		{
+			logger::error("Invalid PSM value: %u", static_cast<uint32_t>(psm));
+			return nullptr;
+		}
+
+		auto reg = std::make_unique<TEX0>();
+		reg->Push(static_cast<uint32_t>(tex0 & 0x3FFF));
+		reg->Push(static_cast<uint32_t>((tex0 >> 14) & 0x3F));
+		reg->Push(Vec2((tex0 >> 26) & 0xF, (tex0 >> 30) & 0xF));
+		reg->ApplyModifier(formats[psm]);
+		reg->ApplyModifier(functions[(tex0 >> 35) & 0x3]);
+		return reg;
+	}
+
+	template <typename Reg, typename Value>
+	std::unique_ptr<GifRegister> Make(Value value)
+	{
+		auto reg = std::make_unique<Reg>();
+		reg->Push(value);
+		return reg;
+	}
+
+	// A register from the fields simd::UnpackAD splits its A+D data into
+	std::unique_ptr<GifRegister> FromFields(uint64_t addr, const uint32_t (&fields)[4])
+	{
+		switch(static_cast<GifRegisterID>(addr))
+		{
+			case GifRegisterID::RGBAQ:
+				return Make<RGBAQ>(Vec4(fields[0], fields[1], fields[2], fields[3]));
+			case GifRegisterID::ST:
+				return Make<ST>(Vec2(fields[0], fields[1]));
+			case GifRegisterID::UV:
+				return Make<UV>(Vec2(fields[0], fields[1]));
+			case GifRegisterID::XYZF2:
+				return Make<XYZF2>(Vec4(fields[0], fields[1], fields[2], fields[3]));
+			case GifRegisterID::XYZ2:
+				return Make<XYZ2>(Vec3(fields[0], fields[1], fields[2]));
+			default:
+				std::unreachable();
+		}
+	}
+
+	// Qwords unpacked at a time, small enough to stay on the stack
+	constexpr size_t UNPACK_BATCH = 64;
+
+	// A tag that is nothing but A+D, the layout gifscript itself writes.
+	// Runs of the same per vertex register are unpacked several qwords at a time.
+	void DecodeADStream(const uint64_t* qwords, size_t count, GIFBlock& block)
+	{
+		const simd::Level level = simd::Best();
+		uint32_t fields[UNPACK_BATCH][4];
+		size_t i = 0;
+		while(i < count)
+		{
+			const uint64_t* run_start = qwords + i * 2;
+			const uint64_t addr = run_start[1] & 0xFF;
+			const size_t run = simd::ADRunLength(run_start, count - i, level);
+			if(!simd::CanUnpack(addr))
+			{
+				for(size_t j = 0; j < run; j++)
+				{
+					if(auto reg = DecodeAD(run_start[j * 2], addr))
+					{
+						block.registers.push_back(std::move(reg));
+					}
+				}
+			}
+			else
+			{
+				for(size_t done = 0; done < run; done += UNPACK_BATCH)
+				{
+					const size_t batch = std::min(UNPACK_BATCH, run - done);
+					simd::UnpackAD(run_start + done * 2, batch, addr, fields, level);
+					for(size_t j = 0; j < batch; j++)
+					{
+						block.registers.push_back(FromFields(addr, fields[j]));
+					}
+				}
+			}
+
+			i += run;
+		}
+	}
+
+	// One qword of PACKED data, nullptr for a NOP or a register gifscript does not know
+	std::unique_ptr<GifRegister> DecodePacked(const uint64_t* qword, uint64_t desc, size_t offset)
+	{
+		const uint64_t lo = qword[0];
+		const uint64_t hi = qword[1];
+		switch(desc)
+		{
+			case gs::GIF_REG_PRIM:
+				return DecodePRIM(lo & 0x7FF);
+			case gs::GIF_REG_RGBAQ:
+				// Q is whatever the last packed ST left behind, gifscript has no way to set it
+				return DecodeAD(gs::SetRGBAQ(lo, lo >> 32, hi, hi >> 32, 0), static_cast<uint64_t>(GifRegisterID::RGBAQ));
+			case gs::GIF_REG_ST:
+				return DecodeAD(lo, static_cast<uint64_t>(GifRegisterID::ST));
+			case gs::GIF_REG_UV:
+				return DecodeAD(gs::SetUV(lo, lo >> 32), static_cast<uint64_t>(GifRegisterID::UV));
+			case gs::GIF_REG_XYZF2:
+			case gs::GIF_REG_XYZ2:
+				if(hi & PACKED_ADC)
+				{
+					logger::warn("Vertex at 0x%zx does not kick a drawing, it is decoded as one that does", offset);
+				}
+
+				if(desc == gs::GIF_REG_XYZF2)
+				{
+					return DecodeAD(gs::SetXYZF(lo, lo >> 32, hi >> 4, hi >> 36), static_cast<uint64_t>(GifRegisterID::XYZF2));
+				}
+				return DecodeAD(gs::SetXYZ(lo, lo >> 32, hi), static_cast<uint64_t>(GifRegisterID::XYZ2));
+			case gs::GIF_REG_FOG:
+				return DecodeAD(gs::SetFOG(hi >> 36), static_cast<uint64_t>(GifRegisterID::FOG));
+			case gs::GIF_REG_AD:
+				return DecodeAD(lo, hi & 0xFF);
+			case gs::GIF_REG_NOP:
+				return nullptr;
+			default:
+				// The rest are register addresses, written with the low half of the qword
+				return DecodeAD(lo, desc);
+		}
+	}
+} // namespace
+
+auto TagDataWords(const GIFTag& tag) noexcept -> size_t
+{
+	const size_t nreg = tag.NREG == 0 ? 16 : tag.NREG;
+	switch(tag.FLG)
+	{
+		case gs::GIF_FLG_PACKED:
+			return tag.NLOOP * nreg * 2;
+		case gs::GIF_FLG_REGLIST:
+			// Padded out to a whole qword
+			return (tag.NLOOP * nreg + 1) & ~1ull;
+		default:
+			return tag.NLOOP * 2;
+	}
+}
+
+auto TagHasRegisters(const GIFTag& tag) noexcept -> bool
+{
+	if(tag.PRE && tag.FLG == gs::GIF_FLG_PACKED)
+	{
+		return true;
+	}
+
+	const size_t nreg = tag.NREG == 0 ? 16 : tag.NREG;
+	for(size_t j = 0; j < nreg; j++)
+	{
+		const uint64_t desc = tag.REGS >> (j * 4) & 0xF;
+		if(desc != gs::GIF_REG_NOP && !(tag.FLG == gs::GIF_FLG_REGLIST && desc == gs::GIF_REG_AD))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+auto DecodeAD(uint64_t data, uint64_t addr) -> std::unique_ptr<GifRegister>
+{
+	switch(static_cast<GifRegisterID>(addr))
+	{
+		case GifRegisterID::PRIM:
+			return DecodePRIM(data);
+		case GifRegisterID::RGBAQ:
+			return Make<RGBAQ>(Vec4(data & 0xFF, (data >> 8) & 0xFF, (data >> 16) & 0xFF, (data >> 24) & 0xFF));
+		case GifRegisterID::ST:
+			return Make<ST>(Vec2(data & UINT32_MAX, data >> 32));
+		case GifRegisterID::UV:
+			return Make<UV>(Vec2((data & 0x3FFF) >> 4, ((data >> 16) & 0x3FFF) >> 4));
+		case GifRegisterID::XYZF2:
+			return Make<XYZF2>(Vec4((data & 0xFFFF) >> 4, ((data >> 16) & 0xFFFF) >> 4, (data >> 32) & 0xFFFFFF, data >> 56));
+		case GifRegisterID::XYZ2:
+			return Make<XYZ2>(Vec3((data >> 4) & 0xFFF, (data >> 20) & 0xFFF, data >> 32));
+		case GifRegisterID::TEX0:
+			return DecodeTEX0(data);
+		case GifRegisterID::FOG:
+			return Make<FOG>(static_cast<uint32_t>((data >> 56) & 0xFF));
+		case GifRegisterID::FOGCOL:
+			return Make<FOGCOL>(Vec3(data & 0xFF, (data >> 8) & 0xFF, (data >> 16) & 0xFF));
+		case GifRegisterID::SCISSOR:
+			return Make<SCISSOR>(Vec4(data & 0x7FF, (data >> 16) & 0x7FF, (data >> 32) & 0x7FF, (data >> 48) & 0x7FF));
+		case GifRegisterID::SIGNAL:
+			return Make<SIGNAL>(Vec2(data & UINT32_MAX, data >> 32));
+		case GifRegisterID::FINISH:
+			return Make<FINISH>(static_cast<uint32_t>(data));
+		case GifRegisterID::LABEL:
+			return Make<LABEL>(static_cast<uint32_t>(data));
+		default:
+			logger::error("Unsupported gs register: 0x%02x", static_cast<uint32_t>(addr));
+			return nullptr;
+	}
+}
+
+void DecodeTag(const GIFTag& tag, const uint64_t* data, size_t offset, GIFBlock& block)
+{
+	// The GS ignores PRE in REGLIST mode
+	if(tag.PRE && tag.FLG == gs::GIF_FLG_PACKED)
+	{
+		if(auto prim = DecodePRIM(tag.PRIM))
+		{
+			block.registers.push_back(std::move(prim));
+		}
+	}
+
+	const size_t nreg = tag.NREG == 0 ? 16 : tag.NREG;
+	if(tag.FLG == gs::GIF_FLG_PACKED && (tag.REGS & (~0ull >> ((16 - nreg) * 4))) == gs::ADRegs(nreg))
+	{
+		DecodeADStream(data, tag.NLOOP * nreg, block);
+		return;
+	}
+
+	for(size_t i = 0; i < tag.NLOOP; i++)
+	{
+		for(size_t j = 0; j < nreg; j++)
+		{
+			const uint64_t desc = tag.REGS >> (j * 4) & 0xF;
+			std::unique_ptr<GifRegister> reg;
+			if(tag.FLG == gs::GIF_FLG_PACKED)
+			{
+				reg = DecodePacked(data, desc, offset);
+				data += 2;
+			}
+			else
+			{
+				// A+D has no meaning without the upper half of a qword, the GS skips it like a NOP
+				if(desc != gs::GIF_REG_AD && desc != gs::GIF_REG_NOP)
+				{
+					reg = DecodeAD(*data, desc);
+				}
+				data++;
+			}
+
+			if(reg)
+			{
+				block.registers.push_back(std::move(reg));
+			}
+		}
+	}
+}
@@ -0,0 +1,115 @@
+#include "encoder.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include "encoding.hpp"
+
+namespace
+{
+	void AppendUpload(const TextureUpload& upload, bool pre, uint64_t prim, std::vector<uint64_t>& data)
+	{
+		data.push_back(gs::SetGIFTag(4, 0, pre, prim, gs::GIF_FLG_PACKED, 1));
+		data.push_back(gs::GIF_REG_AD);
+		for(const auto& [value, addr] : upload.Registers())
+		{
+			data.push_back(value);
+			data.push_back(addr);
+		}
+
+		const auto pixels = upload.Pixels();
+		size_t remaining = upload.ImageQwords();
+		size_t offset = 0;
+		for(size_t tag = 0; tag < upload.ImageTags(); tag++)
+		{
+			const size_t nloop = std::min<size_t>(remaining, gs::GIF_NLOOP_MAX);
+			data.push_back(gs::SetGIFTag(nloop, tag == upload.ImageTags() - 1, 0, 0, gs::GIF_FLG_IMAGE, 0));
+			data.push_back(0);
+
+			// Copied straight out of the mapping, only the last qword can come up short
+			const size_t bytes = std::min(nloop * 16, pixels.size() - offset);
+			const size_t start = data.size();
+			data.resize(start + nloop * 2);
+			memcpy(data.data() + start, pixels.data() + offset, bytes);
+			offset += bytes;
+			remaining -= nloop;
+		}
+	}
+} // namespace
+
+auto EncodeBlock(const GIFBlock& block) -> std::vector<uint64_t>
+{
+	// A repeat loops over the whole register list, otherwise every loop is one register
+	const bool looped = block.nloop > 1;
+	const size_t reg_count = block.registers.size();
+	const size_t nreg = looped ? reg_count : 1;
+	const size_t loops = looped ? block.nloop : reg_count;
+	// A block that only uploads a texture has no register tag, the upload's A+D tag takes the PRIM
+	const size_t tag_count = block.upload && reg_count == 0 ? 0 : std::max<size_t>(1, (loops + gs::GIF_NLOOP_MAX - 1) / gs::GIF_NLOOP_MAX);
+	const uint64_t prim = block.prim ? block.prim->Encode() : 0;
+
+	std::vector<uint64_t> data;
+	data.reserve((loops * nreg + tag_count + (block.upload ? block.upload->Qwords() : 0)) * 2);
+
+	auto regIt = block.registers.cbegin();
+	size_t remaining = loops;
+	for(size_t tag = 0; tag < tag_count; tag++)
+	{
+		const bool first = tag == 0;
+		const bool last = tag == tag_count - 1 && !block.upload;
+		const size_t nloop = std::min<size_t>(remaining, gs::GIF_NLOOP_MAX);
+
+		data.push_back(gs::SetGIFTag(nloop, last, first && block.prim, first ? prim : 0, gs::GIF_FLG_PACKED, nreg));
+		data.push_back(gs::ADRegs(nreg));
+
+		for(size_t i = 0; i < nloop * nreg; i++)
+		{
+			data.push_back((*regIt)->Encode());
+			data.push_back(static_cast<uint64_t>((*regIt)->GetID()));
+			if(++regIt == block.registers.cend())
+			{
+				regIt = block.registers.cbegin();
+			}
+		}
+
+		remaining -= nloop;
+	}
+
+	if(block.upload)
+	{
+		AppendUpload(*block.upload, tag_count == 0 && block.prim, tag_count == 0 ? prim : 0, data);
+	}
+
+	return data;
+}
+
+auto PatchTable(const GIFBlock& block) -> std::vector<Patch>
+{
+	std::vector<Patch> patches;
+	const auto add = [&](GifRegister& reg, size_t qword, uint8_t shift) {
+		for(const auto& field : gs::RegisterFields(static_cast<uint64_t>(reg.GetID())))
+		{
+			patches.push_back({reg.GetPatch(), field.name, qword, static_cast<uint8_t>(field.bit + shift), field.width});
+		}
+	};
+
+	// Whichever tag comes first carries the PRIM, the register tag or the upload's
+	if(block.prim && !block.prim->GetPatch().empty())
+	{
+		add(*block.prim, 0, 47);
+	}
+
+	// Only the first loop of a repeat is listed, every loop sends the same registers
+	const bool looped = block.nloop > 1;
+	size_t index = 0;
+	for(const auto& reg : block.registers)
+	{
+		if(!reg->GetPatch().empty())
+		{
+			// A tag in front of every NLOOP_MAX loops
+			add(*reg, index + (looped ? 0 : index / gs::GIF_NLOOP_MAX) + 1, 0);
+		}
+		index++;
+	}
+
+	return patches;
+}
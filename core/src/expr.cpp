@@ -0,0 +1,110 @@
+#include "expr.hpp"
+#include "logger.hpp"
+
+#include <utility>
+
+auto Expr::Constant(int64_t value) -> Expr
+{
+	Expr expr;
+	expr.value = value;
+	return expr;
+}
+
+auto Expr::Parameter(const std::string& name) -> Expr
+{
+	Expr expr;
+	expr.op = Op::Parameter;
+	expr.name = name;
+	return expr;
+}
+
+auto Expr::Unary(Op op, Expr operand) -> Expr
+{
+	Expr expr;
+	expr.op = op;
+	expr.lhs = std::make_shared<const Expr>(std::move(operand));
+	return expr;
+}
+
+auto Expr::Binary(Op op, Expr lhs, Expr rhs) -> Expr
+{
+	Expr expr;
+	expr.op = op;
+	expr.lhs = std::make_shared<const Expr>(std::move(lhs));
+	expr.rhs = std::make_shared<const Expr>(std::move(rhs));
+	return expr;
+}
+
+auto Expr::Evaluate(const Bindings& bindings) const -> std::optional<int64_t>
+{
+	switch(op)
+	{
+		case Op::Constant:
+			return value;
+		case Op::Parameter:
+		{
+			const auto binding = bindings.find(name);
+			if(binding == bindings.end())
+			{
+				logger::error("Unknown parameter %s", name.c_str());
+				return std::nullopt;
+			}
+			return binding->second;
+		}
+		case Op::Negate:
+		{
+			const auto operand = lhs->Evaluate(bindings);
+			if(!operand)
+			{
+				return std::nullopt;
+			}
+			return -*operand;
+		}
+		default:
+			break;
+	}
+
+	const auto a = lhs->Evaluate(bindings);
+	const auto b = rhs->Evaluate(bindings);
+	if(!a || !b)
+	{
+		return std::nullopt;
+	}
+
+	switch(op)
+	{
+		case Op::Add:
+			return *a + *b;
+		case Op::Subtract:
+			return *a - *b;
+		case Op::Multiply:
+			return *a * *b;
+		case Op::Divide:
+			if(*b == 0)
+			{
+				logger::error("Division by zero");
+				return std::nullopt;
+			}
+			return *a / *b;
+		default:
+			std::unreachable();
+	}
+}
+
+void Expr::CollectParameters(std::vector<std::string>& names) const
+{
+	if(op == Op::Parameter)
+	{
+		names.push_back(name);
+	}
+
+	if(lhs)
+	{
+		lhs->CollectParameters(names);
+	}
+
+	if(rhs)
+	{
+		rhs->CollectParameters(names);
+	}
+}
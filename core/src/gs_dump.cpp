@@ -0,0 +1,163 @@
+#include "gs_dump.hpp"
+#include "logger.hpp"
+
+#include <cstring>
+
+namespace
+{
+	// Newer dumps put this where the CRC used to be, a sized header follows
+	constexpr uint32_t NEW_HEADER = 0xFFFFFFFF;
+	// GSPrivRegSet, the registers only the EE can write
+	constexpr size_t PRIV_REGS_SIZE = 0x2000;
+
+	enum class PacketType : uint8_t
+	{
+		Transfer,
+		VSync,
+		ReadFIFO2,
+		Registers,
+	};
+
+	// PCSX2 only writes the dumps uncompressed or through xz or zstd
+	constexpr uint8_t XZ_MAGIC[] = {0xFD, '7', 'z', 'X', 'Z', 0x00};
+	constexpr uint8_t ZSTD_MAGIC[] = {0x28, 0xB5, 0x2F, 0xFD};
+
+	template <size_t N>
+	bool StartsWith(std::span<const uint8_t> data, const uint8_t (&magic)[N])
+	{
+		return data.size() >= N && memcmp(data.data(), magic, N) == 0;
+	}
+} // namespace
+
+template <typename T>
+auto GSDump::TryRead(T& value) -> bool
+{
+	if(dump.size() - pos < sizeof(T))
+	{
+		return false;
+	}
+
+	memcpy(&value, dump.data() + pos, sizeof(T));
+	pos += sizeof(T);
+	return true;
+}
+
+auto GSDump::TrySkip(size_t size) -> bool
+{
+	if(dump.size() - pos < size)
+	{
+		return false;
+	}
+
+	pos += size;
+	return true;
+}
+
+auto GSDump::TryOpen() -> bool
+{
+	if(StartsWith(dump, XZ_MAGIC) || StartsWith(dump, ZSTD_MAGIC))
+	{
+		logger::error("GS dump is compressed, unpack it with xz or zstd first");
+		return false;
+	}
+
+	pos = 0;
+	uint32_t crc = 0;
+	uint32_t state_size = 0;
+	if(!TryRead(crc))
+	{
+		logger::error("GS dump is too short for a header");
+		return false;
+	}
+
+	if(crc == NEW_HEADER)
+	{
+		// The header proper starts with the state version and size, the serial and screenshot follow in it
+		uint32_t header_size = 0;
+		uint32_t state_version = 0;
+		if(!TryRead(header_size) || header_size < 2 * sizeof(uint32_t) || !TryRead(state_version) || !TryRead(state_size) ||
+			!TrySkip(header_size - 2 * sizeof(uint32_t)))
+		{
+			logger::error("GS dump header is truncated");
+			return false;
+		}
+	}
+	else if(!TryRead(state_size))
+	{
+		logger::error("GS dump header is truncated");
+		return false;
+	}
+
+	if(!TrySkip(state_size) || !TrySkip(PRIV_REGS_SIZE))
+	{
+		logger::error("GS dump ends inside its state snapshot");
+		return false;
+	}
+
+	return true;
+}
+
+auto GSDump::Next() -> std::optional<Transfer>
+{
+	while(pos < dump.size())
+	{
+		const size_t start = pos;
+		uint8_t type = 0;
+		uint8_t path = 0;
+		uint8_t field = 0;
+		uint32_t size = 0;
+		(void)TryRead(type);
+		switch(static_cast<PacketType>(type))
+		{
+			case PacketType::Transfer:
+				if(!TryRead(path) || !TryRead(size) || !TrySkip(size))
+				{
+					logger::error("Truncated transfer packet at 0x%zx", start);
+					failed = true;
+					return std::nullopt;
+				}
+
+				if(path > static_cast<uint8_t>(Path::Dummy))
+				{
+					logger::error("Transfer packet at 0x%zx is on unknown path %u", start, path);
+					failed = true;
+					return std::nullopt;
+				}
+
+				return Transfer{static_cast<Path>(path), pos - size, dump.subspan(pos - size, size)};
+			case PacketType::VSync:
+				if(!TryRead(field))
+				{
+					logger::error("Truncated vsync packet at 0x%zx", start);
+					failed = true;
+					return std::nullopt;
+				}
+
+				frames++;
+				break;
+			case PacketType::ReadFIFO2:
+				// Only the size of the read is recorded, the data came back from the GS
+				if(!TryRead(size))
+				{
+					logger::error("Truncated FIFO read packet at 0x%zx", start);
+					failed = true;
+					return std::nullopt;
+				}
+				break;
+			case PacketType::Registers:
+				if(!TrySkip(PRIV_REGS_SIZE))
+				{
+					logger::error("Truncated register packet at 0x%zx", start);
+					failed = true;
+					return std::nullopt;
+				}
+				break;
+			default:
+				logger::error("Unknown packet type %u at 0x%zx", type, start);
+				failed = true;
+				return std::nullopt;
+		}
+	}
+
+	return std::nullopt;
+}
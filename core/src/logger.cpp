@@ -1,3 +1,25 @@
 #include "logger.hpp"
 
 bool logger::g_log_enabled = true;
+
+namespace
+{
+	thread_local logger::ScopedSink* current_sink = nullptr;
+} // namespace
+
+logger::ScopedSink::ScopedSink(Sink sink)
+	: sink(std::move(sink))
+	, previous(current_sink)
+{
+	current_sink = this;
+}
+
+logger::ScopedSink::~ScopedSink()
+{
+	current_sink = previous;
+}
+
+auto logger::ScopedSink::Current() noexcept -> ScopedSink*
+{
+	return current_sink;
+}
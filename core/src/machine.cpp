@@ -4,8 +4,99 @@
 #include "registers.hpp"
 #include "types.hpp"
 #include "logger.hpp"
+#include "encoding.hpp"
+#include "mapped_file.hpp"
+#include "cost.hpp"
+#include "passes.hpp"
 
-Machine machine;
+namespace
+{
+	// Appends count - 1 more copies of the registers from first to the end
+	void AppendCopies(std::list<std::unique_ptr<GifRegister>>& registers, std::list<std::unique_ptr<GifRegister>>::iterator first, uint32_t count)
+	{
+		const auto last = std::prev(registers.end());
+		for(uint32_t i = 1; i < count; i++)
+		{
+			for(auto it = first;; it++)
+			{
+				registers.push_back((*it)->Clone());
+				if(it == last)
+				{
+					break;
+				}
+			}
+		}
+	}
+
+	// Every expression evaluated, std::nullopt if any of them fails
+	std::optional<std::vector<int64_t>> EvaluateAll(const std::vector<Expr>& exprs, const Expr::Bindings& bindings)
+	{
+		std::vector<int64_t> values;
+		values.reserve(exprs.size());
+		for(const auto& expr : exprs)
+		{
+			const auto value = expr.Evaluate(bindings);
+			if(!value)
+			{
+				return std::nullopt;
+			}
+			values.push_back(*value);
+		}
+		return values;
+	}
+
+	std::vector<Expr> Constants(const std::vector<int64_t>& values)
+	{
+		std::vector<Expr> exprs;
+		exprs.reserve(values.size());
+		for(const int64_t value : values)
+		{
+			exprs.push_back(Expr::Constant(value));
+		}
+		return exprs;
+	}
+
+	// How many 32bit words a register takes in a vertex file, 0 for the ones that can't be imported
+	size_t VertexWords(GifRegisters reg) noexcept
+	{
+		switch(reg)
+		{
+			case GifRegisters::RGBAQ:
+			case GifRegisters::XYZF2:
+				return 4;
+			case GifRegisters::XYZ2:
+				return 3;
+			case GifRegisters::ST:
+			case GifRegisters::UV:
+				return 2;
+			case GifRegisters::FOG:
+				return 1;
+			default:
+				return 0;
+		}
+	}
+
+	std::unique_ptr<GifRegister> ReadVertexRegister(GifRegisters reg, const uint32_t* words)
+	{
+		auto out = GenReg(reg);
+		switch(VertexWords(reg))
+		{
+			case 4:
+				out->Push(Vec4(words[0], words[1], words[2], words[3]));
+				break;
+			case 3:
+				out->Push(Vec3(words[0], words[1], words[2]));
+				break;
+			case 2:
+				out->Push(Vec2(words[0], words[1]));
+				break;
+			default:
+				out->Push(words[0]);
+				break;
+		}
+		return out;
+	}
+} // namespace
 
 auto Machine::TryStartBlock(const std::string& name) -> bool
 {
@@ -21,8 +112,7 @@ auto Machine::TryStartBlock(const std::string& name) -> bool
 	}
 	else
 	{
-		auto block_name_dup = std::find_if(blocks.begin(), blocks.end(), [&name](GIFBlock& block) { return block.name == name; });
-		if(block_name_dup != blocks.end())
+		if(blockNames.contains(name))
 		{
 			logger::error("Block with name %s already exists\n", name.c_str());
 			return false;
@@ -36,6 +126,7 @@ auto Machine::TryStartBlock(const std::string& name) -> bool
 		}
 
 		blocks.emplace_back(name);
+		blockNames.insert(name);
 		// Questionable usage of end and iterators here...
 		currentBlockIt = --blocks.end();
 		return true;
@@ -56,8 +147,7 @@ auto Machine::TryStartMacro(const std::string& name) -> bool
 	}
 	else
 	{
-		auto block_name_dup = std::find_if(blocks.begin(), blocks.end(), [&name](GIFBlock& block) { return block.name == name; });
-		if(block_name_dup != blocks.end())
+		if(blockNames.contains(name))
 		{
 			logger::error("Block with name %s already exists\n", name.c_str());
 			return false;
@@ -76,11 +166,173 @@ auto Machine::TryStartMacro(const std::string& name) -> bool
 	}
 }
 
+auto Machine::TryStartMacro(const std::string& name, const std::vector<std::string>& params) -> bool
+{
+	for(size_t i = 0; i < params.size(); i++)
+	{
+		if(std::find(params.begin(), params.begin() + i, params[i]) != params.begin() + i)
+		{
+			logger::error("Macro %s has parameter %s more than once\n", name.c_str(), params[i].c_str());
+			return false;
+		}
+	}
+
+	if(!TryStartMacro(name))
+	{
+		return false;
+	}
+
+	recording = &(templates[name] = MacroTemplate{params, {}});
+	return true;
+}
+
+void Machine::Record(MacroStep step)
+{
+	recording->steps.push_back(std::move(step));
+}
+
+auto Machine::TryCheckParameters(const std::vector<Expr>& exprs) const -> bool
+{
+	std::vector<std::string> names;
+	for(const auto& expr : exprs)
+	{
+		expr.CollectParameters(names);
+	}
+
+	for(const auto& name : names)
+	{
+		if(std::find(recording->params.begin(), recording->params.end(), name) == recording->params.end())
+		{
+			logger::error("Macro %s has no parameter %s\n", currentMacroIt->first.c_str(), name.c_str());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+auto Machine::TryStartRepeat(uint32_t count) -> bool
+{
+	if(!HasCurrentBlockOrMacro()) [[unlikely]]
+	{
+		logger::error("No block or macro to repeat registers in\n");
+		return false;
+	}
+
+	if(repeatCount != 0) [[unlikely]]
+	{
+		logger::error("Repeats can not be nested\n");
+		return false;
+	}
+
+	if(!TryCheckNoUpload()) [[unlikely]]
+	{
+		return false;
+	}
+
+	if(count == 0 || count > gs::GIF_NLOOP_MAX) [[unlikely]]
+	{
+		logger::error("Repeat count %u is out of range, it has to be between 1 and %u\n", count, gs::GIF_NLOOP_MAX);
+		return false;
+	}
+
+	if(recording != nullptr)
+	{
+		Record({.kind = MacroStep::Kind::StartRepeat, .count = count});
+		repeatCount = count;
+		return true;
+	}
+
+	if(CurrentBlockMacro().HasRegister() && !CurrentBlockMacro().CurrentRegister().Ready()) [[unlikely]]
+	{
+		logger::error("Current register is not fulfilled");
+		return false;
+	}
+
+	if(CurrentBlockMacro().nloop > 1)
+	{
+		Unroll(CurrentBlockMacro());
+	}
+
+	repeatStart = CurrentBlockMacro().registers.size();
+	repeatCount = count;
+	return true;
+}
+
+// A repeat that is all the block holds, past a PRIM that can go in the tag, is kept as is and sent with NLOOP.
+// Anything else is written out count times, a GIFtag loop can only cover the whole tag.
+auto Machine::TryEndRepeat() -> bool
+{
+	GIFBlock& block = CurrentBlockMacro();
+	const uint32_t count = repeatCount;
+	repeatCount = 0;
+
+	const size_t body = block.registers.size() - repeatStart;
+	if(body == 0) [[unlikely]]
+	{
+		logger::error("Repeat in %s has no registers\n", block.name.c_str());
+		return false;
+	}
+
+	const bool prim_prefix = repeatStart == 1 && block.registers.front()->GetID() == GifRegisterID::PRIM && OptimizeConfig[USE_TAG_PRIM];
+	if(HasCurrentBlock() && body <= 16 && (repeatStart == 0 || prim_prefix))
+	{
+		if(prim_prefix)
+		{
+			block.prim = std::move(block.registers.front());
+			block.registers.pop_front();
+		}
+
+		block.nloop = count;
+		return true;
+	}
+
+	logger::info("Unrolling repeat of %zu registers %u times in %s", body, count, block.name.c_str());
+	AppendCopies(block.registers, std::prev(block.registers.end(), static_cast<ptrdiff_t>(body)), count);
+	return true;
+}
+
+void Machine::Unroll(GIFBlock& block)
+{
+	logger::info("Unrolling repeat of %zu registers %u times in %s, more registers follow it", block.registers.size(), block.nloop, block.name.c_str());
+	AppendCopies(block.registers, block.registers.begin(), block.nloop);
+	block.nloop = 1;
+	if(block.prim)
+	{
+		block.registers.push_front(std::move(block.prim));
+	}
+}
+
 auto Machine::TryEndBlockMacro() -> bool
 {
+	if(recording != nullptr)
+	{
+		if(repeatCount != 0)
+		{
+			Record({.kind = MacroStep::Kind::EndRepeat});
+			repeatCount = 0;
+			return true;
+		}
+
+		if(recording->steps.empty())
+		{
+			logger::error("Block/Macro %s has no registers\n", CurrentMacro().name.c_str());
+			return false;
+		}
+
+		recording = nullptr;
+		currentMacroIt = macros.end();
+		return true;
+	}
+
+	if(repeatCount != 0)
+	{
+		return TryEndRepeat();
+	}
+
 	if(HasCurrentBlockOrMacro())
 	{
-		if(CurrentBlockMacro().registers.empty())
+		if(CurrentBlockMacro().registers.empty() && !CurrentBlockMacro().upload)
 		{
 			logger::error("Block/Macro %s has no registers\n", CurrentBlockMacro().name.c_str());
 			return false;
@@ -89,8 +341,9 @@ auto Machine::TryEndBlockMacro() -> bool
 
 	if(HasCurrentBlock())
 	{
-		FirstPassOptimize();
+		FirstPassOptimize(*currentBlockIt);
 		backend->emit(*currentBlockIt);
+		blocks.erase(currentBlockIt);
 		currentBlockIt = blocks.end();
 		return true;
 	}
@@ -105,6 +358,25 @@ auto Machine::TryEndBlockMacro() -> bool
 	return false;
 }
 
+auto Machine::TryEmitBlock(GIFBlock& block) -> bool
+{
+	if(HasCurrentBlockOrMacro()) [[unlikely]]
+	{
+		logger::error("Still waiting for you to end the block/macro %s\n", CurrentBlockMacro().name.c_str());
+		return false;
+	}
+
+	if(block.registers.empty()) [[unlikely]]
+	{
+		logger::error("Block %s has no registers\n", block.name.c_str());
+		return false;
+	}
+
+	FirstPassOptimize(block);
+	backend->emit(block);
+	return true;
+}
+
 auto Machine::TryInsertMacro(const std::string& name) -> bool
 {
 	if(!HasCurrentBlockOrMacro()) [[unlikely]]
@@ -113,9 +385,24 @@ auto Machine::TryInsertMacro(const std::string& name) -> bool
 		return false;
 	}
 
+	if(!TryCheckNoUpload()) [[unlikely]]
+	{
+		return false;
+	}
+
+	if(recording != nullptr || templates.contains(name))
+	{
+		return TryInsertMacro(name, std::vector<Expr>());
+	}
+
 	const auto& macro = macros.find(name);
 	if(macro != macros.end())
 	{
+		if(CurrentBlockMacro().nloop > 1)
+		{
+			Unroll(CurrentBlockMacro());
+		}
+
 		for(const auto& reg : macro->second.registers)
 		{
 			CurrentBlockMacro().registers.push_back(reg->Clone());
@@ -136,9 +423,31 @@ auto Machine::TryInsertMacro(const std::string& name, Vec2 xyOffset) -> bool
 		return false;
 	}
 
+	if(!TryCheckNoUpload()) [[unlikely]]
+	{
+		return false;
+	}
+
+	if(recording != nullptr)
+	{
+		Record({.kind = MacroStep::Kind::InsertOffset, .args = Constants({xyOffset.x, xyOffset.y}), .macro = name});
+		return true;
+	}
+
+	if(templates.contains(name)) [[unlikely]]
+	{
+		logger::error("Macro %s has parameters, it is inserted with arguments instead of an offset\n", name.c_str());
+		return false;
+	}
+
 	const auto& macro = macros.find(name);
 	if(macro != macros.end()) [[likely]]
 	{
+		if(CurrentBlockMacro().nloop > 1)
+		{
+			Unroll(CurrentBlockMacro());
+		}
+
 		GIFBlock tmpMacro = macro->second;
 		for(const auto& reg : tmpMacro.registers)
 		{
@@ -167,26 +476,351 @@ auto Machine::TryInsertMacro(const std::string& name, Vec2 xyOffset) -> bool
 	return false;
 }
 
+auto Machine::TryInsertMacro(const std::string& name, const std::vector<Expr>& args) -> bool
+{
+	if(!HasCurrentBlockOrMacro()) [[unlikely]]
+	{
+		logger::error("No block or macro to insert macro into\n");
+		return false;
+	}
+
+	if(!TryCheckNoUpload()) [[unlikely]]
+	{
+		return false;
+	}
+
+	if(recording != nullptr)
+	{
+		if(!TryCheckParameters(args))
+		{
+			return false;
+		}
+
+		Record({.kind = MacroStep::Kind::Insert, .args = args, .macro = name});
+		return true;
+	}
+
+	const auto macro = templates.find(name);
+	if(macro == templates.end())
+	{
+		if(args.empty())
+		{
+			return TryInsertMacro(name);
+		}
+
+		logger::error("Macro %s does not take arguments or does not exist\n", name.c_str());
+		return false;
+	}
+
+	if(args.size() != macro->second.params.size()) [[unlikely]]
+	{
+		logger::error("Macro %s takes %zu arguments, %zu were given\n", name.c_str(), macro->second.params.size(), args.size());
+		return false;
+	}
+
+	// Outside of a macro the arguments can only be constants
+	const auto values = EvaluateAll(args, {});
+	if(!values)
+	{
+		return false;
+	}
+
+	Expr::Bindings bindings;
+	for(size_t i = 0; i < args.size(); i++)
+	{
+		bindings[macro->second.params[i]] = (*values)[i];
+	}
+
+	if(insertDepth == MAX_INSERT_DEPTH) [[unlikely]]
+	{
+		logger::error("Macro %s is nested more than %zu deep, does it insert itself?\n", name.c_str(), MAX_INSERT_DEPTH);
+		return false;
+	}
+
+	insertDepth++;
+	const bool inserted = TryReplay(name, macro->second, bindings);
+	insertDepth--;
+	return inserted;
+}
+
+auto Machine::TryReplay(const std::string& name, const MacroTemplate& macro, const Expr::Bindings& bindings) -> bool
+{
+	for(const auto& step : macro.steps)
+	{
+		bool done = false;
+		switch(step.kind)
+		{
+			case MacroStep::Kind::SetRegister:
+				done = TrySetRegister(step.reg->Clone());
+				break;
+			case MacroStep::Kind::Push:
+				if(const auto values = EvaluateAll(step.args, bindings))
+				{
+					done = TryPushValues(*values);
+				}
+				break;
+			case MacroStep::Kind::Modifier:
+				done = TryApplyModifier(step.mod);
+				break;
+			case MacroStep::Kind::Insert:
+				if(const auto values = EvaluateAll(step.args, bindings))
+				{
+					done = TryInsertMacro(step.macro, Constants(*values));
+				}
+				break;
+			case MacroStep::Kind::InsertOffset:
+				if(const auto values = EvaluateAll(step.args, bindings))
+				{
+					done = TryInsertMacro(step.macro, Vec2((*values)[0], (*values)[1]));
+				}
+				break;
+			case MacroStep::Kind::StartRepeat:
+				done = TryStartRepeat(step.count);
+				break;
+			case MacroStep::Kind::EndRepeat:
+				done = TryEndBlockMacro();
+				break;
+		}
+
+		if(!done)
+		{
+			logger::error("Failed to insert macro %s\n", name.c_str());
+			return false;
+		}
+	}
+
+	return true;
+}
+
 auto Machine::TrySetRegister(std::unique_ptr<GifRegister> reg) -> bool
 {
+	const std::string patch = std::exchange(pendingPatch, {});
+	if(recording != nullptr)
+	{
+		Record({.kind = MacroStep::Kind::SetRegister, .reg = std::shared_ptr<GifRegister>(std::move(reg))});
+		return true;
+	}
+
 	if(!HasCurrentBlockOrMacro())
 	{
 		logger::error("Not in current block");
 	}
+	else if(!TryCheckNoUpload())
+	{
+		return false;
+	}
 	else if(CurrentBlockMacro().HasRegister() && !CurrentBlockMacro().CurrentRegister().Ready())
 	{
 		logger::error("Current register is not fulfilled");
 	}
 	else [[likely]]
 	{
+		if(CurrentBlockMacro().nloop > 1)
+		{
+			Unroll(CurrentBlockMacro());
+		}
+		reg->SetPatch(patch);
 		CurrentBlockMacro().registers.emplace_back(std::move(reg));
 		return true;
 	}
 	return false;
 }
 
+auto Machine::TryMarkPatch(const std::string& name) -> bool
+{
+	if(recording != nullptr || HasCurrentMacro())
+	{
+		logger::error("Patch field %s is in a macro, only registers of a block can be patched", name.c_str());
+		return false;
+	}
+
+	if(!HasCurrentBlock())
+	{
+		logger::error("Not in current block");
+		return false;
+	}
+
+	if(repeatCount != 0)
+	{
+		logger::error("Patch field %s is in a repeat, it would be sent %u times", name.c_str(), repeatCount);
+		return false;
+	}
+
+	const auto& block = CurrentBlock();
+	const auto taken = [&](const std::unique_ptr<GifRegister>& reg) { return reg && reg->GetPatch() == name; };
+	if(taken(block.prim) || std::ranges::any_of(block.registers, taken))
+	{
+		logger::error("Patch field %s is already in block %s", name.c_str(), block.name.c_str());
+		return false;
+	}
+
+	pendingPatch = name;
+	return true;
+}
+
+auto Machine::TryImportVertices(const std::string& path, const std::vector<GifRegisters>& layout) -> bool
+{
+	if(recording != nullptr)
+	{
+		logger::error("Vertices can not be imported in a macro with parameters");
+		return false;
+	}
+
+	if(!HasCurrentBlockOrMacro())
+	{
+		logger::error("Not in current block");
+		return false;
+	}
+
+	if(!TryCheckNoUpload())
+	{
+		return false;
+	}
+
+	if(CurrentBlockMacro().HasRegister() && !CurrentBlockMacro().CurrentRegister().Ready())
+	{
+		logger::error("Current register is not fulfilled");
+		return false;
+	}
+
+	size_t stride = 0;
+	for(const GifRegisters reg : layout)
+	{
+		const size_t words = VertexWords(reg);
+		if(words == 0)
+		{
+			logger::error("%s can not be imported from a vertex file", GenReg(reg)->GetName().c_str());
+			return false;
+		}
+		stride += words;
+	}
+
+	if(stride == 0)
+	{
+		logger::error("A vertex layout needs at least one register");
+		return false;
+	}
+
+	MappedFile file;
+	if(!file.TryOpen(path))
+	{
+		return false;
+	}
+
+	const size_t vertex_size = stride * sizeof(uint32_t);
+	if(file.Size() % vertex_size != 0)
+	{
+		logger::error("%s is %zu bytes, not a whole number of %zu byte vertices", path.c_str(), file.Size(), vertex_size);
+		return false;
+	}
+
+	// Mappings are page aligned, the words can be read in place
+	const auto words = file.As<uint32_t>();
+	GIFBlock& block = CurrentBlockMacro();
+	if(block.nloop > 1)
+	{
+		Unroll(block);
+	}
+
+	for(size_t i = 0; i < words.size(); i += stride)
+	{
+		const uint32_t* vertex = words.data() + i;
+		for(const GifRegisters reg : layout)
+		{
+			block.registers.emplace_back(ReadVertexRegister(reg, vertex));
+			vertex += VertexWords(reg);
+		}
+	}
+
+	logger::info("Imported %zu vertices from %s", words.size() / stride, path.c_str());
+	return true;
+}
+
+auto Machine::TryUploadTexture(const std::string& path, uint32_t tbp, uint32_t tbw, PSM psm, Vec4 rect) -> bool
+{
+	if(!HasCurrentBlock())
+	{
+		logger::error("Textures can only be uploaded in a block");
+		return false;
+	}
+
+	if(repeatCount != 0)
+	{
+		logger::error("Textures can not be uploaded in a repeat");
+		return false;
+	}
+
+	if(!TryCheckNoUpload())
+	{
+		return false;
+	}
+
+	if(CurrentBlock().HasRegister() && !CurrentBlock().CurrentRegister().Ready())
+	{
+		logger::error("Current register is not fulfilled");
+		return false;
+	}
+
+	if(tbp > 0x3FFF || tbw == 0 || tbw > 0x3F)
+	{
+		logger::error("Texture base 0x%x or width %u is out of range", tbp, tbw);
+		return false;
+	}
+
+	// TRXPOS and TRXREG only go up to 2047
+	if(rect.z == 0 || rect.w == 0 || rect.x + rect.z > 2048 || rect.y + rect.w > 2048)
+	{
+		logger::error("Upload rectangle %u,%u,%u,%u does not fit in VRAM", rect.x, rect.y, rect.z, rect.w);
+		return false;
+	}
+
+	auto file = std::make_shared<MappedFile>();
+	if(!file->TryOpen(path))
+	{
+		return false;
+	}
+
+	const size_t size = static_cast<size_t>(rect.z) * rect.w * TextureUpload::BytesPerPixel(psm);
+	if(file->Size() != size)
+	{
+		logger::error("%s is %zu bytes, a %ux%u upload needs %zu", path.c_str(), file->Size(), rect.z, rect.w, size);
+		return false;
+	}
+
+	if(size % 8 != 0)
+	{
+		logger::error("A %ux%u upload is %zu bytes, the GS only transfers whole 64bit words", rect.z, rect.w, size);
+		return false;
+	}
+
+	if(CurrentBlock().nloop > 1)
+	{
+		Unroll(CurrentBlock());
+	}
+
+	CurrentBlock().upload = TextureUpload{.path = path, .file = std::move(file), .tbp = tbp, .tbw = tbw, .psm = psm, .rect = rect};
+	return true;
+}
+
+auto Machine::TryCheckNoUpload() -> bool
+{
+	if(HasCurrentBlock() && CurrentBlock().upload)
+	{
+		logger::error("Nothing can follow the texture upload in block %s", CurrentBlock().name.c_str());
+		return false;
+	}
+
+	return true;
+}
+
 auto Machine::TryPushReg(int32_t value) -> bool
 {
+	if(recording != nullptr)
+	{
+		Record({.kind = MacroStep::Kind::Push, .args = Constants({value})});
+		return true;
+	}
+
 	if(HasCurrentBlockOrMacro() && CurrentBlockMacro().HasRegister()) [[likely]]
 	{
 		return CurrentBlockMacro().CurrentRegister().Push(value);
@@ -198,6 +832,12 @@ auto Machine::TryPushReg(int32_t value) -> bool
 
 auto Machine::TryPushReg(Vec2 value) -> bool
 {
+	if(recording != nullptr)
+	{
+		Record({.kind = MacroStep::Kind::Push, .args = Constants({value.x, value.y})});
+		return true;
+	}
+
 	if(HasCurrentBlockOrMacro() && CurrentBlockMacro().HasRegister()) [[likely]]
 	{
 		return CurrentBlockMacro().CurrentRegister().Push(value);
@@ -209,6 +849,12 @@ auto Machine::TryPushReg(Vec2 value) -> bool
 
 auto Machine::TryPushReg(Vec3 value) -> bool
 {
+	if(recording != nullptr)
+	{
+		Record({.kind = MacroStep::Kind::Push, .args = Constants({value.x, value.y, value.z})});
+		return true;
+	}
+
 	if(HasCurrentBlockOrMacro() && CurrentBlockMacro().HasRegister()) [[likely]]
 	{
 		return CurrentBlockMacro().CurrentRegister().Push(value);
@@ -220,6 +866,12 @@ auto Machine::TryPushReg(Vec3 value) -> bool
 
 auto Machine::TryPushReg(Vec4 value) -> bool
 {
+	if(recording != nullptr)
+	{
+		Record({.kind = MacroStep::Kind::Push, .args = Constants({value.x, value.y, value.z, value.w})});
+		return true;
+	}
+
 	if(HasCurrentBlockOrMacro() && CurrentBlockMacro().HasRegister()) [[likely]]
 	{
 		return CurrentBlockMacro().CurrentRegister().Push(value);
@@ -229,8 +881,54 @@ auto Machine::TryPushReg(Vec4 value) -> bool
 	return false;
 }
 
+auto Machine::TryPushReg(const std::vector<Expr>& values) -> bool
+{
+	if(values.empty() || values.size() > 4) [[unlikely]]
+	{
+		logger::error("A register takes 1 to 4 values at a time, %zu were given", values.size());
+		return false;
+	}
+
+	if(recording != nullptr)
+	{
+		if(!TryCheckParameters(values))
+		{
+			return false;
+		}
+
+		Record({.kind = MacroStep::Kind::Push, .args = values});
+		return true;
+	}
+
+	const auto evaluated = EvaluateAll(values, {});
+	return evaluated && TryPushValues(*evaluated);
+}
+
+auto Machine::TryPushValues(const std::vector<int64_t>& values) -> bool
+{
+	// Wraps like the macro XY offset always has
+	const auto at = [&values](size_t i) { return static_cast<uint32_t>(values[i]); };
+	switch(values.size())
+	{
+		case 1:
+			return TryPushReg(static_cast<int32_t>(at(0)));
+		case 2:
+			return TryPushReg(Vec2(at(0), at(1)));
+		case 3:
+			return TryPushReg(Vec3(at(0), at(1), at(2)));
+		default:
+			return TryPushReg(Vec4(at(0), at(1), at(2), at(3)));
+	}
+}
+
 auto Machine::TryApplyModifier(RegModifier mod) -> bool
 {
+	if(recording != nullptr)
+	{
+		Record({.kind = MacroStep::Kind::Modifier, .mod = mod});
+		return true;
+	}
+
 	if(HasCurrentBlockOrMacro() && CurrentBlockMacro().HasRegister()) [[likely]]
 	{
 		return CurrentBlockMacro().CurrentRegister().ApplyModifier(mod);
@@ -242,25 +940,75 @@ auto Machine::TryApplyModifier(RegModifier mod) -> bool
 
 // First pass, doesn't know anything about the output format
 // Second pass would be in the backend
-void Machine::FirstPassOptimize()
+void Machine::FirstPassOptimize(GIFBlock& block)
 {
+	// Patched fields are found by where the registers are, and the runtime can move vertices anywhere
+	const bool patched = block.HasPatches();
+	if(patched)
+	{
+		logger::info("Leaving the primitives of %s as written, it has patch fields", block.name.c_str());
+	}
+
+	if(!patched && OptimizeConfig[SCISSOR_CULLING])
+	{
+		if(const size_t culled = CullOutsideScissor(block))
+		{
+			logger::info("Culled %zu primitives outside the scissor in %s", culled, block.name.c_str());
+		}
+	}
+
+	if(!patched && OptimizeConfig[DEGENERATE_REMOVAL])
+	{
+		if(const size_t dropped = RemoveDegenerates(block))
+		{
+			logger::info("Dropped %zu vertices of degenerate primitives in %s", dropped, block.name.c_str());
+		}
+	}
+
+	if(!patched && OptimizeConfig[GOURAUD_DEMOTION])
+	{
+		if(const size_t demoted = DemoteGouraud(block))
+		{
+			logger::info("Demoted %zu single color gouraud PRIMs in %s to flat", demoted, block.name.c_str());
+		}
+	}
+
+	if(!patched && OptimizeConfig[SPRITE_MERGING])
+	{
+		if(const size_t merged = MergeSprites(block))
+		{
+			logger::info("Merged %zu adjacent sprites in %s", merged, block.name.c_str());
+		}
+	}
+
+	if(!patched && spriteStripWidth != 0)
+	{
+		const uint64_t before = EstimateCost(block).Cycles();
+		if(const size_t split = SplitSprites(block, spriteStripWidth))
+		{
+			logger::info("Split %zu sprites in %s into %u texel strips, estimated %llu -> %llu GS cycles", split, block.name.c_str(), spriteStripWidth,
+				static_cast<unsigned long long>(before), static_cast<unsigned long long>(EstimateCost(block).Cycles()));
+		}
+	}
+
 	// Dead store Elimination
 	if(OptimizeConfig[DEAD_STORE_ELIMINATION])
 	{
-		auto lastRegIt = CurrentBlock().registers.end();
+		auto lastRegIt = block.registers.end();
 
-		for(auto regIt = CurrentBlock().registers.begin(); regIt != CurrentBlock().registers.end(); regIt++)
+		for(auto regIt = block.registers.begin(); regIt != block.registers.end(); regIt++)
 		{
-			if(regIt->operator->()->HasSideEffects())
+			// Patch fields are kept, the runtime expects to find them in the packet
+			if(regIt->operator->()->HasSideEffects() || !regIt->operator->()->GetPatch().empty())
 			{
-				lastRegIt = CurrentBlock().registers.end();
+				lastRegIt = block.registers.end();
 			}
-			else if(lastRegIt != CurrentBlock().registers.end())
+			else if(lastRegIt != block.registers.end())
 			{
 				if(lastRegIt->operator->()->GetID() == regIt->operator->()->GetID())
 				{
 					logger::info("Dead store elimination: %s", lastRegIt->operator->()->GetName().cbegin());
-					CurrentBlock().registers.remove(*lastRegIt);
+					block.registers.remove(*lastRegIt);
 					lastRegIt = regIt;
 				}
 				else
@@ -276,15 +1024,16 @@ void Machine::FirstPassOptimize()
 	}
 
 	// Packing Prim into GIFTAG (should have no side effects)
-	if(OptimizeConfig[USE_TAG_PRIM])
+	// A looped block sends its PRIM every loop, the tag would only send it once
+	if(OptimizeConfig[USE_TAG_PRIM] && block.nloop == 1 && !block.prim)
 	{
-		for(const auto& reg : CurrentBlock().registers)
+		for(const auto& reg : block.registers)
 		{
 			if(reg->GetID() == GifRegisterID::PRIM)
 			{
 				logger::info("Packing Prim into GIFTAG");
-				CurrentBlock().prim = reg->Clone();
-				CurrentBlock().registers.remove(reg);
+				block.prim = reg->Clone();
+				block.registers.remove(reg);
 				break;
 			}
 		}
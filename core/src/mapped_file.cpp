@@ -0,0 +1,71 @@
+#include "mapped_file.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile()
+{
+	if(data != nullptr)
+	{
+		munmap(const_cast<uint8_t*>(data), size);
+	}
+}
+
+auto MappedFile::TryOpen(const std::string& path) -> bool
+{
+	const int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		logger::error("Failed to open file: %s (%s)", path.c_str(), strerror(errno));
+		return false;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		logger::error("Failed to stat file: %s (%s)", path.c_str(), strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	size = static_cast<size_t>(st.st_size);
+	// Nothing to map, an empty file is an empty view
+	if(size == 0)
+	{
+		close(fd);
+		return true;
+	}
+
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file
+	close(fd);
+	if(mapping == MAP_FAILED)
+	{
+		logger::error("Failed to map file: %s (%s)", path.c_str(), strerror(errno));
+		size = 0;
+		return false;
+	}
+
+	madvise(mapping, size, MADV_SEQUENTIAL);
+	data = static_cast<const uint8_t*>(mapping);
+	return true;
+}
+
+void MappedFile::Release(size_t offset) noexcept
+{
+	const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t end = std::min(offset, size) / page_size * page_size;
+	if(data == nullptr || end <= released)
+	{
+		return;
+	}
+
+	madvise(const_cast<uint8_t*>(data) + released, end - released, MADV_DONTNEED);
+	released = end;
+}
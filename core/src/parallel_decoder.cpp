@@ -0,0 +1,87 @@
+#include "parallel_decoder.hpp"
+
+#include <algorithm>
+#include <fmt/format.h>
+
+ParallelDecoder::ParallelDecoder(size_t threads)
+{
+	for(size_t i = 0; i < std::max<size_t>(threads, 1); i++)
+	{
+		workers.emplace_back(&ParallelDecoder::Work, this);
+	}
+}
+
+ParallelDecoder::~ParallelDecoder()
+{
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for(auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void ParallelDecoder::Submit(const uint64_t* words, std::span<const size_t> tags, std::span<GIFBlock> blocks)
+{
+	{
+		std::lock_guard lock(mutex);
+		this->words = words;
+		this->tags = tags;
+		this->blocks = blocks;
+		next = 0;
+		busy = workers.size();
+		generation++;
+	}
+	wake.notify_all();
+}
+
+void ParallelDecoder::Wait()
+{
+	std::unique_lock lock(mutex);
+	done.wait(lock, [this] { return busy == 0; });
+}
+
+void ParallelDecoder::Work()
+{
+	size_t seen = 0;
+	while(true)
+	{
+		{
+			std::unique_lock lock(mutex);
+			wake.wait(lock, [&] { return stopping || generation != seen; });
+			if(stopping)
+			{
+				return;
+			}
+			seen = generation;
+		}
+
+		for(size_t first = next.fetch_add(CHUNK_TAGS); first < tags.size(); first = next.fetch_add(CHUNK_TAGS))
+		{
+			const size_t last = std::min(first + CHUNK_TAGS, tags.size());
+			for(size_t i = first; i < last; i++)
+			{
+				const size_t pos = tags[i];
+				const size_t offset = pos * sizeof(uint64_t);
+				GIFBlock& block = blocks[i];
+				block.name = fmt::format("block_{:x}", offset);
+				block.prim.reset();
+				block.registers.clear();
+				block.nloop = 1;
+				DecodeTag(*reinterpret_cast<const GIFTag*>(words + pos), words + pos + 2, offset, block);
+			}
+		}
+
+		{
+			std::lock_guard lock(mutex);
+			if(--busy == 0)
+			{
+				done.notify_all();
+			}
+		}
+	}
+}
@@ -1,10 +1,12 @@
 %include {
 #include <any>
-#include <iostream>
 #include <cassert>
 #include "types.hpp"
+#include "expr.hpp"
+#include "logger.hpp"
 #include "registers.hpp"
 #include "machine.hpp"
+#include "scanner.hpp"
 #include "parser.h"
 
 
@@ -12,22 +14,37 @@
 }
 
 %syntax_error {
-  std::cout << "Syntax error." << std::endl;
+  logger::error("Syntax error.");
   // print the bad token
-  *valid = false;
+  state->valid = false;
 }
 
 %token_type {std::any *}
 %token_destructor { delete $$; }
 
 //%destructor IDENTIFIER { delete $$; }
-%extra_argument { bool* valid }
+%extra_argument { ParseState* state }
+
+%left PLUS MINUS.
+%left TIMES DIVIDE.
+%right NEGATE.
+
+%type expr {Expr*}
+%destructor expr { delete $$; }
+%type exprs {std::vector<Expr>*}
+%destructor exprs { delete $$; }
+%type layout {std::vector<GifRegisters>*}
+%destructor layout { delete $$; }
 
 program ::= create_block. 
 program ::= create_macro.
 program ::= set_register params.
+program ::= mark_patch set_register params.
 program ::= end_block.
 program ::= insert_macro.
+program ::= start_repeat.
+program ::= import_vertices.
+program ::= upload_texture.
 
 // Register stuff
 params ::= param.
@@ -35,8 +52,8 @@ params ::= params param.
 
 param ::= VEC4(A). {
 	Vec4 val = std::any_cast<Vec4>(*A);
-	if(!machine.TryPushReg(val)) {
-		*valid = false;
+	if(!state->machine.TryPushReg(val)) {
+		state->valid = false;
 	}
 
 	delete A;
@@ -44,8 +61,8 @@ param ::= VEC4(A). {
 
 param ::= VEC3(A). {
 	Vec3 val = std::any_cast<Vec3>(*A);
-	if(!machine.TryPushReg(val)) {
-		*valid = false;
+	if(!state->machine.TryPushReg(val)) {
+		state->valid = false;
 	}
 
 	delete A;
@@ -53,33 +70,101 @@ param ::= VEC3(A). {
 
 param ::= VEC2(A). {
 	Vec2 val = std::any_cast<Vec2>(*A);
-	if(!machine.TryPushReg(val)) {
-		*valid = false;
+	if(!state->machine.TryPushReg(val)) {
+		state->valid = false;
 	}
 
 	delete A;
 }
 
 param ::= NUMBER_LITERAL(A). {
-	std::cout << "Number literal" << std::endl;
-	if(!machine.TryPushReg(std::any_cast<uint32_t>(*A))) {
-		*valid = false;
+	logger::debug("Number literal");
+	if(!state->machine.TryPushReg(std::any_cast<uint32_t>(*A))) {
+		state->valid = false;
 	}
 
 	delete A;
 }
 
 param ::= MOD(A). {
-	if(!machine.TryApplyModifier(std::any_cast<RegModifier>(*A))) {
-		*valid = false;
+	if(!state->machine.TryApplyModifier(std::any_cast<RegModifier>(*A))) {
+		state->valid = false;
+	}
+
+	delete A;
+}
+
+// Expressions, macro parameters are only known once the macro is inserted
+param ::= LPAREN exprs(A) RPAREN. {
+	if(!state->machine.TryPushReg(*A)) {
+		state->valid = false;
 	}
 
 	delete A;
 }
 
+exprs(R) ::= expr(A). {
+	R = new std::vector<Expr>{std::move(*A)};
+	delete A;
+}
+
+exprs(R) ::= exprs(A) COMMA expr(B). {
+	R = A;
+	R->push_back(std::move(*B));
+	delete B;
+}
+
+expr(R) ::= NUMBER_LITERAL(A). {
+	R = new Expr(Expr::Constant(std::any_cast<uint32_t>(*A)));
+	delete A;
+}
+
+expr(R) ::= IDENTIFIER(A). {
+	R = new Expr(Expr::Parameter(std::any_cast<std::string>(*A)));
+	delete A;
+}
+
+expr(R) ::= LPAREN expr(A) RPAREN. {
+	R = A;
+}
+
+expr(R) ::= MINUS expr(A). [NEGATE] {
+	R = new Expr(Expr::Unary(Expr::Op::Negate, std::move(*A)));
+	delete A;
+}
+
+expr(R) ::= expr(A) PLUS expr(B). {
+	R = new Expr(Expr::Binary(Expr::Op::Add, std::move(*A), std::move(*B)));
+	delete A;
+	delete B;
+}
+
+expr(R) ::= expr(A) MINUS expr(B). {
+	R = new Expr(Expr::Binary(Expr::Op::Subtract, std::move(*A), std::move(*B)));
+	delete A;
+	delete B;
+}
+
+expr(R) ::= expr(A) TIMES expr(B). {
+	R = new Expr(Expr::Binary(Expr::Op::Multiply, std::move(*A), std::move(*B)));
+	delete A;
+	delete B;
+}
+
+expr(R) ::= expr(A) DIVIDE expr(B). {
+	R = new Expr(Expr::Binary(Expr::Op::Divide, std::move(*A), std::move(*B)));
+	delete A;
+	delete B;
+}
+
+// The register that follows is named, backends list where its fields are so they can be rewritten at runtime
+mark_patch ::= PATCH IDENTIFIER(A). {
+	state->valid = state->machine.TryMarkPatch(std::any_cast<std::string>(*A));
+	delete A;
+}
 set_register ::= REG(A). {
-	if(!machine.TrySetRegister(GenReg(std::any_cast<GifRegisters>(*A)))) {
-		*valid = false;
+	if(!state->machine.TrySetRegister(GenReg(std::any_cast<GifRegisters>(*A)))) {
+		state->valid = false;
 	}
 
 	delete A;
@@ -88,31 +173,113 @@ set_register ::= REG(A). {
 // Block madness
 
 create_block ::= IDENTIFIER(A) BLOCK_START. {
-	*valid = machine.TryStartBlock(std::any_cast<std::string>(*A));
+	state->valid = state->machine.TryStartBlock(std::any_cast<std::string>(*A));
 
 	delete A;
 }
 
 create_macro ::= MACRO IDENTIFIER(A) BLOCK_START. {
-	*valid = machine.TryStartMacro(std::any_cast<std::string>(*A));
+	state->valid = state->machine.TryStartMacro(std::any_cast<std::string>(*A));
+
+	delete A;
+}
+
+
+// Parameters are parsed as expressions, each one has to be a bare name
+create_macro ::= MACRO IDENTIFIER(A) LPAREN exprs(B) RPAREN BLOCK_START. {
+	std::vector<std::string> params;
+	for(const auto& expr : *B) {
+		if(expr.GetOp() != Expr::Op::Parameter) {
+			logger::error("Macro parameters have to be names.");
+			state->valid = false;
+		}
+		params.push_back(expr.GetName());
+	}
+
+	if(state->valid) {
+		state->valid = state->machine.TryStartMacro(std::any_cast<std::string>(*A), params);
+	}
 
 	delete A;
+	delete B;
 }
 
+insert_macro ::= MACRO IDENTIFIER(A) LPAREN exprs(B) RPAREN. {
+	state->valid = state->machine.TryInsertMacro(std::any_cast<std::string>(*A), *B);
+
+	delete A;
+	delete B;
+}
 
 insert_macro ::= MACRO IDENTIFIER(A). {
-	*valid = machine.TryInsertMacro(std::any_cast<std::string>(*A));
+	state->valid = state->machine.TryInsertMacro(std::any_cast<std::string>(*A));
 
 	delete A;
 }
 
 insert_macro ::= MACRO IDENTIFIER(A) VEC2(B). {
-	*valid = machine.TryInsertMacro(std::any_cast<std::string>(*A), std::any_cast<Vec2>(*B));
+	state->valid = state->machine.TryInsertMacro(std::any_cast<std::string>(*A), std::any_cast<Vec2>(*B));
 
 	delete A;
 	delete B;
 }
 
+start_repeat ::= REPEAT NUMBER_LITERAL(A) BLOCK_START. {
+	state->valid = state->machine.TryStartRepeat(std::any_cast<uint32_t>(*A));
+
+	delete A;
+}
+
+// Paths are taken as written, relative ones from the working directory
+import_vertices ::= VERTICES STRING_LITERAL(A) layout(B). {
+	state->valid = state->machine.TryImportVertices(std::any_cast<std::string>(*A), *B);
+
+	delete A;
+	delete B;
+}
+
+// Same argument order as tex0, then the destination rectangle
+upload_texture ::= UPLOAD STRING_LITERAL(A) NUMBER_LITERAL(B) NUMBER_LITERAL(C) MOD(D) VEC4(E). {
+	std::optional<PSM> psm;
+	switch(std::any_cast<RegModifier>(*D)) {
+		case RegModifier::CT32:
+			psm = PSM::CT32;
+			break;
+		case RegModifier::CT24:
+			psm = PSM::CT24;
+			break;
+		case RegModifier::CT16:
+			psm = PSM::CT16;
+			break;
+		default:
+			logger::error("Textures are uploaded as ct32, ct24 or ct16.");
+			state->valid = false;
+			break;
+	}
+
+	if(psm) {
+		state->valid = state->machine.TryUploadTexture(std::any_cast<std::string>(*A), std::any_cast<uint32_t>(*B), std::any_cast<uint32_t>(*C),
+			*psm, std::any_cast<Vec4>(*E));
+	}
+
+	delete A;
+	delete B;
+	delete C;
+	delete D;
+	delete E;
+}
+
+layout(R) ::= REG(A). {
+	R = new std::vector<GifRegisters>{std::any_cast<GifRegisters>(*A)};
+	delete A;
+}
+
+layout(R) ::= layout(A) REG(B). {
+	R = A;
+	R->push_back(std::any_cast<GifRegisters>(*B));
+	delete B;
+}
+
 end_block ::= BLOCK_END. {
-	*valid = machine.TryEndBlockMacro();
+	state->valid = state->machine.TryEndBlockMacro();
 }
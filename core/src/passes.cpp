@@ -0,0 +1,755 @@
+#include "passes.hpp"
+
+#include <algorithm>
+#include <initializer_list>
+#include <iterator>
+#include <optional>
+#include <set>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+	using RegisterList = std::list<std::unique_ptr<GifRegister>>;
+
+	struct SpriteVertex
+	{
+		int64_t u, v;
+		int64_t x, y;
+		uint32_t z;
+	};
+
+	// Whether the registers from it on are the given ones, in order
+	bool Matches(RegisterList::const_iterator it, RegisterList::const_iterator end, std::initializer_list<GifRegisterID> ids)
+	{
+		for(const GifRegisterID id : ids)
+		{
+			if(it == end || (*it)->GetID() != id)
+			{
+				return false;
+			}
+			it++;
+		}
+		return true;
+	}
+
+	SpriteVertex ReadVertex(RegisterList::const_iterator it)
+	{
+		const Vec2 uv = dynamic_cast<const UV&>(**it).GetValue();
+		const Vec3 xyz = dynamic_cast<const XYZ2&>(**std::next(it)).GetValue();
+		return {uv.x, uv.y, xyz.x, xyz.y, xyz.z};
+	}
+
+	// The U of every cut from a to b, in the order they are met, empty if one would fall between pixels
+	std::vector<int64_t> StripCuts(const SpriteVertex& a, const SpriteVertex& b, uint32_t width)
+	{
+		std::vector<int64_t> cuts;
+		if(a.u == b.u)
+		{
+			return cuts;
+		}
+
+		const int64_t step = a.u < b.u ? width : -static_cast<int64_t>(width);
+		// First multiple of width past a.u, going towards b.u
+		int64_t u = a.u < b.u ? (a.u / width + 1) * width : (a.u - 1) / width * width;
+		for(; a.u < b.u ? u < b.u : u > b.u; u += step)
+		{
+			if((u - a.u) * (b.x - a.x) % (b.u - a.u) != 0)
+			{
+				return {};
+			}
+			cuts.push_back(u);
+		}
+		return cuts;
+	}
+
+	bool IsKick(GifRegisterID id) noexcept
+	{
+		return id == GifRegisterID::XYZ2 || id == GifRegisterID::XYZF2;
+	}
+
+	// Per vertex state, only the last write before a kick matters
+	bool IsAttribute(GifRegisterID id) noexcept
+	{
+		return id == GifRegisterID::RGBAQ || id == GifRegisterID::ST || id == GifRegisterID::UV || id == GifRegisterID::FOG;
+	}
+
+	Vec3 KickPosition(GifRegister& reg)
+	{
+		if(reg.GetID() == GifRegisterID::XYZF2)
+		{
+			const Vec4 xyzf = dynamic_cast<const XYZF2&>(reg).GetValue();
+			return Vec3(xyzf.x, xyzf.y, xyzf.z);
+		}
+		return dynamic_cast<const XYZ2&>(reg).GetValue();
+	}
+
+	// How the GS builds primitives out of the vertex queue
+	struct Assembly
+	{
+		// Vertices in one primitive
+		size_t size;
+		// Vertices the next primitive starts on, past the first of this one
+		size_t step;
+		// The first vertex stays in every primitive
+		bool fan = false;
+	};
+
+	Assembly AssemblyOf(PrimType type) noexcept
+	{
+		switch(type)
+		{
+			case PrimType::Point:
+				return {1, 1};
+			case PrimType::Line:
+			case PrimType::Sprite:
+				return {2, 2};
+			case PrimType::LineStrip:
+				return {2, 1};
+			case PrimType::Triangle:
+				return {3, 3};
+			case PrimType::TriangleStrip:
+				return {3, 1};
+			default:
+				return {3, 1, true};
+		}
+	}
+
+	struct Vertex
+	{
+		// The registers of the vertex run from the one after the previous kick up to its own
+		RegisterList::iterator first;
+		RegisterList::iterator kick;
+		Vec3 xyz;
+		// The scissor set in this block when the vertex was kicked
+		std::optional<Vec4> scissor;
+	};
+
+	// The vertices kicked under one PRIM write
+	struct Run
+	{
+		PRIM prim;
+		std::vector<Vertex> vertices;
+
+		size_t Primitives() const noexcept
+		{
+			const Assembly assembly = AssemblyOf(prim.GetType());
+			return vertices.size() < assembly.size ? 0 : (vertices.size() - assembly.size) / assembly.step + 1;
+		}
+
+		// Index of the i-th vertex of primitive p
+		size_t VertexOf(size_t p, size_t i) const noexcept
+		{
+			const Assembly assembly = AssemblyOf(prim.GetType());
+			return assembly.fan && i == 0 ? 0 : p * assembly.step + i;
+		}
+	};
+
+	// Vertices kicked before the block sets a PRIM are left out, what they draw is not known
+	std::vector<Run> CollectRuns(GIFBlock& block)
+	{
+		std::vector<Run> runs;
+		if(block.prim)
+		{
+			runs.push_back({dynamic_cast<const PRIM&>(*block.prim), {}});
+		}
+
+		std::optional<Vec4> scissor;
+		auto first = block.registers.begin();
+		for(auto it = block.registers.begin(); it != block.registers.end(); it++)
+		{
+			const GifRegisterID id = (*it)->GetID();
+			if(id == GifRegisterID::PRIM)
+			{
+				runs.push_back({dynamic_cast<const PRIM&>(**it), {}});
+				first = std::next(it);
+			}
+			else if(id == GifRegisterID::SCISSOR)
+			{
+				scissor = dynamic_cast<const SCISSOR&>(**it).GetValue();
+			}
+			else if(IsKick(id))
+			{
+				if(!runs.empty())
+				{
+					runs.back().vertices.push_back({first, it, KickPosition(**it), scissor});
+				}
+				first = std::next(it);
+			}
+		}
+
+		return runs;
+	}
+
+	// Drops the vertices of a run from first to last. The last write to each
+	// attribute in between stays, the vertex after them may be relying on it.
+	void DropVertices(RegisterList& registers, const Run& run, size_t first, size_t last)
+	{
+		std::vector<RegisterList::iterator> range;
+		for(auto it = run.vertices[first].first; it != std::next(run.vertices[last].kick); it++)
+		{
+			range.push_back(it);
+		}
+
+		std::set<GifRegisterID> kept;
+		for(auto it = range.rbegin(); it != range.rend(); it++)
+		{
+			const GifRegisterID id = (**it)->GetID();
+			if(IsKick(id) || (IsAttribute(id) && !kept.insert(id).second))
+			{
+				registers.erase(*it);
+			}
+		}
+	}
+
+	bool Overlaps(const Vec3& min, const Vec3& max, const Vec4& scissor) noexcept
+	{
+		// x0, x1, y0, y1, all inclusive
+		return min.x <= scissor.y && max.x >= scissor.x && min.y <= scissor.w && max.y >= scissor.z;
+	}
+
+	// Whether primitive p of the run is entirely outside the scissor it was drawn with
+	bool OutsideScissor(const Run& run, size_t p)
+	{
+		const size_t size = AssemblyOf(run.prim.GetType()).size;
+		const Vertex& last = run.vertices[run.VertexOf(p, size - 1)];
+		if(!last.scissor)
+		{
+			return false;
+		}
+
+		Vec3 min = last.xyz;
+		Vec3 max = last.xyz;
+		for(size_t i = 0; i < size - 1; i++)
+		{
+			const Vec3& xyz = run.vertices[run.VertexOf(p, i)].xyz;
+			min = Vec3(std::min(min.x, xyz.x), std::min(min.y, xyz.y), 0);
+			max = Vec3(std::max(max.x, xyz.x), std::max(max.y, xyz.y), 0);
+		}
+		return !Overlaps(min, max, *last.scissor);
+	}
+
+	// Zero area triangles and zero size sprites, the GS draws no pixels for them
+	bool Degenerate(const Run& run, size_t p)
+	{
+		const Vec3& a = run.vertices[run.VertexOf(p, 0)].xyz;
+		switch(run.prim.GetType())
+		{
+			case PrimType::Sprite:
+			{
+				const Vec3& b = run.vertices[run.VertexOf(p, 1)].xyz;
+				return a.x == b.x || a.y == b.y;
+			}
+			case PrimType::Triangle:
+			case PrimType::TriangleStrip:
+			case PrimType::TriangleFan:
+			{
+				const Vec3& b = run.vertices[run.VertexOf(p, 1)].xyz;
+				const Vec3& c = run.vertices[run.VertexOf(p, 2)].xyz;
+				const int64_t cross = (static_cast<int64_t>(b.x) - a.x) * (static_cast<int64_t>(c.y) - a.y) -
+									  (static_cast<int64_t>(c.x) - a.x) * (static_cast<int64_t>(b.y) - a.y);
+				return cross == 0;
+			}
+			default:
+				return false;
+		}
+	}
+
+	struct Removed
+	{
+		size_t primitives = 0;
+		size_t vertices = 0;
+	};
+
+	// Removes the primitives of a run culled is true for.
+	// Lists drop their vertices outright. Strips and fans only drop the vertices
+	// no kept primitive uses, a strip restarts with a fresh PRIM write where
+	// vertices went from its middle. A fan can't do that without sending its
+	// centre again, so it only loses primitives from either end.
+	Removed RemovePrimitives(GIFBlock& block, const Run& run, const std::vector<bool>& culled)
+	{
+		const Assembly assembly = AssemblyOf(run.prim.GetType());
+		const size_t count = culled.size();
+		Removed removed;
+		for(size_t a = 0; a < count;)
+		{
+			if(!culled[a])
+			{
+				a++;
+				continue;
+			}
+
+			size_t b = a;
+			while(b + 1 < count && culled[b + 1])
+			{
+				b++;
+			}
+			const size_t next = b + 1;
+
+			const bool leading = a == 0;
+			const bool trailing = b == count - 1;
+			// A restarted triangle strip winds its first triangle one way, keep
+			// one of the removed triangles if the next one is wound the other way
+			if(run.prim.GetType() == PrimType::TriangleStrip && !trailing && next % 2 != 0)
+			{
+				if(b == a)
+				{
+					a = next;
+					continue;
+				}
+				b--;
+			}
+			size_t lo = 0;
+			size_t hi = 0;
+			bool restart = false;
+			if(assembly.step == assembly.size)
+			{
+				lo = a * assembly.size;
+				hi = b * assembly.size + assembly.size - 1;
+			}
+			else if(leading && trailing)
+			{
+				lo = 0;
+				hi = run.vertices.size() - 1;
+			}
+			else if(assembly.fan)
+			{
+				if(!leading && !trailing)
+				{
+					a = next;
+					continue;
+				}
+				lo = leading ? 1 : a + 2;
+				hi = trailing ? run.vertices.size() - 1 : b + 1;
+			}
+			else
+			{
+				lo = leading ? 0 : a + assembly.size - 1;
+				hi = trailing ? run.vertices.size() - 1 : b;
+				restart = !leading && !trailing;
+			}
+
+			if(lo <= hi)
+			{
+				if(restart)
+				{
+					block.registers.insert(run.vertices[hi + 1].first, std::make_unique<PRIM>(run.prim));
+				}
+				DropVertices(block.registers, run, lo, hi);
+				removed.primitives += b - a + 1;
+				removed.vertices += hi - lo + 1;
+			}
+			a = next;
+		}
+
+		return removed;
+	}
+
+	// Demotes the gouraud PRIM the registers from begin to end are drawn with
+	// when every vertex kicked in them has the same color, dropping the RGBAQ
+	// writes that don't change it. color is the RGBAQ the range starts with and
+	// is left at the one it ends with.
+	bool DemoteRun(RegisterList& registers, PRIM* prim, RegisterList::iterator begin, RegisterList::iterator end, std::optional<uint64_t>& color)
+	{
+		std::optional<uint64_t> current = color;
+		std::optional<uint64_t> kicked;
+		bool flat = prim && prim->IsGouraud();
+		for(auto it = begin; it != end; it++)
+		{
+			const GifRegisterID id = (*it)->GetID();
+			if(id == GifRegisterID::RGBAQ)
+			{
+				current = (*it)->Encode();
+			}
+			else if(IsKick(id))
+			{
+				flat = flat && current && (!kicked || *kicked == *current);
+				kicked = current;
+			}
+		}
+
+		if(!flat || !kicked)
+		{
+			color = current;
+			return false;
+		}
+
+		prim->gouraud = false;
+		for(auto it = begin; it != end;)
+		{
+			if((*it)->GetID() == GifRegisterID::RGBAQ)
+			{
+				const uint64_t value = (*it)->Encode();
+				if(color && *color == value)
+				{
+					it = registers.erase(it);
+					continue;
+				}
+				color = value;
+			}
+			it++;
+		}
+		return true;
+	}
+
+	struct Color
+	{
+		uint64_t value;
+		// An RGBAQ write setting it, to copy when it has to be set again
+		GifRegister* reg;
+	};
+
+	// An untextured sprite, covering x0 to x1 and y0 to y1 with the right and bottom edges left out
+	struct Rect
+	{
+		int64_t x0, y0, x1, y1;
+		uint32_t z;
+		Color color;
+	};
+
+	// A stretch of a sprite run that only writes RGBAQ and XYZ2
+	struct SpriteRun
+	{
+		std::vector<Rect> rects;
+		// The register after the last whole sprite
+		RegisterList::iterator last;
+		// The color set at last
+		std::optional<Color> color;
+		// Every sprite has a known color and a single depth
+		bool mergeable = true;
+	};
+
+	SpriteRun ReadSprites(RegisterList::iterator it, RegisterList::iterator end, std::optional<Color> color)
+	{
+		SpriteRun run{{}, it, color};
+		// The first vertex of the sprite being read, if it has been
+		Vec3 first;
+		bool started = false;
+		for(; it != end; it++)
+		{
+			const GifRegisterID id = (*it)->GetID();
+			if(id == GifRegisterID::RGBAQ)
+			{
+				color = Color{(*it)->Encode(), it->get()};
+			}
+			else if(id == GifRegisterID::XYZ2)
+			{
+				const Vec3 xyz = dynamic_cast<const XYZ2&>(**it).GetValue();
+				started = !started;
+				if(started)
+				{
+					first = xyz;
+					continue;
+				}
+
+				run.mergeable = run.mergeable && color && first.z == xyz.z;
+				run.rects.push_back({std::min<int64_t>(first.x, xyz.x), std::min<int64_t>(first.y, xyz.y), std::max<int64_t>(first.x, xyz.x),
+					std::max<int64_t>(first.y, xyz.y), xyz.z, color.value_or(Color{0, nullptr})});
+				run.last = std::next(it);
+				run.color = color;
+			}
+			else
+			{
+				break;
+			}
+		}
+		return run;
+	}
+
+	// Whether no two rectangles share a pixel, so they can be drawn in any order
+	bool Disjoint(std::vector<Rect> rects)
+	{
+		std::ranges::sort(rects, {}, &Rect::y0);
+		for(size_t i = 0; i < rects.size(); i++)
+		{
+			for(size_t j = i + 1; j < rects.size() && rects[j].y0 < rects[i].y1; j++)
+			{
+				const Rect& a = rects[i];
+				const Rect& b = rects[j];
+				if(a.x0 < b.x1 && b.x0 < a.x1)
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	// Joins rectangles of the same color and depth sharing a whole edge, along rows and then along columns
+	std::vector<Rect> Coalesce(std::vector<Rect> rects)
+	{
+		std::vector<Rect> rows;
+		std::ranges::sort(rects, {}, [](const Rect& r) { return std::tuple(r.color.value, r.z, r.y0, r.y1, r.x0); });
+		for(const Rect& rect : rects)
+		{
+			Rect* prev = rows.empty() ? nullptr : &rows.back();
+			if(prev && prev->color.value == rect.color.value && prev->z == rect.z && prev->y0 == rect.y0 && prev->y1 == rect.y1 && prev->x1 == rect.x0)
+			{
+				prev->x1 = rect.x1;
+				continue;
+			}
+			rows.push_back(rect);
+		}
+
+		std::vector<Rect> columns;
+		std::ranges::sort(rows, {}, [](const Rect& r) { return std::tuple(r.color.value, r.z, r.x0, r.x1, r.y0); });
+		for(const Rect& rect : rows)
+		{
+			Rect* prev = columns.empty() ? nullptr : &columns.back();
+			if(prev && prev->color.value == rect.color.value && prev->z == rect.z && prev->x0 == rect.x0 && prev->x1 == rect.x1 && prev->y1 == rect.y0)
+			{
+				prev->y1 = rect.y1;
+				continue;
+			}
+			columns.push_back(rect);
+		}
+		return columns;
+	}
+
+	// The rectangles drawn one color at a time, ending on the color the registers after them expect
+	RegisterList EmitSprites(std::vector<Rect> rects, std::optional<uint64_t> color, uint64_t end)
+	{
+		std::ranges::sort(rects, {}, [end](const Rect& r) { return std::tuple(r.color.value == end, r.color.value, r.y0, r.x0); });
+
+		RegisterList out;
+		for(const Rect& rect : rects)
+		{
+			if(color != rect.color.value)
+			{
+				out.push_back(rect.color.reg->Clone());
+				color = rect.color.value;
+			}
+			auto a = std::make_unique<XYZ2>();
+			a->Push(Vec3(rect.x0, rect.y0, rect.z));
+			out.push_back(std::move(a));
+			auto b = std::make_unique<XYZ2>();
+			b->Push(Vec3(rect.x1, rect.y1, rect.z));
+			out.push_back(std::move(b));
+		}
+		return out;
+	}
+
+	void AppendVertex(RegisterList& out, int64_t u, int64_t v, int64_t x, int64_t y, uint32_t z)
+	{
+		auto uv = std::make_unique<UV>();
+		uv->Push(Vec2(u, v));
+		out.push_back(std::move(uv));
+		auto xyz2 = std::make_unique<XYZ2>();
+		xyz2->Push(Vec3(x, y, z));
+		out.push_back(std::move(xyz2));
+	}
+} // namespace
+
+auto SplitSprites(GIFBlock& block, uint32_t width) -> size_t
+{
+	if(block.nloop > 1 || width == 0)
+	{
+		return 0;
+	}
+
+	std::optional<PRIM> prim;
+	if(block.prim)
+	{
+		prim = dynamic_cast<const PRIM&>(*block.prim);
+	}
+
+	size_t split = 0;
+	// Vertices kicked since the last PRIM, a sprite starts on an even one
+	size_t kicks = 0;
+	for(auto it = block.registers.begin(); it != block.registers.end();)
+	{
+		switch((*it)->GetID())
+		{
+			case GifRegisterID::PRIM:
+				prim = dynamic_cast<const PRIM&>(**it);
+				kicks = 0;
+				break;
+			case GifRegisterID::XYZ2:
+			case GifRegisterID::XYZF2:
+				kicks++;
+				break;
+			default:
+				break;
+		}
+
+		const bool sprite = prim && prim->GetType() == PrimType::Sprite && prim->IsTextured() && prim->IsUV() && kicks % 2 == 0;
+		if(!sprite || !Matches(it, block.registers.end(), {GifRegisterID::UV, GifRegisterID::XYZ2, GifRegisterID::UV, GifRegisterID::XYZ2}))
+		{
+			it++;
+			continue;
+		}
+
+		const SpriteVertex a = ReadVertex(it);
+		const SpriteVertex b = ReadVertex(std::next(it, 2));
+		const auto cuts = StripCuts(a, b, width);
+		const auto last = std::next(it, 4);
+		kicks += 2;
+		if(cuts.empty())
+		{
+			it = last;
+			continue;
+		}
+
+		RegisterList strips;
+		int64_t u = a.u;
+		int64_t x = a.x;
+		for(size_t i = 0; i <= cuts.size(); i++)
+		{
+			const int64_t next_u = i < cuts.size() ? cuts[i] : b.u;
+			const int64_t next_x = i < cuts.size() ? a.x + (next_u - a.u) * (b.x - a.x) / (b.u - a.u) : b.x;
+			AppendVertex(strips, u, a.v, x, a.y, a.z);
+			AppendVertex(strips, next_u, b.v, next_x, b.y, b.z);
+			u = next_u;
+			x = next_x;
+		}
+
+		block.registers.splice(it, strips);
+		it = block.registers.erase(it, last);
+		split++;
+	}
+
+	return split;
+}
+
+auto CullOutsideScissor(GIFBlock& block) -> size_t
+{
+	if(block.nloop > 1)
+	{
+		return 0;
+	}
+
+	size_t culled = 0;
+	for(const Run& run : CollectRuns(block))
+	{
+		std::vector<bool> outside(run.Primitives());
+		for(size_t p = 0; p < outside.size(); p++)
+		{
+			outside[p] = OutsideScissor(run, p);
+		}
+		culled += RemovePrimitives(block, run, outside).primitives;
+	}
+
+	return culled;
+}
+
+auto RemoveDegenerates(GIFBlock& block) -> size_t
+{
+	if(block.nloop > 1)
+	{
+		return 0;
+	}
+
+	size_t dropped = 0;
+	for(const Run& run : CollectRuns(block))
+	{
+		std::vector<bool> degenerate(run.Primitives());
+		for(size_t p = 0; p < degenerate.size(); p++)
+		{
+			degenerate[p] = Degenerate(run, p);
+		}
+		dropped += RemovePrimitives(block, run, degenerate).vertices;
+	}
+
+	return dropped;
+}
+
+auto DemoteGouraud(GIFBlock& block) -> size_t
+{
+	if(block.nloop > 1)
+	{
+		return 0;
+	}
+
+	size_t demoted = 0;
+	std::optional<uint64_t> color;
+	PRIM* prim = block.prim ? &dynamic_cast<PRIM&>(*block.prim) : nullptr;
+	auto begin = block.registers.begin();
+	// Only runs ended by another PRIM, the last PRIM is still set once the
+	// block is done and later blocks can draw with it
+	for(auto it = block.registers.begin(); it != block.registers.end(); it++)
+	{
+		if((*it)->GetID() == GifRegisterID::PRIM)
+		{
+			demoted += DemoteRun(block.registers, prim, begin, it, color);
+			prim = &dynamic_cast<PRIM&>(**it);
+			begin = std::next(it);
+		}
+	}
+
+	return demoted;
+}
+
+auto MergeSprites(GIFBlock& block) -> size_t
+{
+	if(block.nloop > 1)
+	{
+		return 0;
+	}
+
+	std::optional<PRIM> prim;
+	if(block.prim)
+	{
+		prim = dynamic_cast<const PRIM&>(*block.prim);
+	}
+
+	size_t merged = 0;
+	std::optional<Color> color;
+	// Vertices kicked since the last PRIM, a sprite starts on an even one
+	size_t kicks = 0;
+	for(auto it = block.registers.begin(); it != block.registers.end();)
+	{
+		const GifRegisterID id = (*it)->GetID();
+		const bool sprites = prim && prim->GetType() == PrimType::Sprite && !prim->IsTextured() && kicks % 2 == 0;
+		if(sprites && (id == GifRegisterID::RGBAQ || id == GifRegisterID::XYZ2))
+		{
+			const SpriteRun run = ReadSprites(it, block.registers.end(), color);
+			if(!run.rects.empty())
+			{
+				if(run.mergeable && run.rects.size() > 1 && Disjoint(run.rects))
+				{
+					const auto rects = Coalesce(run.rects);
+					if(rects.size() < run.rects.size())
+					{
+						auto out = EmitSprites(rects, color ? std::optional(color->value) : std::nullopt, run.color->value);
+						// The RGBAQ writes of the run are going, point at the one setting its color now
+						for(const auto& reg : out)
+						{
+							if(reg->GetID() == GifRegisterID::RGBAQ)
+							{
+								color = Color{run.color->value, reg.get()};
+							}
+						}
+						block.registers.splice(it, out);
+						block.registers.erase(it, run.last);
+						merged += run.rects.size() - rects.size();
+						it = run.last;
+						continue;
+					}
+				}
+				color = run.color;
+				it = run.last;
+				continue;
+			}
+		}
+
+		switch(id)
+		{
+			case GifRegisterID::PRIM:
+				prim = dynamic_cast<const PRIM&>(**it);
+				kicks = 0;
+				break;
+			case GifRegisterID::RGBAQ:
+				color = Color{(*it)->Encode(), it->get()};
+				break;
+			case GifRegisterID::XYZ2:
+			case GifRegisterID::XYZF2:
+				kicks++;
+				break;
+			default:
+				break;
+		}
+		it++;
+	}
+
+	return merged;
+}
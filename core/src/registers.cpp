@@ -9,8 +9,12 @@ auto GenReg(GifRegisters reg) -> std::unique_ptr<GifRegister>
 			return std::make_unique<PRIM>();
 		case GifRegisters::RGBAQ:
 			return std::make_unique<RGBAQ>();
+		case GifRegisters::ST:
+			return std::make_unique<ST>();
 		case GifRegisters::UV:
 			return std::make_unique<UV>();
+		case GifRegisters::XYZF2:
+			return std::make_unique<XYZF2>();
 		case GifRegisters::XYZ2:
 			return std::make_unique<XYZ2>();
 		case GifRegisters::TEX0:
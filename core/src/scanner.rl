@@ -1,114 +1,115 @@
-#include "version.hpp"
-
-#include <cstring>
-#include <cstdlib>
-#include <map>
-#include <fcntl.h>
-#include <fmt/format.h>
-
-#include "c_code.hpp"
-#include "gifscript_backend.hpp"
-
+#include "scanner.hpp"
 #include "logger.hpp"
-
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-variable"
-#include "parser.cpp"
-#pragma GCC diagnostic pop
-
 #include "registers.hpp"
-#include "machine.hpp"
-
-static bool valid = true;
-static Backend* backend = nullptr;
+#include "expr.hpp"
+#include "parser.h"
 
-static int line = 1;
-static bool pByLine = true;
+#include <any>
+#include <bit>
+#include <cstdlib>
+#include <string>
 
-void FailError(const char* ts, const char* te);
+// The parser lemon generates, built on its own
+void* ParseAlloc(void* (*mallocProc)(size_t));
+void ParseFree(void* p, void (*freeProc)(void*));
+void Parse(void* yyp, int yymajor, std::any* yyminor, ParseState* state);
 
 %%{
     machine gifscript;
 
     # End cmd
     action semi_tok{
-        Parse(lparser, 0, 0, &valid);
+        Parse(lparser, 0, 0, &state);
     }
 
     # Registers
     action prim_tok {
-        Parse(lparser, REG, new std::any(GifRegisters::PRIM), &valid);
-        if(!valid) {
+        Parse(lparser, REG, new std::any(GifRegisters::PRIM), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action rgbaq_tok {
-        Parse(lparser, REG, new std::any(GifRegisters::RGBAQ), &valid);
-        if(!valid) {
+        Parse(lparser, REG, new std::any(GifRegisters::RGBAQ), &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+    }
+
+    action st_tok {
+        Parse(lparser, REG, new std::any(GifRegisters::ST), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action uv_tok {
-        Parse(lparser, REG, new std::any(GifRegisters::UV), &valid);
-        if(!valid) {
+        Parse(lparser, REG, new std::any(GifRegisters::UV), &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+    }
+
+    action xyzf2_tok {
+        Parse(lparser, REG, new std::any(GifRegisters::XYZF2), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action xyz2_tok {
-        Parse(lparser, REG, new std::any(GifRegisters::XYZ2), &valid);
-        if(!valid) {
+        Parse(lparser, REG, new std::any(GifRegisters::XYZ2), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action tex0_tok {
-        Parse(lparser, REG, new std::any(GifRegisters::TEX0), &valid);
-        if(!valid) {
+        Parse(lparser, REG, new std::any(GifRegisters::TEX0), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action fog_tok {
-        Parse(lparser, REG, new std::any(GifRegisters::FOG), &valid);
-        if(!valid) {
+        Parse(lparser, REG, new std::any(GifRegisters::FOG), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action fogcol_tok {
-        Parse(lparser, REG, new std::any(GifRegisters::FOGCOL), &valid);
-        if(!valid) {
+        Parse(lparser, REG, new std::any(GifRegisters::FOGCOL), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action scissor_tok {
-        Parse(lparser, REG, new std::any(GifRegisters::SCISSOR), &valid);
-        if(!valid) {
+        Parse(lparser, REG, new std::any(GifRegisters::SCISSOR), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action signal_tok {
-        Parse(lparser, REG, new std::any(GifRegisters::SIGNAL), &valid);
-        if(!valid) {
+        Parse(lparser, REG, new std::any(GifRegisters::SIGNAL), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action finish_tok {
-        Parse(lparser, REG, new std::any(GifRegisters::FINISH), &valid);
-        if(!valid) {
+        Parse(lparser, REG, new std::any(GifRegisters::FINISH), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action label_tok {
-        Parse(lparser, REG, new std::any(GifRegisters::LABEL), &valid);
-        if(!valid) {
+        Parse(lparser, REG, new std::any(GifRegisters::LABEL), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
@@ -116,129 +117,136 @@ void FailError(const char* ts, const char* te);
     # Modifiers
     # Primitive Types
     action mod_point_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::Point), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::Point), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_line_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::Line), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::Line), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_linestrip_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::LineStrip), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::LineStrip), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_triangle_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::Triangle), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::Triangle), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_trianglestrip_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::TriangleStrip), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::TriangleStrip), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_trianglefan_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::TriangleFan), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::TriangleFan), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_sprite_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::Sprite), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::Sprite), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     # Primitive Modifiers
     action mod_gouraud_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::Gouraud), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::Gouraud), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_fogging_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::Fogging), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::Fogging), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_aa1_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::AA1), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::AA1), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_texture_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::Texture), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::Texture), &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+    }
+
+    action mod_stq_tok {
+        Parse(lparser, MOD, new std::any(RegModifier::STQ), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     # TEX0 Modifiers
     action mod_ct32_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::CT32), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::CT32), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_ct24_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::CT24), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::CT24), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_ct16_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::CT16), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::CT16), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_modulate_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::Modulate), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::Modulate), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_decal_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::Decal), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::Decal), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_highlight_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::Highlight), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::Highlight), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action mod_highlight2_tok {
-        Parse(lparser, MOD, new std::any(RegModifier::Highlight2), &valid);
-        if(!valid) {
+        Parse(lparser, MOD, new std::any(RegModifier::Highlight2), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
@@ -246,24 +254,24 @@ void FailError(const char* ts, const char* te);
     # Vectors
     action vec4_tok {
         std::string s(ts, te - ts);
-        Parse(lparser, VEC4, new std::any(Vec4::Parse(s)), &valid);
-        if(!valid) {
+        Parse(lparser, VEC4, new std::any(Vec4::Parse(s)), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action vec3_tok {
         std::string s(ts, te - ts);
-        Parse(lparser, VEC3, new std::any(Vec3::Parse(s)), &valid);
-        if(!valid) {
+        Parse(lparser, VEC3, new std::any(Vec3::Parse(s)), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
 
     action vec2_tok {
         std::string s(ts, te - ts);
-        Parse(lparser, VEC2, new std::any(Vec2::Parse(s)), &valid);
-        if(!valid) {
+        Parse(lparser, VEC2, new std::any(Vec2::Parse(s)), &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
     }
@@ -271,8 +279,8 @@ void FailError(const char* ts, const char* te);
     # Constants
     action int_const_tok {
         std::string s(ts, te - ts);
-        Parse(lparser, NUMBER_LITERAL, new std::any(static_cast<uint32_t>(std::stoi(s))), &valid);
-        if(!valid)
+        Parse(lparser, NUMBER_LITERAL, new std::any(static_cast<uint32_t>(std::stoi(s))), &state);
+        if(!state.valid)
         {
             FailError(ts, te);
         }
@@ -280,8 +288,8 @@ void FailError(const char* ts, const char* te);
 
     action hex_const_tok {
         std::string s(ts, te - ts);
-        Parse(lparser, NUMBER_LITERAL, new std::any(static_cast<uint32_t>(std::stoi(s, nullptr, 16))), &valid);
-        if(!valid)
+        Parse(lparser, NUMBER_LITERAL, new std::any(static_cast<uint32_t>(std::stoi(s, nullptr, 16))), &state);
+        if(!state.valid)
         {
             FailError(ts, te);
         }
@@ -289,8 +297,8 @@ void FailError(const char* ts, const char* te);
 
     action float_const_tok {
         std::string s(ts, te - ts);
-        Parse(lparser, NUMBER_LITERAL, new std::any(std::bit_cast<uint32_t>(std::stof(s))), &valid);
-        if(!valid)
+        Parse(lparser, NUMBER_LITERAL, new std::any(std::bit_cast<uint32_t>(std::stof(s))), &state);
+        if(!state.valid)
         {
             FailError(ts, te);
         }
@@ -298,41 +306,145 @@ void FailError(const char* ts, const char* te);
 
     # Block controls
     action block_begin_tok {
-        Parse(lparser, BLOCK_START, 0, &valid);
-        if(!valid) {
+        Parse(lparser, BLOCK_START, 0, &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
-        Parse(lparser, 0, 0, &valid);
+        Parse(lparser, 0, 0, &state);
     }
 
     action block_end_tok {
-        if(!valid && !pByLine) {
+        if(!state.valid && !by_line) {
             logger::warn("!!!! Ending block when in an invalid state. Your output may be incorrect. Please try without --oneshot-parse");
         }
-        Parse(lparser, BLOCK_END, 0, &valid);
-        if(!valid) {
+        Parse(lparser, BLOCK_END, 0, &state);
+        if(!state.valid) {
             FailError(ts, te);
         }
-        Parse(lparser, 0, 0, &valid);
+        Parse(lparser, 0, 0, &state);
     }
 
     # Macro keyword
     action macro_tok {
-        Parse(lparser, MACRO, 0, &valid);
-        if(!valid) {
+        Parse(lparser, MACRO, 0, &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+    }
+
+    # Repeat keyword
+    action repeat_tok {
+        Parse(lparser, REPEAT, 0, &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+    }
+
+    # Vertices keyword
+    action vertices_tok {
+        Parse(lparser, VERTICES, 0, &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+    }
+
+    # Upload keyword
+    action upload_tok {
+        Parse(lparser, UPLOAD, 0, &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+    }
+
+    # Patch keyword
+    action patch_tok {
+        Parse(lparser, PATCH, 0, &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+    }
+
+    # Strings, without the quotes
+    action string_tok {
+        Parse(lparser, STRING_LITERAL, new std::any(std::string(ts + 1, te - 1)), &state);
+        if(!state.valid)
+        {
             FailError(ts, te);
         }
     }
 
     # Identifiers
     action identifier_tok {
-        Parse(lparser, IDENTIFIER, new std::any(std::string(ts, te)), &valid);
-        if(!valid)
+        Parse(lparser, IDENTIFIER, new std::any(std::string(ts, te)), &state);
+        if(!state.valid)
         {
             FailError(ts, te);
         }
     }
 
+    # Expressions
+    action expr_begin_tok {
+        Parse(lparser, LPAREN, 0, &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+        paren_depth = 1;
+        fgoto expr;
+    }
+
+    action lparen_tok {
+        Parse(lparser, LPAREN, 0, &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+        paren_depth++;
+    }
+
+    action rparen_tok {
+        Parse(lparser, RPAREN, 0, &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+        if(--paren_depth == 0) {
+            fgoto main;
+        }
+    }
+
+    action comma_tok {
+        Parse(lparser, COMMA, 0, &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+    }
+
+    action plus_tok {
+        Parse(lparser, PLUS, 0, &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+    }
+
+    action minus_tok {
+        Parse(lparser, MINUS, 0, &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+    }
+
+    action times_tok {
+        Parse(lparser, TIMES, 0, &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+    }
+
+    action divide_tok {
+        Parse(lparser, DIVIDE, 0, &state);
+        if(!state.valid) {
+            FailError(ts, te);
+        }
+    }
+
     c_comment := 
         any* :>> '*/'
         @{ fgoto main; };
@@ -343,7 +455,9 @@ void FailError(const char* ts, const char* te);
     # Registers
     prim = /prim/i;
     rgbaq = (/rgbaq/i|/rgba/i);
+    st = /st/i;
     uv = /uv/i;
+    xyzf2 = /xyzf2/i;
     xyz2 = /xyz2/i;
     tex0 = /tex0/i;
     fog = /fog/i;
@@ -367,6 +481,7 @@ void FailError(const char* ts, const char* te);
         mod_fogging = (/fogging/i|/fog/i);
         mod_aa1 = /aa1/i;
         mod_texture = (/texture/i|/textured/i);
+        mod_stq = /stq/i;
         # TEX0 Modifiers
         mod_ct32 = (/ct32/i|/psmct32/i);
         mod_ct24 = (/ct24/i|/psmct24/i);
@@ -393,9 +508,42 @@ void FailError(const char* ts, const char* te);
     # Macro keyword
     macro = /macro/i;
 
+    # Repeat keyword
+    repeat = /repeat/i;
+
+    # Vertices keyword
+    vertices = /vertices/i;
+
+    # Upload keyword
+    upload = /upload/i;
+
+    # Patch keyword
+    patch = /patch/i;
+
+    # Strings
+    string = '"' [^"\n]* '"';
+
     # Identifiers
     identifier = [a-zA-Z_][a-zA-Z0-9_]*;
 
+    # Inside parentheses numbers are single values and commas separate
+    # expressions, so 16,0 is two arguments rather than a Vec2.
+    # Identifiers come first, x1 is a name and hex has to be written 0x1.
+    expr := |*
+        identifier => identifier_tok;
+        int_const => int_const_tok;
+        hex_const => hex_const_tok;
+
+        ',' => comma_tok;
+        '+' => plus_tok;
+        '-' => minus_tok;
+        '*' => times_tok;
+        '/' => divide_tok;
+        '(' => lparen_tok;
+        ')' => rparen_tok;
+        space;
+    *|;
+
     main := |*
         # End cmd
         semi => semi_tok;
@@ -403,7 +551,9 @@ void FailError(const char* ts, const char* te);
         # Registers
         prim => prim_tok;
         rgbaq => rgbaq_tok;
+        st => st_tok;
         uv => uv_tok;
+        xyzf2 => xyzf2_tok;
         xyz2 => xyz2_tok;
         tex0 => tex0_tok;
         fog => fog_tok;
@@ -427,6 +577,7 @@ void FailError(const char* ts, const char* te);
             mod_fogging => mod_fogging_tok;
             mod_aa1 => mod_aa1_tok;
             mod_texture => mod_texture_tok;
+            mod_stq => mod_stq_tok;
             # TEX0 Modifiers
             mod_ct32 => mod_ct32_tok;
             mod_ct24 => mod_ct24_tok;
@@ -453,6 +604,18 @@ void FailError(const char* ts, const char* te);
         # Macro keyword
         macro => macro_tok;
 
+        # Repeat keyword
+        repeat => repeat_tok;
+
+        # Vertices keyword
+        vertices => vertices_tok;
+        upload => upload_tok;
+        patch => patch_tok;
+        string => string_tok;
+
+        # Arguments and parameters
+        '(' => expr_begin_tok;
+
         # Identifiers
         identifier => identifier_tok;
         space;
@@ -465,46 +628,31 @@ void FailError(const char* ts, const char* te);
 
 %% write data;
 
-class Scan
+Scanner::Scanner(Machine& machine, bool by_line)
+    : state{machine}
+    , by_line(by_line)
 {
-public:
-    ~Scan();
-    void init();
-    void execute(const char* data, size_t len);
-
-private:
-    int cs;
-    int act;
-    const char* ts = nullptr;
-    const char* te = nullptr;
-
-    void* lparser;
-};
+    lparser = ParseAlloc(malloc);
 
-Scan::~Scan()
-{
-    ParseFree(lparser, free);
+    %% write init;
 }
 
-void
-Scan::init()
+Scanner::~Scanner()
 {
-    lparser = ParseAlloc(malloc);
-
-    %% write init;
+    ParseFree(lparser, free);
 }
 
-void
-Scan::execute(const char* data, size_t len)
+auto
+Scanner::TryExecute(std::string_view source) -> bool
 {
-    const char* p = data;
-    const char* pe = data + len;
+    const char* p = source.data();
+    const char* pe = p + source.size();
     const char* eof = pe;
     const char *line_start = p;
     const char* line_end = p;
-    if(pByLine)
+    if(by_line)
     {
-by_line:
+next_line:
         while(line_end < eof && *line_end != '\n')
         {
             line_end++;
@@ -516,179 +664,21 @@ by_line:
 
     %% write exec;
 
-    if(!valid)
-        return;
-    if(pByLine)
+    if(!state.valid)
+        return false;
+    if(by_line)
     {
         line++;
         if(p < eof)
         {
-            goto by_line;
+            goto next_line;
         }
     }
-    printf("Done\n");
+    return true;
 }
 
 
-void FailError(const char* ts, const char* te)
+void Scanner::FailError(const char* ts, const char* te) const
 {
     logger::error("Parser error at line %d.\n\tEither the token `%s` is erroneous, or the previous token is invalid.", line, std::string(ts, te - ts).c_str());
 }
-
-
-void print_help(char* argv0)
-{
-    fmt::print("Usage: {} <file> <output> [--backend=<backend>] [--b<backend arguments>]\n\t"
-            "General Arguments:\n\t"
-            "  --help, -h\n\t"
-            "    Prints this help message\n\t"
-            "  --version, -v\n\t"
-            "    Prints the version of gifscript\n\t"
-            "  --oneshot-parse\n\t"
-            "    Parses the entire file in one go. Probably faster, but you lose proper parsing error handling\n\t"
-            "Optimization settings:\n\t"
-            "  --keep-deadstore\n\t"
-            "    Disables dead store optimization. (Consecutive writes to stateless registers)\n\t"
-            " --no-tag-prim\n\t"
-            "    Disables packing the first PRIM write into the GIFTag\n\t"
-            "Valid backends are:\n\t"
-            "  c_code(default)\n\t"
-            "    Generates a c file with an array for each gif block\n"
-            "  gifscript\n\t"
-            "    Generates a gifscript file. Mostly used for debugging or tpircsfig\n"
-            "For backend specific help, please pass --bhelp to your backend\n" , argv0);
-};
-
-
-std::string file_in = "";
-std::string file_out = "";
-int main(int argc, char **argv)
-{
-    if(argc < 2)
-    {
-        print_help(argv[0]);
-        return 1;
-    }
-    for(int i = 1; i < argc; i++) {
-        std::string_view arg = argv[i];
-        if(arg.starts_with("--backend="))
-        {
-            std::string_view backend_str = arg.substr(10);
-            if(backend_str == "c_code")
-            {
-                fmt::print("Using C backend\n");
-                backend = new c_code_backend();
-                if(!backend->arg_parse(argc, argv))
-                {
-                    fmt::print("Use --bhelp for valid backend configuration arguments\n");
-                    return 1;
-                }
-            }
-            else if (backend_str == "gifscript")
-            {
-                fmt::print("Using gifscript backend\n");
-                backend = new gifscript_backend();
-                if(!backend->arg_parse(argc, argv))
-                {
-                    fmt::print("Use --bhelp for valid backend configuration arguments\n");
-                    return 1;
-                }
-            }
-            else
-            {
-                fmt::print("Unknown backend: {}\n", backend_str);
-                return 1;
-            }
-        }
-        else if(arg == "--help" || arg == "-h")
-        {
-            print_help(argv[0]);
-            return 1;
-        }
-        else if (arg == "--version" || arg == "-v")
-        {
-            fmt::print("Gifscript version: {}\n", GIT_VERSION);
-            return 0;
-        }
-        else if (arg == "--keep-deadstore")
-        {
-            machine.DisableOptimization(Machine::Optimization::DEAD_STORE_ELIMINATION);
-        }
-        else if (arg == "--no-tag-prim")
-        {
-            machine.DisableOptimization(Machine::Optimization::USE_TAG_PRIM);
-        }
-        else if (arg == "--oneshot-parse")
-        {
-            pByLine = false;
-        }
-        else if(file_in.empty() && !arg.starts_with("-"))
-        {
-            file_in = arg;
-        }
-        else if (file_out.empty() && !arg.starts_with("-"))
-        {
-            file_out = arg;
-        }
-        else if(!arg.starts_with("--b"))
-        {
-            fmt::print("Unknown argument: {}\n", arg);
-            return 1;
-        }
-    }
-
-    if(backend == nullptr)
-    {
-        logger::info("No backend specified, using default 'c_code'");
-        backend = new c_code_backend();
-        if(!backend->arg_parse(argc, argv))
-        {
-            fmt::print("Use --bhelp for valid backend configuration arguments\n");
-            return 1;
-        }
-    }
-
-    machine.SetBackend(backend);
-
-    backend->set_output(file_out);
-
-    if(file_in.empty())
-    {
-        fmt::print("No input file specified\n");
-        return 1;
-    }
-
-    if(file_out.empty())
-    {
-        fmt::print("No output file specified. Printing to stdout\n");
-    }
-
-    char buffer[8192];
-    FILE* fin;
-    Scan scan;
-    unsigned long numbytes;
-
-    fin = fopen(file_in.c_str(), "r");
-    if(fin == nullptr)
-    {
-        fmt::print("Failed to open file: {}\n", file_in);
-        return 1;
-    }
-    fseek(fin, 0, SEEK_END);
-    numbytes = ftell(fin);
-    fseek(fin, 0, SEEK_SET);
-
-    if(numbytes > sizeof(buffer))
-    {
-        fmt::print("File {} bytes is too large for internal buffer {} bytes :(\n", numbytes, sizeof(buffer));
-        return 1;
-    }
-
-    fread(buffer, 1, numbytes, fin);
-
-    scan.init();
-    scan.execute(buffer, numbytes);
-    delete backend;
-    fclose(fin);
-    return 0;
-}
@@ -0,0 +1,25 @@
+// Macros with parameters are filled in when they are inserted.
+// Arguments and register values in parentheses are integer expressions,
+// + - * / and nested parentheses, over the parameters of the macro.
+
+macro tile(x, y, z, shade) {
+	rgbaq (shade, shade / 2, 255 - shade, 0x80);
+	xyz2 (x, y, z);
+	xyz2 (x + 32, y + 32, z);
+}
+
+macro tile_row(y, z) {
+	macro tile(0, y, z, 0);
+	macro tile(32, y, z + 1, 32);
+	macro tile(64, y, z + 2, 64);
+	macro tile(96, y, z + 3, 96);
+	macro tile(128, y, z + 4, 128);
+}
+
+tiles {
+	prim sprite;
+	macro tile_row(0, 0);
+	macro tile_row(32, 10);
+	macro tile_row(64, 20);
+	macro tile_row(96, 30);
+}
@@ -0,0 +1,11 @@
+// A sprite the program moves and recolors every frame without rebuilding it.
+// Every register marked with patch gets a row per field in the block's patch
+// table, the c_code backend writes it as moving_sprite_patches with an
+// enum of moving_sprite_patch_<name>_<field> indices into it.
+// The fields are stored as the GS reads them, X and Y are 12.4 fixed point.
+moving_sprite {
+	prim sprite;
+	patch color rgbaq 255,255,255;
+	patch top_left xyz2 0,0,0;
+	patch bottom_right xyz2 64,64,0;
+}
@@ -0,0 +1,11 @@
+// Fills the screen 64 times over, a quick GS fill rate test.
+// The repeat is sent as a single GIFtag with NLOOP=64. Only the source and the
+// Machine's copy of the body shrink, the packet still carries all 64 iterations.
+overdraw {
+	prim sprite;
+	repeat 64 {
+		rgbaq 0,0,255,0x80;
+		xyz2 0,0,0;
+		xyz2 640,448,0;
+	}
+}
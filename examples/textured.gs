@@ -5,6 +5,13 @@
 
 	UV (and XY coords) are automatically shifted, there is no way to do half
 	pixel offsets at this moment
+
+	The texture can be sent from a raw file of 128x128 RGB pixels first, in a
+	block of its own since nothing can follow the upload in its block:
+
+	texture_upload {
+		upload "texture.raw" 0x2300 2 ct24 0,0,128,128;
+	}
 */
 
 textured_tri {
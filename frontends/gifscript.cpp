@@ -0,0 +1,255 @@
+#include "version.hpp"
+
+#include <charconv>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fmt/format.h>
+
+#include "c_code.hpp"
+#include "elf.hpp"
+#include "gifscript_backend.hpp"
+#include "stats.hpp"
+
+#include "logger.hpp"
+#include "registers.hpp"
+#include "machine.hpp"
+#include "scanner.hpp"
+
+static Machine machine;
+static Backend* backend = nullptr;
+static bool pByLine = true;
+
+void print_help(char* argv0)
+{
+    fmt::print("Usage: {} <file> <output> [--backend=<backend>] [--b<backend arguments>]\n\t"
+            "General Arguments:\n\t"
+            "  --help, -h\n\t"
+            "    Prints this help message\n\t"
+            "  --version, -v\n\t"
+            "    Prints the version of gifscript\n\t"
+            "  --oneshot-parse\n\t"
+            "    Parses the entire file in one go. Probably faster, but you lose proper parsing error handling\n\t"
+            "Optimization settings:\n\t"
+            "  --keep-deadstore\n\t"
+            "    Disables dead store optimization. (Consecutive writes to stateless registers)\n\t"
+            " --no-tag-prim\n\t"
+            "    Disables packing the first PRIM write into the GIFTag\n\t"
+            "  --keep-degenerate\n\t"
+            "    Disables removing zero area triangles and zero size sprites\n\t"
+            "  --keep-gouraud\n\t"
+            "    Disables demoting gouraud primitives whose vertices all have the same color to flat\n\t"
+            "  --no-sprite-merge\n\t"
+            "    Disables merging same colored untextured sprites that share an edge\n\t"
+            "  --cull-scissor\n\t"
+            "    Drops primitives entirely outside the SCISSOR set earlier in their block. Assumes an XYOFFSET of 0\n\t"
+            "  --split-sprites[=<texels>]\n\t"
+            "    Splits textured sprites into strips this many texels wide (default 32), kinder to the texture cache\n\t"
+            "Valid backends are:\n\t"
+            "  c_code(default)\n\t"
+            "    Generates a c file with an array for each gif block\n"
+            "  elf\n\t"
+            "    Generates a relocatable object with a .rodata symbol for each gif block\n"
+            "  gifscript\n\t"
+            "    Generates a gifscript file. Mostly used for debugging or tpircsfig\n"
+            "  stats\n\t"
+            "    Writes a JSON summary of the size and estimated GS cost of each gif block, needs an output file\n"
+            "For backend specific help, please pass --bhelp to your backend\n" , argv0);
+};
+
+
+std::string file_in = "";
+std::string file_out = "";
+// The stats backend writes JSON, which stdout would mix with the log
+bool output_required = false;
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        print_help(argv[0]);
+        return 1;
+    }
+    for(int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if(arg.starts_with("--backend="))
+        {
+            std::string_view backend_str = arg.substr(10);
+            if(backend_str == "c_code")
+            {
+                fmt::print("Using C backend\n");
+                backend = new c_code_backend();
+                if(!backend->arg_parse(argc, argv))
+                {
+                    fmt::print("Use --bhelp for valid backend configuration arguments\n");
+                    return 1;
+                }
+            }
+            else if (backend_str == "elf")
+            {
+                fmt::print("Using elf backend\n");
+                backend = new elf_backend();
+                if(!backend->arg_parse(argc, argv))
+                {
+                    fmt::print("Use --bhelp for valid backend configuration arguments\n");
+                    return 1;
+                }
+            }
+            else if (backend_str == "stats")
+            {
+                fmt::print("Using stats backend\n");
+                backend = new stats_backend();
+                output_required = true;
+                if(!backend->arg_parse(argc, argv))
+                {
+                    fmt::print("Use --bhelp for valid backend configuration arguments\n");
+                    return 1;
+                }
+            }
+            else if (backend_str == "gifscript")
+            {
+                fmt::print("Using gifscript backend\n");
+                backend = new gifscript_backend();
+                if(!backend->arg_parse(argc, argv))
+                {
+                    fmt::print("Use --bhelp for valid backend configuration arguments\n");
+                    return 1;
+                }
+            }
+            else
+            {
+                fmt::print("Unknown backend: {}\n", backend_str);
+                return 1;
+            }
+        }
+        else if(arg == "--help" || arg == "-h")
+        {
+            print_help(argv[0]);
+            return 1;
+        }
+        else if (arg == "--version" || arg == "-v")
+        {
+            fmt::print("Gifscript version: {}\n", GIT_VERSION);
+            return 0;
+        }
+        else if (arg == "--keep-deadstore")
+        {
+            machine.DisableOptimization(Machine::Optimization::DEAD_STORE_ELIMINATION);
+        }
+        else if (arg == "--no-tag-prim")
+        {
+            machine.DisableOptimization(Machine::Optimization::USE_TAG_PRIM);
+        }
+        else if (arg == "--keep-degenerate")
+        {
+            machine.DisableOptimization(Machine::Optimization::DEGENERATE_REMOVAL);
+        }
+        else if (arg == "--keep-gouraud")
+        {
+            machine.DisableOptimization(Machine::Optimization::GOURAUD_DEMOTION);
+        }
+        else if (arg == "--no-sprite-merge")
+        {
+            machine.DisableOptimization(Machine::Optimization::SPRITE_MERGING);
+        }
+        else if (arg == "--cull-scissor")
+        {
+            machine.EnableOptimization(Machine::Optimization::SCISSOR_CULLING);
+        }
+        else if (arg.starts_with("--split-sprites"))
+        {
+            uint32_t width = 32;
+            if(arg.starts_with("--split-sprites="))
+            {
+                const std::string_view value = arg.substr(16);
+                const auto [end, ec] = std::from_chars(value.begin(), value.end(), width);
+                if(ec != std::errc() || end != value.end() || width == 0)
+                {
+                    fmt::print("Invalid strip width: {}\n", value);
+                    return 1;
+                }
+            }
+            machine.SetSpriteStripWidth(width);
+        }
+        else if (arg == "--oneshot-parse")
+        {
+            pByLine = false;
+        }
+        else if(file_in.empty() && !arg.starts_with("-"))
+        {
+            file_in = arg;
+        }
+        else if (file_out.empty() && !arg.starts_with("-"))
+        {
+            file_out = arg;
+        }
+        else if(!arg.starts_with("--b"))
+        {
+            fmt::print("Unknown argument: {}\n", arg);
+            return 1;
+        }
+    }
+
+    if(backend == nullptr)
+    {
+        logger::info("No backend specified, using default 'c_code'");
+        backend = new c_code_backend();
+        if(!backend->arg_parse(argc, argv))
+        {
+            fmt::print("Use --bhelp for valid backend configuration arguments\n");
+            return 1;
+        }
+    }
+
+    machine.SetBackend(backend);
+
+    backend->set_output(file_out);
+
+    if(file_in.empty())
+    {
+        fmt::print("No input file specified\n");
+        return 1;
+    }
+
+    if(file_out.empty() && output_required)
+    {
+        fmt::print("The stats backend needs an output file\n");
+        return 1;
+    }
+
+    if(file_out.empty())
+    {
+        fmt::print("No output file specified. Printing to stdout\n");
+    }
+
+    char buffer[8192];
+    FILE* fin;
+    unsigned long numbytes;
+
+    fin = fopen(file_in.c_str(), "r");
+    if(fin == nullptr)
+    {
+        fmt::print("Failed to open file: {}\n", file_in);
+        return 1;
+    }
+    fseek(fin, 0, SEEK_END);
+    numbytes = ftell(fin);
+    fseek(fin, 0, SEEK_SET);
+
+    if(numbytes > sizeof(buffer))
+    {
+        fmt::print("File {} bytes is too large for internal buffer {} bytes :(\n", numbytes, sizeof(buffer));
+        return 1;
+    }
+
+    fread(buffer, 1, numbytes, fin);
+
+    Scanner scan(machine, pByLine);
+    if(scan.TryExecute(std::string_view(buffer, numbytes)))
+    {
+        printf("Done\n");
+    }
+    const bool failed = backend->failed();
+    delete backend;
+    fclose(fin);
+    return failed ? 1 : 0;
+}
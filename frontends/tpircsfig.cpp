@@ -1,283 +1,373 @@
 #include <fmt/format.h>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <optional>
 
 #include "logger.hpp"
 #include "registers.hpp"
 #include "machine.hpp"
+#include "decoder.hpp"
+#include "parallel_decoder.hpp"
+#include "mapped_file.hpp"
+#include "gs_dump.hpp"
 #include "backend.hpp"
 #include "c_code.hpp"
+#include "elf.hpp"
 #include "gifscript_backend.hpp"
+#include "stats.hpp"
 #include "version.hpp"
-#include "parser.h"
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-variable"
-#include "parser.cpp"
-#pragma GCC diagnostic pop
-
-static bool valid = true;
+static Machine machine;
 static Backend* backend = nullptr;
-static void* lparser;
+// Cleared once a block fails to emit, nothing after it is decoded
+static bool valid = true;
 
-struct GIFTag
+// Turns one PACKED or REGLIST GIFtag and its data into a block and emits it
+void EmitTag(const GIFTag& tag, const uint64_t* ptr, size_t offset)
 {
-	uint32_t NLOOP : 15;
-	uint32_t EOP : 1;
-	uint32_t : 16;
-	uint32_t : 14;
-	uint32_t PRE : 1;
-	uint32_t PRIM : 11;
-	uint32_t FLG : 2;
-	uint32_t NREG : 4;
-	uint64_t REGS;
-};
+	GIFBlock block(fmt::format("block_{:x}", offset));
+	DecodeTag(tag, ptr, offset, block);
+	valid = machine.TryEmitBlock(block);
+}
+
+// Where IMAGE data is written out to, empty to skip it
+std::string image_dir;
 
-void ParsePRIM(const uint64_t& prim)
+// IMAGE data is a raw transfer to the GS local memory, there is nothing to decode
+bool ExtractImage(const GIFTag& tag, const uint64_t* ptr, size_t offset)
 {
-	Parse(lparser, REG, new std::any(GifRegisters::PRIM), &valid);
-	switch(prim & 0x7)
+	if(image_dir.empty())
 	{
-		case 0:
-			Parse(lparser, MOD, new std::any(RegModifier::Point), &valid);
-			break;
-		case 1:
-			Parse(lparser, MOD, new std::any(RegModifier::Line), &valid);
-			break;
-		case 2:
-			Parse(lparser, MOD, new std::any(RegModifier::TriangleStrip), &valid);
-			break;
-		case 3:
-			Parse(lparser, MOD, new std::any(RegModifier::Triangle), &valid);
-			break;
-		case 4:
-			Parse(lparser, MOD, new std::any(RegModifier::TriangleStrip), &valid);
-			break;
-		case 5:
-			Parse(lparser, MOD, new std::any(RegModifier::TriangleFan), &valid);
-			break;
-		case 6:
-			Parse(lparser, MOD, new std::any(RegModifier::Sprite), &valid);
-			break;
-		case 7:
-			logger::error("Invalid PRIM type: 7");
-			break;
-		default:
-			std::unreachable();
+		logger::info("Skipping %zu bytes of IMAGE data at 0x%zx", tag.NLOOP * 2 * sizeof(uint64_t), offset);
+		return true;
 	}
 
-	if(prim & 0x8)
+	const std::string path = fmt::format("{}/image_{:x}.bin", image_dir, offset);
+	FILE* file = fopen(path.c_str(), "wb");
+	if(file == nullptr)
 	{
-		Parse(lparser, MOD, new std::any(RegModifier::Gouraud), &valid);
+		logger::error("Failed to open file: %s", path.c_str());
+		return false;
 	}
 
-	if(prim & 0x10)
+	const size_t size = tag.NLOOP * 2 * sizeof(uint64_t);
+	const bool written = fwrite(ptr, 1, size, file) == size;
+	fclose(file);
+	if(!written)
 	{
-		Parse(lparser, MOD, new std::any(RegModifier::Texture), &valid);
+		logger::error("Failed to write file: %s", path.c_str());
 	}
 
-	if(prim & 0x20)
+	return written;
+}
+
+// Decodes one GIFtag whose data is all there, or extracts its IMAGE data.
+// False only when the IMAGE data could not be written out.
+bool WalkTag(const GIFTag& tag, const uint64_t* data, size_t offset)
+{
+	// EOP only ends the packet, captures carry many packets back to back.
+	// Tags without any loops are padding or only there to end a packet.
+	if(tag.NLOOP == 0)
 	{
-		Parse(lparser, MOD, new std::any(RegModifier::Fogging), &valid);
+		return true;
 	}
 
-	Parse(lparser, 0, nullptr, &valid);
-}
+	if(tag.FLG == gs::GIF_FLG_IMAGE)
+	{
+		return ExtractImage(tag, data, offset);
+	}
 
-void ParseRGBAQ(const uint64_t& rgbaq)
-{
-	Parse(lparser, REG, new std::any(GifRegisters::RGBAQ), &valid);
-	Vec4 color = Vec4(rgbaq & 0xFF, (rgbaq >> 8) & 0xFF, (rgbaq >> 16) & 0xFF, (rgbaq >> 24) & 0xFF);
-	Parse(lparser, VEC4, new std::any(color), &valid);
-	Parse(lparser, 0, 0, &valid);
+	if(TagHasRegisters(tag))
+	{
+		EmitTag(tag, data, offset);
+	}
+
+	return true;
 }
 
-void ParseUV(const uint64_t& uv_reg)
+// How much of the input is walked before the pages behind are dropped
+constexpr size_t RELEASE_INTERVAL = 64 * 1024 * 1024;
+
+// Threads decoding tags, 1 decodes on the main thread as the tags are walked
+size_t jobs = 1;
+
+// Tags handed to the decoder threads at a time
+constexpr size_t WINDOW_TAGS = 16 * 1024;
+
+// Tags found by the walk, decoded together on the decoder threads
+struct Window
 {
-	Parse(lparser, REG, new std::any(GifRegisters::UV), &valid);
-	Vec2 uv_vec = Vec2((uv_reg >> 4) & 0x3FFF, (uv_reg >> 20) & 0x3FFF);
-	Parse(lparser, VEC2, new std::any(uv_vec), &valid);
-	Parse(lparser, 0, nullptr, &valid);
-}
+	std::vector<size_t> tags;
+	std::vector<GIFBlock> blocks;
+};
 
-void ParseXYZ2(const uint64_t& xyz2)
+// Windows go through the decoder one after the other. While one decodes
+// the previous one is emitted, so the backend always sees stream order.
+class WindowQueue
 {
-	Parse(lparser, REG, new std::any(GifRegisters::XYZ2), &valid);
-	Vec3 xyz = Vec3((xyz2 >> 4) & 0xFFFF, (xyz2 >> 20) & 0xFFFF, (xyz2 >> 36) & 0xFFFF);
-	Parse(lparser, VEC3, new std::any(xyz), &valid);
-	Parse(lparser, 0, 0, &valid);
-}
+	ParallelDecoder decoder;
+	MappedFile& input;
+	Window windows[2];
+	// The window being filled by the walk, the other one is in flight
+	size_t filling = 0;
+	bool in_flight = false;
+
+	bool Emit(Window& window)
+	{
+		for(size_t i = 0; i < window.tags.size() && valid; i++)
+		{
+			valid = machine.TryEmitBlock(window.blocks[i]);
+			window.blocks[i].registers.clear();
+		}
+
+		return valid;
+	}
+
+public:
+	WindowQueue(size_t threads, MappedFile& input)
+		: decoder(threads)
+		, input(input)
+	{
+		for(auto& window : windows)
+		{
+			window.tags.reserve(WINDOW_TAGS);
+			window.blocks.resize(WINDOW_TAGS);
+		}
+	}
+
+	// Queues a tag, once a window is full it goes to the decoder
+	bool Push(size_t pos)
+	{
+		windows[filling].tags.push_back(pos);
+		return windows[filling].tags.size() < WINDOW_TAGS || Dispatch();
+	}
+
+	// Sends off the window being filled and emits the one before it
+	bool Dispatch()
+	{
+		Window& pending = windows[filling];
+		Window& previous = windows[filling ^ 1];
+		if(in_flight)
+		{
+			decoder.Wait();
+		}
+
+		const bool has_pending = !pending.tags.empty();
+		if(has_pending)
+		{
+			decoder.Submit(input.As<uint64_t>().data(), pending.tags, std::span(pending.blocks).first(pending.tags.size()));
+		}
+
+		const bool emitted = !in_flight || Emit(previous);
+		// Nothing before the window in flight is read again
+		if(has_pending)
+		{
+			input.Release(pending.tags.front() * sizeof(uint64_t));
+		}
 
-void ParseTEX0(const uint64_t& tex0)
+		in_flight = has_pending;
+		filling ^= 1;
+		windows[filling].tags.clear();
+		return emitted;
+	}
+
+	// Decodes and emits whatever is left
+	bool Flush()
+	{
+		const bool emitted = Dispatch();
+		return Dispatch() && emitted;
+	}
+};
+
+// Walks every GIFtag of the input in place.
+// Each tag's data is checked against what is left of the input before any of it is read.
+bool Scan(MappedFile& input)
 {
-	Parse(lparser, REG, new std::any(GifRegisters::TEX0), &valid);
-	Parse(lparser, NUMBER_LITERAL, new std::any(static_cast<uint32_t>(tex0 & 0x3FFF)), &valid);
-	Parse(lparser, NUMBER_LITERAL, new std::any(static_cast<uint32_t>((tex0 >> 14) & 0x3F)), &valid);
-	Parse(lparser, VEC2, new std::any(Vec2((tex0 >> 26) & 0xF, (tex0 >> 30) & 0xF)), &valid);
-	switch(tex0 >> 20 & 0x3F)
+	const auto words = input.As<uint64_t>();
+	const uint64_t* buffer = words.data();
+	const size_t size = words.size();
+	size_t pos = 0;
+	size_t next_release = RELEASE_INTERVAL;
+	// Whether the input itself holds up, valid covers the blocks made from it
+	bool intact = true;
+
+	std::optional<WindowQueue> queue;
+	if(jobs > 1)
 	{
-		case 0:
-			Parse(lparser, MOD, new std::any(RegModifier::CT32), &valid);
-			break;
-		case 1:
-			Parse(lparser, MOD, new std::any(RegModifier::CT24), &valid);
-			break;
-		case 2:
-			Parse(lparser, MOD, new std::any(RegModifier::CT16), &valid);
-			break;
-		default:
-			logger::error("Invalid TBP value: {}", tex0 >> 20 & 0xF);
+		queue.emplace(jobs, input);
 	}
 
-	switch((tex0 >> 35) & 0x3)
+	while(pos < size && valid)
 	{
-		case 0:
-			Parse(lparser, MOD, new std::any(RegModifier::Modulate), &valid);
-			break;
-		case 1:
-			Parse(lparser, MOD, new std::any(RegModifier::Decal), &valid);
+		if(!queue && pos * sizeof(uint64_t) >= next_release)
+		{
+			input.Release(pos * sizeof(uint64_t));
+			next_release += RELEASE_INTERVAL;
+		}
+
+		const size_t offset = pos * sizeof(uint64_t);
+		if(size - pos < 2)
+		{
+			logger::error("Truncated GIFtag at 0x%zx", offset);
+			intact = false;
 			break;
-		case 2:
-			Parse(lparser, MOD, new std::any(RegModifier::Highlight), &valid);
+		}
+
+		const GIFTag& tag = *reinterpret_cast<const GIFTag*>(buffer + pos);
+		const size_t data_words = TagDataWords(tag);
+		if(data_words > size - pos - 2)
+		{
+			logger::error("GIFtag at 0x%zx needs %zu bytes of data, only %zu are left", offset,
+				data_words * sizeof(uint64_t), (size - pos - 2) * sizeof(uint64_t));
+			intact = false;
 			break;
-		case 3:
-			Parse(lparser, MOD, new std::any(RegModifier::Highlight2), &valid);
+		}
+
+		if(queue && tag.NLOOP != 0 && tag.FLG != gs::GIF_FLG_IMAGE && TagHasRegisters(tag))
+		{
+			valid = queue->Push(pos);
+		}
+		else if(!WalkTag(tag, buffer + pos + 2, offset))
+		{
+			intact = false;
 			break;
+		}
+
+		pos += 2 + data_words;
 	}
 
-	Parse(lparser, 0, nullptr, &valid);
-}
+	// Blocks before a broken tag still make it out, the same as without threads
+	if(queue && !queue->Flush())
+	{
+		valid = false;
+	}
 
-void ParseFOG(const uint64_t& fog)
-{
-	Parse(lparser, REG, new std::any(GifRegisters::FOG), &valid);
-	Parse(lparser, NUMBER_LITERAL, new std::any(static_cast<uint32_t>((fog >> 56) & 0xFF)), &valid);
-	Parse(lparser, 0, nullptr, &valid);
+	return intact && valid;
 }
 
-void ParseFOGCOL(const uint64_t& fogcol)
-{
-	Parse(lparser, REG, new std::any(GifRegisters::FOGCOL), &valid);
-	Vec3 color = Vec3(fogcol & 0xFF, (fogcol >> 8) & 0xFF, (fogcol >> 16) & 0xFF);
-	Parse(lparser, VEC3, new std::any(color), &valid);
-	Parse(lparser, 0, nullptr, &valid);
-}
+// Whether the input is a PCSX2 GS dump rather than raw GIF packets
+bool gs_dump = false;
 
-void ParseSCISSOR(const uint64_t& scissor)
+// The transfers of one GIF path glued back together. A GIFtag and its data
+// can be split over several transfers, it is walked once all of it is in.
+// Transfers are copied in, their data has no alignment in the dump.
+struct PathStream
 {
-	Parse(lparser, REG, new std::any(GifRegisters::SCISSOR), &valid);
-	Vec4 scissor_vec = Vec4(scissor & 0x7FF, (scissor >> 16) & 0x7FF, (scissor >> 32) & 0x7FF, (scissor >> 48) & 0x7FF);
-	Parse(lparser, VEC4, new std::any(scissor_vec), &valid);
-	Parse(lparser, 0, nullptr, &valid);
-}
+	std::vector<uint64_t> words;
+	// Where the words from each index on came from in the dump, one entry per transfer still held
+	std::vector<std::pair<size_t, size_t>> sources;
 
-void ParseSIGNAL(const uint64_t& signal)
-{
-	Parse(lparser, REG, new std::any(GifRegisters::SIGNAL), &valid);
-	Parse(lparser, VEC2, new std::any(Vec2(signal & UINT32_MAX, signal >> 32)), &valid);
-	Parse(lparser, 0, nullptr, &valid);
-}
-
-void ParseFINISH(const uint64_t& finish)
-{
-	Parse(lparser, REG, new std::any(GifRegisters::FINISH), &valid);
-	Parse(lparser, NUMBER_LITERAL, new std::any(static_cast<uint32_t>(finish)), &valid);
-	Parse(lparser, 0, nullptr, &valid);
-}
+	void Append(const GSDump::Transfer& transfer)
+	{
+		sources.emplace_back(words.size(), transfer.offset);
+		const size_t size = transfer.data.size() / sizeof(uint64_t);
+		words.resize(words.size() + size);
+		memcpy(words.data() + words.size() - size, transfer.data.data(), size * sizeof(uint64_t));
+	}
 
-void ParseLABEL(const uint64_t& label)
-{
-	Parse(lparser, REG, new std::any(GifRegisters::LABEL), &valid);
-	Parse(lparser, NUMBER_LITERAL, new std::any(static_cast<uint32_t>(label)), &valid);
-	Parse(lparser, 0, nullptr, &valid);
-}
+	// Offset in the dump of the word at index
+	size_t OffsetOf(size_t index) const
+	{
+		auto source = std::prev(std::upper_bound(sources.begin(), sources.end(), std::pair(index, SIZE_MAX)));
+		return source->second + (index - source->first) * sizeof(uint64_t);
+	}
 
-void Scan(uint64_t* buffer, size_t size)
-{
-	uint64_t* ptr = buffer;
+	// Drops the first count words, they have been walked
+	void Consume(size_t count)
+	{
+		if(count == words.size())
+		{
+			words.clear();
+			sources.clear();
+			return;
+		}
 
-	// GIFTag
-	GIFTag& tag = *reinterpret_cast<GIFTag*>(ptr);
-	Parse(lparser, IDENTIFIER, new std::any(fmt::format("block_{:x}", reinterpret_cast<uintptr_t>(ptr) - reinterpret_cast<uintptr_t>(buffer))), &valid);
-	Parse(lparser, BLOCK_START, nullptr, &valid);
-	Parse(lparser, 0, nullptr, &valid);
+		const size_t offset = OffsetOf(count);
+		std::erase_if(sources, [count](const auto& source) { return source.first <= count; });
+		for(auto& source : sources)
+		{
+			source.first -= count;
+		}
+		sources.emplace(sources.begin(), 0, offset);
+		words.erase(words.begin(), words.begin() + count);
+	}
+};
 
-	if(tag.PRE)
+// Walks the GIF transfers of a GS dump. Each path is its own stream of
+// packets, a tag is decoded as soon as the last of its data comes in.
+bool ScanDump(MappedFile& input)
+{
+	GSDump dump(std::span(input.Data(), input.Size()));
+	if(!dump.TryOpen())
 	{
-		ParsePRIM(tag.PRIM);
+		return false;
 	}
 
-	ptr++;
-	uint64_t gifregs = *ptr;
-	ptr++;
-
-	switch(tag.FLG)
+	// PATH1, PATH2 and PATH3, both of PCSX2's PATH1 packets go to the first
+	PathStream paths[3];
+	size_t next_release = RELEASE_INTERVAL;
+	bool intact = true;
+	while(valid && intact)
 	{
-		case 0:
-			for(int i = 0; i < tag.NLOOP; i++)
+		const auto transfer = dump.Next();
+		if(!transfer)
+		{
+			break;
+		}
+
+		if(dump.Offset() >= next_release)
+		{
+			input.Release(transfer->offset);
+			next_release += RELEASE_INTERVAL;
+		}
+
+		if(transfer->path == GSDump::Path::Dummy)
+		{
+			continue;
+		}
+
+		if(transfer->data.size() % sizeof(uint64_t) != 0)
+		{
+			logger::warn("Transfer at 0x%zx is not a whole number of 64bit words, the last %zu bytes are ignored", transfer->offset,
+				transfer->data.size() % sizeof(uint64_t));
+		}
+
+		PathStream& stream = transfer->path == GSDump::Path::Path2 ? paths[1] : transfer->path == GSDump::Path::Path3 ? paths[2] : paths[0];
+		stream.Append(*transfer);
+
+		const size_t size = stream.words.size();
+		size_t pos = 0;
+		while(size - pos >= 2 && valid)
+		{
+			const GIFTag& tag = *reinterpret_cast<const GIFTag*>(stream.words.data() + pos);
+			const size_t data_words = TagDataWords(tag);
+			if(data_words > size - pos - 2)
 			{
-				for(int j = 0; j < tag.NREG; j++)
-				{
-					uint64_t gifreg = gifregs >> (j * 4) & 0xF;
-					logger::warn("GIFREG is %x, %016X", gifreg, *ptr);
-
-					switch(gifreg)
-					{
-						case 0x0E:
-						{
-							uint64_t data = *ptr;
-							ptr++;
-							uint64_t dest = *ptr;
-							ptr++;
-							switch(static_cast<GifRegisterID>(dest))
-							{
-								case GifRegisterID::PRIM:
-									ParsePRIM(data);
-									break;
-								case GifRegisterID::RGBAQ:
-									ParseRGBAQ(data);
-									break;
-								case GifRegisterID::UV:
-									ParseUV(data);
-									break;
-								case GifRegisterID::XYZ2:
-									ParseXYZ2(data);
-									break;
-								case GifRegisterID::TEX0:
-									ParseTEX0(data);
-									break;
-								case GifRegisterID::FOG:
-									ParseFOG(data);
-									break;
-								case GifRegisterID::FOGCOL:
-									ParseFOGCOL(data);
-									break;
-								case GifRegisterID::SCISSOR:
-									ParseSCISSOR(data);
-									break;
-								case GifRegisterID::SIGNAL:
-									ParseSIGNAL(data);
-									break;
-								case GifRegisterID::FINISH:
-									ParseFINISH(data);
-									break;
-								case GifRegisterID::LABEL:
-									ParseLABEL(data);
-									break;
-								default:
-									logger::error("Unsupported gs register");
-							}
-						}
-						break;
-						default:
-							logger::error("Only supports AD gifreg currently");
-					}
-				}
+				break;
 			}
-			break;
-		default:
-			logger::error("Unsupported FLG: %u", (uint32_t)tag.FLG);
+
+			if(!WalkTag(tag, stream.words.data() + pos + 2, stream.OffsetOf(pos)))
+			{
+				intact = false;
+				break;
+			}
+			pos += 2 + data_words;
+		}
+		stream.Consume(pos);
+	}
+
+	for(size_t i = 0; i < std::size(paths); i++)
+	{
+		if(!paths[i].words.empty() && valid && intact)
+		{
+			logger::warn("PATH%zu ends in the middle of a GIFtag at 0x%zx, the last %zu bytes are ignored", i + 1, paths[i].OffsetOf(0),
+				paths[i].words.size() * sizeof(uint64_t));
+		}
 	}
-	Parse(lparser, BLOCK_END, nullptr, &valid);
-	Parse(lparser, 0, nullptr, &valid);
+
+	logger::info("Walked %zu frames of GS dump", dump.Frames());
+	return !dump.Failed() && intact && valid;
 }
 
 void print_help(char* argv0)
@@ -288,11 +378,21 @@ void print_help(char* argv0)
 			   "    Prints this help message\n\t"
 			   "  --version, -v\n\t"
 			   "    Prints the version of tpircsfig\n\t"
+			   "  --jobs=<n>\n\t"
+			   "    Decodes on n threads, 0 for one per core. Blocks are still emitted in stream order\n\t"
+			   "  --gs-dump\n\t"
+			   "    Reads the input as an uncompressed PCSX2 GS dump and decodes the GIF transfers in it\n\t"
+			   "  --extract-images=<dir>\n\t"
+			   "    Writes the data of every IMAGE GIFtag to <dir>/image_<offset>.bin instead of skipping it\n\t"
 			   "Valid backends are:\n\t"
 			   "  c_code(default)\n\t"
 			   "    Generates a c file with an array for each gif block\n"
+			   "  elf\n\t"
+			   "    Generates a relocatable object with a .rodata symbol for each gif block\n"
 			   "  gifscript\n\t"
 			   "    Generates a gifscript file. Mostly used for debugging or tpircsfig\n"
+			   "  stats\n\t"
+			   "    Writes a JSON summary of the size and estimated GS cost of each gif block, needs an output file\n"
 			   "For backend specific help, please pass --bhelp to your backend\n",
 		argv0);
 };
@@ -300,10 +400,16 @@ void print_help(char* argv0)
 
 std::string file_in;
 std::string file_out;
+// The stats backend writes JSON, which stdout would mix with the log
+bool output_required = false;
 auto main(int argc, char** argv) -> int
 {
 	machine.DisableOptimization(Machine::Optimization::DEAD_STORE_ELIMINATION);
 	//machine.DisableOptimization(Machine::Optimization::USE_TAG_PRIM);
+	// A capture is decoded as it was sent, passes that change geometry stay off
+	machine.DisableOptimization(Machine::Optimization::DEGENERATE_REMOVAL);
+	machine.DisableOptimization(Machine::Optimization::GOURAUD_DEMOTION);
+	machine.DisableOptimization(Machine::Optimization::SPRITE_MERGING);
 
 	if(argc < 2)
 	{
@@ -326,6 +432,27 @@ auto main(int argc, char** argv) -> int
 					return 1;
 				}
 			}
+			else if(backend_str == "elf")
+			{
+				fmt::print("Using elf backend\n");
+				backend = new elf_backend();
+				if(!backend->arg_parse(argc, argv))
+				{
+					fmt::print("Use --bhelp for valid backend configuration arguments\n");
+					return 1;
+				}
+			}
+			else if(backend_str == "stats")
+			{
+				fmt::print("Using stats backend\n");
+				backend = new stats_backend();
+				output_required = true;
+				if(!backend->arg_parse(argc, argv))
+				{
+					fmt::print("Use --bhelp for valid backend configuration arguments\n");
+					return 1;
+				}
+			}
 			else if(backend_str == "gifscript")
 			{
 				fmt::print("Using gifscript backend\n");
@@ -360,6 +487,29 @@ auto main(int argc, char** argv) -> int
 		{
 			machine.DisableOptimization(Machine::Optimization::USE_TAG_PRIM);
 		}
+		else if(arg.starts_with("--jobs="))
+		{
+			const std::string_view value = arg.substr(strlen("--jobs="));
+			const auto [end, ec] = std::from_chars(value.begin(), value.end(), jobs);
+			if(ec != std::errc() || end != value.end())
+			{
+				fmt::print("Invalid job count: {}\n", value);
+				return 1;
+			}
+
+			if(jobs == 0)
+			{
+				jobs = std::max(1u, std::thread::hardware_concurrency());
+			}
+		}
+		else if(arg == "--gs-dump")
+		{
+			gs_dump = true;
+		}
+		else if(arg.starts_with("--extract-images="))
+		{
+			image_dir = arg.substr(strlen("--extract-images="));
+		}
 		else if(file_in.empty() && !arg.starts_with("-"))
 		{
 			file_in = arg;
@@ -396,39 +546,36 @@ auto main(int argc, char** argv) -> int
 		return 1;
 	}
 
+	if(file_out.empty() && output_required)
+	{
+		fmt::print("The stats backend needs an output file\n");
+		return 1;
+	}
+
 	if(file_out.empty())
 	{
 		fmt::print("No output file specified. Printing to stdout\n");
 	}
 
-	lparser = ParseAlloc(malloc);
-	const size_t buffer_size = 8192;
-	std::array<uint64_t, buffer_size> buffer;
-	FILE* fin;
-	unsigned long numbytes;
-
-	fin = fopen(file_in.c_str(), "rb");
-	if(fin == nullptr)
+	if(gs_dump && jobs > 1)
 	{
-		fmt::print("Failed to open file: {}\n", file_in);
+		fmt::print("--gs-dump decodes on a single thread, it can not be used with --jobs\n");
 		return 1;
 	}
-	fseek(fin, 0, SEEK_END);
-	numbytes = ftell(fin);
-	fseek(fin, 0, SEEK_SET);
 
-	if(numbytes > sizeof(buffer))
+	MappedFile input;
+	if(!input.TryOpen(file_in))
 	{
-		fmt::print("File {} bytes is too large for internal buffer {} bytes :(\n", numbytes, sizeof(buffer));
 		return 1;
 	}
 
-	fread(buffer.data(), sizeof(uint64_t), numbytes, fin);
-
-	Scan(buffer.data(), numbytes);
+	if(!gs_dump && input.Size() % sizeof(uint64_t) != 0)
+	{
+		logger::warn("%s is not a whole number of 64bit words, the last %zu bytes are ignored", file_in.c_str(), input.Size() % sizeof(uint64_t));
+	}
 
-	ParseFree(lparser, free);
+	const bool scanned = gs_dump ? ScanDump(input) : Scan(input);
+	const bool failed = !scanned || backend->failed();
 	delete backend;
-	fclose(fin);
-	return 0;
+	return failed ? 1 : 0;
 }
@@ -1,11 +1,30 @@
 #include <gtest/gtest.h>
+#include <fmt/core.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <memory>
+#include <numeric>
+#include <sstream>
 
 #include "logger.hpp"
 #include "registers.hpp"
 #include "machine.hpp"
-#include "parser.h"
-#include "parser.cpp"
+#include "encoder.hpp"
+#include "static_packet.hpp"
+#include "packet_builder.hpp"
+#include "cost.hpp"
+#include "decoder.hpp"
+#include "ad_kernels.hpp"
+#include "parallel_decoder.hpp"
+#include "gs_dump.hpp"
+#include "dedup.hpp"
+#include "repeat_finder.hpp"
+#include "passes.hpp"
+#include "compiler.hpp"
+#include "c_code.hpp"
+#include "elf.hpp"
 
 TEST(MachineTests_StartBlock, Valid)
 {
@@ -249,6 +268,1369 @@ TEST(MachineTests_InsertMacro, Invalid_NoBlock)
 	EXPECT_FALSE(machine.TryInsertMacro("macro1"));
 }
 
+namespace
+{
+	// Keeps a copy of every emitted block
+	class CaptureBackend : public DummyBackend
+	{
+	public:
+		std::vector<GIFBlock> blocks;
+
+		void emit(GIFBlock& block) override
+		{
+			blocks.emplace_back(block);
+		}
+	};
+
+	void PushSprite(Machine& machine, uint32_t x, uint32_t y)
+	{
+		EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::RGBAQ)));
+		EXPECT_TRUE(machine.TryPushReg(Vec4(0xFF, 0, 0, 0x80)));
+		EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::XYZ2)));
+		EXPECT_TRUE(machine.TryPushReg(Vec3(x, y, 0)));
+		EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::XYZ2)));
+		EXPECT_TRUE(machine.TryPushReg(Vec3(x + 16, y + 16, 0)));
+	}
+} // namespace
+
+TEST(MachineTests_Repeat, Valid_SentWithNLOOP)
+{
+	Machine machine;
+	CaptureBackend backend;
+	machine.SetBackend(&backend);
+
+	EXPECT_TRUE(machine.TryStartBlock("block1"));
+	EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::PRIM)));
+	EXPECT_TRUE(machine.TryApplyModifier(RegModifier::Sprite));
+	EXPECT_TRUE(machine.TryStartRepeat(100));
+	PushSprite(machine, 0, 0);
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+
+	ASSERT_EQ(backend.blocks.size(), 1);
+	const GIFBlock& block = backend.blocks[0];
+	EXPECT_EQ(block.nloop, 100);
+	EXPECT_TRUE(block.prim);
+	EXPECT_EQ(block.registers.size(), 3);
+
+	const auto data = EncodeBlock(block);
+	ASSERT_EQ(data.size(), 2 + 100 * 3 * 2);
+	EXPECT_EQ(data[0], gs::SetGIFTag(100, 1, 1, block.prim->Encode(), gs::GIF_FLG_PACKED, 3));
+	EXPECT_EQ(data[1], 0xEEE);
+	EXPECT_EQ(data[2 + 99 * 6 + 3], static_cast<uint64_t>(GifRegisterID::XYZ2));
+
+	// The decoder sees the same registers as if they were written out
+	GIFBlock decoded("block1");
+	DecodeTag(*reinterpret_cast<const GIFTag*>(data.data()), data.data() + 2, 0, decoded);
+	EXPECT_EQ(decoded.registers.size(), 1 + 100 * 3);
+}
+
+TEST(MachineTests_Repeat, Valid_UnrolledWhenRegistersFollow)
+{
+	Machine machine;
+	CaptureBackend backend;
+	machine.SetBackend(&backend);
+
+	EXPECT_TRUE(machine.TryStartBlock("block1"));
+	EXPECT_TRUE(machine.TryStartRepeat(4));
+	PushSprite(machine, 0, 0);
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+	EXPECT_TRUE(machine.TrySetRegister(std::make_unique<FINISH>()));
+	EXPECT_TRUE(machine.TryPushReg(0));
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+
+	ASSERT_EQ(backend.blocks.size(), 1);
+	EXPECT_EQ(backend.blocks[0].nloop, 1);
+	EXPECT_EQ(backend.blocks[0].registers.size(), 4 * 3 + 1);
+}
+
+TEST(MachineTests_Repeat, Valid_UnrolledInMacro)
+{
+	Machine machine;
+	CaptureBackend backend;
+	machine.SetBackend(&backend);
+
+	EXPECT_TRUE(machine.TryStartMacro("macro1"));
+	EXPECT_TRUE(machine.TryStartRepeat(2));
+	PushSprite(machine, 0, 0);
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+
+	EXPECT_TRUE(machine.TryStartBlock("block1"));
+	EXPECT_TRUE(machine.TryInsertMacro("macro1"));
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+
+	ASSERT_EQ(backend.blocks.size(), 1);
+	EXPECT_EQ(backend.blocks[0].registers.size(), 2 * 3);
+}
+
+TEST(MachineTests_Patch, Valid_ListedInPatchTable)
+{
+	Machine machine;
+	CaptureBackend backend;
+	machine.SetBackend(&backend);
+
+	EXPECT_TRUE(machine.TryStartBlock("block1"));
+	EXPECT_TRUE(machine.TryMarkPatch("mode"));
+	EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::PRIM)));
+	EXPECT_TRUE(machine.TryApplyModifier(RegModifier::Sprite));
+	EXPECT_TRUE(machine.TryMarkPatch("color"));
+	EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::RGBAQ)));
+	EXPECT_TRUE(machine.TryPushReg(Vec3(0xFF, 0, 0)));
+	// Would be a dead store and a degenerate sprite, both stay for the runtime to fill in
+	EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::RGBAQ)));
+	EXPECT_TRUE(machine.TryPushReg(Vec3(0, 0xFF, 0)));
+	EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::XYZ2)));
+	EXPECT_TRUE(machine.TryPushReg(Vec3(0, 0, 0)));
+	EXPECT_TRUE(machine.TryMarkPatch("corner"));
+	EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::XYZ2)));
+	EXPECT_TRUE(machine.TryPushReg(Vec3(0, 0, 0)));
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+
+	ASSERT_EQ(backend.blocks.size(), 1);
+	const GIFBlock& block = backend.blocks[0];
+	ASSERT_TRUE(block.prim);
+	EXPECT_EQ(block.registers.size(), 4);
+
+	const auto patches = PatchTable(block);
+	ASSERT_EQ(patches.size(), 5 + 5 + 3);
+	EXPECT_EQ(patches[0].name, "mode");
+	EXPECT_EQ(patches[0].field, "type");
+	EXPECT_EQ(patches[0].qword, 0);
+	EXPECT_EQ(patches[0].bit, 47);
+	EXPECT_EQ(patches[5].name, "color");
+	EXPECT_EQ(patches[5].qword, 1);
+	EXPECT_EQ(patches[10].name, "corner");
+	EXPECT_EQ(patches[10].field, "x");
+	EXPECT_EQ(patches[10].qword, 4);
+
+	// Writing a field where the table says gives the same packet as the script writing it
+	auto data = EncodeBlock(block);
+	const auto set = [&](const Patch& patch, uint64_t value) {
+		uint64_t& word = data[patch.qword * 2];
+		const uint64_t mask = ((uint64_t{1} << patch.width) - 1) << patch.bit;
+		word = (word & ~mask) | ((value << patch.bit) & mask);
+	};
+	set(patches[10], 16 << 4);
+	set(patches[11], 16 << 4);
+	EXPECT_EQ(data[8], gs::SetXYZ(16 << 4, 16 << 4, 0));
+	set(patches[0], gs::GS_PRIM_TRIANGLE);
+	EXPECT_EQ(data[0], gs::SetGIFTag(4, 1, 1, gs::SetPRIM(gs::GS_PRIM_TRIANGLE, 0, 0, 0, 0, 0, 1, 0, 0), gs::GIF_FLG_PACKED, 1));
+}
+
+TEST(MachineTests_Patch, Invalid)
+{
+	Machine machine;
+	EXPECT_FALSE(machine.TryMarkPatch("outside"));
+
+	EXPECT_TRUE(machine.TryStartMacro("macro1"));
+	EXPECT_FALSE(machine.TryMarkPatch("in_macro"));
+	EXPECT_TRUE(machine.TrySetRegister(std::make_unique<FINISH>()));
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+
+	EXPECT_TRUE(machine.TryStartBlock("block1"));
+	EXPECT_TRUE(machine.TryMarkPatch("done"));
+	EXPECT_TRUE(machine.TrySetRegister(std::make_unique<FINISH>()));
+	EXPECT_FALSE(machine.TryMarkPatch("done"));
+	EXPECT_TRUE(machine.TryStartRepeat(2));
+	EXPECT_FALSE(machine.TryMarkPatch("in_repeat"));
+}
+
+TEST(MachineTests_Repeat, Invalid)
+{
+	Machine machine;
+
+	EXPECT_FALSE(machine.TryStartRepeat(2));
+	EXPECT_TRUE(machine.TryStartBlock("block1"));
+	EXPECT_FALSE(machine.TryStartRepeat(0));
+	EXPECT_FALSE(machine.TryStartRepeat(gs::GIF_NLOOP_MAX + 1));
+	EXPECT_TRUE(machine.TryStartRepeat(2));
+	EXPECT_FALSE(machine.TryStartRepeat(2));
+	// Empty body
+	EXPECT_FALSE(machine.TryEndBlockMacro());
+}
+
+namespace
+{
+	Expr Param(const std::string& name)
+	{
+		return Expr::Parameter(name);
+	}
+
+	Expr Add(Expr a, Expr b)
+	{
+		return Expr::Binary(Expr::Op::Add, std::move(a), std::move(b));
+	}
+
+	// macro quad(x, y, z, size) { rgbaq (size * 2, 0, 0, 0x80); xyz2 (x, y, z); xyz2 (x + size, y + size, z); }
+	void DefineQuad(Machine& machine)
+	{
+		EXPECT_TRUE(machine.TryStartMacro("quad", {"x", "y", "z", "size"}));
+		EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::RGBAQ)));
+		EXPECT_TRUE(machine.TryPushReg(std::vector<Expr>{Expr::Binary(Expr::Op::Multiply, Param("size"), Expr::Constant(2)),
+			Expr::Constant(0), Expr::Constant(0), Expr::Constant(0x80)}));
+		EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::XYZ2)));
+		EXPECT_TRUE(machine.TryPushReg(std::vector<Expr>{Param("x"), Param("y"), Param("z")}));
+		EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::XYZ2)));
+		EXPECT_TRUE(machine.TryPushReg(std::vector<Expr>{Add(Param("x"), Param("size")), Add(Param("y"), Param("size")), Param("z")}));
+		EXPECT_TRUE(machine.TryEndBlockMacro());
+	}
+} // namespace
+
+TEST(MachineTests_ParamMacro, Valid_EvaluatedPerInsertion)
+{
+	Machine machine;
+	CaptureBackend backend;
+	machine.SetBackend(&backend);
+	DefineQuad(machine);
+
+	// A macro with parameters can insert another one, passing expressions over its own
+	EXPECT_TRUE(machine.TryStartMacro("two_quads", {"x", "z"}));
+	EXPECT_TRUE(machine.TryInsertMacro("quad", std::vector<Expr>{Param("x"), Expr::Constant(10), Param("z"), Expr::Constant(8)}));
+	EXPECT_TRUE(machine.TryInsertMacro("quad", std::vector<Expr>{Add(Param("x"), Expr::Constant(100)), Expr::Constant(10), Param("z"), Expr::Constant(4)}));
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+
+	EXPECT_TRUE(machine.TryStartBlock("block1"));
+	EXPECT_TRUE(machine.TryInsertMacro("two_quads", std::vector<Expr>{Expr::Constant(50), Expr::Constant(7)}));
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+
+	ASSERT_EQ(backend.blocks.size(), 1);
+	ASSERT_EQ(backend.blocks[0].registers.size(), 6);
+	auto it = backend.blocks[0].registers.begin();
+	EXPECT_EQ(dynamic_cast<const RGBAQ&>(**it).GetValue().x, 16);
+	std::advance(it, 2);
+	const Vec3 second = dynamic_cast<const XYZ2&>(**it).GetValue();
+	EXPECT_EQ(second.x, 58);
+	EXPECT_EQ(second.y, 18);
+	EXPECT_EQ(second.z, 7);
+	std::advance(it, 2);
+	EXPECT_EQ(dynamic_cast<const XYZ2&>(**it).GetValue().x, 150);
+}
+
+TEST(MachineTests_ParamMacro, Invalid)
+{
+	Machine machine;
+	DefineQuad(machine);
+
+	// Parameters are checked when the macro is defined
+	EXPECT_TRUE(machine.TryStartMacro("broken", {"x"}));
+	EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::XYZ2)));
+	EXPECT_FALSE(machine.TryPushReg(std::vector<Expr>{Param("x"), Param("y"), Expr::Constant(0)}));
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+
+	EXPECT_FALSE(machine.TryStartMacro("twice", {"x", "x"}));
+
+	EXPECT_TRUE(machine.TryStartMacro("forever", {"x"}));
+	EXPECT_TRUE(machine.TryInsertMacro("forever", std::vector<Expr>{Param("x")}));
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+
+	EXPECT_TRUE(machine.TryStartBlock("block1"));
+	EXPECT_FALSE(machine.TryInsertMacro("quad", std::vector<Expr>{Expr::Constant(0)}));
+	EXPECT_FALSE(machine.TryInsertMacro("quad", Vec2(1, 1)));
+	EXPECT_FALSE(machine.TryPushReg(std::vector<Expr>{Param("x")}));
+	EXPECT_FALSE(machine.TryInsertMacro("forever", std::vector<Expr>{Expr::Constant(0)}));
+}
+
+TEST(MachineTests_ImportVertices, Valid)
+{
+	const std::string path = testing::TempDir() + "vertices.bin";
+	{
+		// rgbaq then xyz2, two vertices
+		const uint32_t words[] = {0xFF, 0, 0, 0x80, 10, 20, 0, 0, 0xFF, 0, 0x80, 30, 40, 5};
+		std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(words), sizeof(words));
+	}
+
+	Machine machine;
+	CaptureBackend backend;
+	machine.SetBackend(&backend);
+	machine.DisableOptimization(Machine::DEAD_STORE_ELIMINATION);
+
+	EXPECT_TRUE(machine.TryStartBlock("block1"));
+	EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::PRIM)));
+	EXPECT_TRUE(machine.TryApplyModifier(RegModifier::Line));
+	EXPECT_TRUE(machine.TryImportVertices(path, {GifRegisters::RGBAQ, GifRegisters::XYZ2}));
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+
+	ASSERT_EQ(backend.blocks.size(), 1);
+	const auto& registers = backend.blocks[0].registers;
+	ASSERT_EQ(registers.size(), 4);
+	// The PRIM went into the GIFtag
+	auto it = registers.begin();
+	EXPECT_EQ((*it++)->Encode(), gs::SetRGBAQ(0xFF, 0, 0, 0x80, 0));
+	EXPECT_EQ((*it++)->Encode(), gs::SetXYZ(10 << 4, 20 << 4, 0));
+	EXPECT_EQ((*it++)->Encode(), gs::SetRGBAQ(0, 0xFF, 0, 0x80, 0));
+	EXPECT_EQ((*it++)->Encode(), gs::SetXYZ(30 << 4, 40 << 4, 5));
+
+	std::remove(path.c_str());
+}
+
+TEST(MachineTests_ImportVertices, Invalid)
+{
+	const std::string path = testing::TempDir() + "vertices_odd.bin";
+	{
+		const uint32_t words[] = {1, 2, 3, 4};
+		std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(words), sizeof(words));
+	}
+
+	Machine machine;
+
+	EXPECT_FALSE(machine.TryImportVertices(path, {GifRegisters::XYZ2}));
+	EXPECT_TRUE(machine.TryStartBlock("block1"));
+	// Four words are not a whole number of XYZ2 vertices
+	EXPECT_FALSE(machine.TryImportVertices(path, {GifRegisters::XYZ2}));
+	EXPECT_FALSE(machine.TryImportVertices(path, {GifRegisters::TEX0}));
+	EXPECT_FALSE(machine.TryImportVertices(path, {}));
+	EXPECT_FALSE(machine.TryImportVertices(path + ".missing", {GifRegisters::RGBAQ}));
+	EXPECT_TRUE(machine.TryImportVertices(path, {GifRegisters::RGBAQ}));
+
+	std::remove(path.c_str());
+}
+
+TEST(MachineTests_UploadTexture, Valid_SentAsImageTags)
+{
+	const std::string path = testing::TempDir() + "texture.raw";
+	{
+		// 4x2 CT24 is a qword and a half
+		uint8_t pixels[24];
+		std::iota(std::begin(pixels), std::end(pixels), 1);
+		std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(pixels), sizeof(pixels));
+	}
+
+	Machine machine;
+	CaptureBackend backend;
+	machine.SetBackend(&backend);
+
+	EXPECT_TRUE(machine.TryStartBlock("block1"));
+	EXPECT_FALSE(machine.TryUploadTexture(path, 0x2300, 1, PSM::CT32, Vec4(0, 0, 4, 2)));
+	EXPECT_TRUE(machine.TryUploadTexture(path, 0x2300, 1, PSM::CT24, Vec4(16, 32, 4, 2)));
+	EXPECT_FALSE(machine.TrySetRegister(GenReg(GifRegisters::RGBAQ)));
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+
+	ASSERT_EQ(backend.blocks.size(), 1);
+	const GIFBlock& block = backend.blocks[0];
+	const auto data = EncodeBlock(block);
+	ASSERT_EQ(data.size() / 2, block.upload->Qwords());
+	EXPECT_EQ(data[0], gs::SetGIFTag(4, 0, 0, 0, gs::GIF_FLG_PACKED, 1));
+	EXPECT_EQ(data[2], gs::SetBITBLTBUF(0, 0, 0, 0x2300, 1, 1));
+	EXPECT_EQ(data[3], gs::GS_REG_BITBLTBUF);
+	EXPECT_EQ(data[4], gs::SetTRXPOS(0, 0, 16, 32, 0));
+	EXPECT_EQ(data[6], gs::SetTRXREG(4, 2));
+	EXPECT_EQ(data[9], gs::GS_REG_TRXDIR);
+	EXPECT_EQ(data[10], gs::SetGIFTag(2, 1, 0, 0, gs::GIF_FLG_IMAGE, 0));
+	EXPECT_EQ(data[12], 0x0807060504030201);
+	EXPECT_EQ(data[13], 0x100F0E0D0C0B0A09);
+	EXPECT_EQ(data[14], 0x1817161514131211);
+	EXPECT_EQ(data[15], 0);
+
+	std::remove(path.c_str());
+}
+
+TEST(MachineTests_UploadTexture, Invalid)
+{
+	const std::string path = testing::TempDir() + "texture_small.raw";
+	{
+		const uint8_t pixels[16] = {};
+		std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(pixels), sizeof(pixels));
+	}
+
+	Machine machine;
+
+	EXPECT_FALSE(machine.TryUploadTexture(path, 0, 1, PSM::CT32, Vec4(0, 0, 2, 2)));
+	EXPECT_TRUE(machine.TryStartMacro("macro1"));
+	EXPECT_FALSE(machine.TryUploadTexture(path, 0, 1, PSM::CT32, Vec4(0, 0, 2, 2)));
+	EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::FINISH)));
+	EXPECT_TRUE(machine.TryPushReg(0));
+	EXPECT_TRUE(machine.TryEndBlockMacro());
+
+	EXPECT_TRUE(machine.TryStartBlock("block1"));
+	EXPECT_FALSE(machine.TryUploadTexture(path, 0x4000, 1, PSM::CT32, Vec4(0, 0, 2, 2)));
+	EXPECT_FALSE(machine.TryUploadTexture(path, 0, 0, PSM::CT32, Vec4(0, 0, 2, 2)));
+	EXPECT_FALSE(machine.TryUploadTexture(path, 0, 1, PSM::CT32, Vec4(2047, 0, 2, 2)));
+	// 2x2 CT16 is only 8 of the 16 bytes
+	EXPECT_FALSE(machine.TryUploadTexture(path, 0, 1, PSM::CT16, Vec4(0, 0, 2, 2)));
+	EXPECT_TRUE(machine.TryUploadTexture(path, 0, 1, PSM::CT32, Vec4(0, 0, 2, 2)));
+	EXPECT_FALSE(machine.TryUploadTexture(path, 0, 1, PSM::CT32, Vec4(0, 0, 2, 2)));
+	EXPECT_FALSE(machine.TryInsertMacro("macro1"));
+	EXPECT_FALSE(machine.TryStartRepeat(2));
+
+	std::remove(path.c_str());
+}
+
+namespace
+{
+	struct BackendRun
+	{
+		std::string output;
+		bool failed;
+	};
+
+	// Runs script through a T given args, the stream outlives the backend as it writes on its way out
+	template <typename T>
+	BackendRun RunBackend(std::vector<std::string> args, const std::function<void(Machine&)>& script)
+	{
+		FILE* stream = std::tmpfile();
+		BackendRun run;
+		{
+			T backend;
+			std::vector<char*> argv;
+			for(auto& arg : args)
+			{
+				argv.push_back(arg.data());
+			}
+			EXPECT_TRUE(backend.arg_parse(static_cast<int>(argv.size()), argv.data()));
+			backend.set_output_stream(stream);
+
+			Machine machine;
+			machine.SetBackend(&backend);
+			script(machine);
+			run.failed = backend.failed();
+		}
+
+		std::rewind(stream);
+		char buffer[4096];
+		while(const size_t read = std::fread(buffer, 1, sizeof(buffer), stream))
+		{
+			run.output.append(buffer, read);
+		}
+		std::fclose(stream);
+		return run;
+	}
+
+	template <typename T>
+	T Read(const std::string& bytes, size_t offset)
+	{
+		T value;
+		std::memcpy(&value, bytes.data() + offset, sizeof(T));
+		return value;
+	}
+
+	// Where a symbol's data is in an ELF64 object
+	size_t ElfSymbolOffset(const std::string& object, const std::string& name)
+	{
+		const auto shoff = Read<uint64_t>(object, 0x28);
+		const auto shnum = Read<uint16_t>(object, 0x3C);
+		const auto section = [&](size_t index) { return shoff + index * 64; };
+		for(size_t i = 0; i < shnum; i++)
+		{
+			// SHT_SYMTAB, linked to its string table
+			if(Read<uint32_t>(object, section(i) + 4) != 2)
+			{
+				continue;
+			}
+
+			const auto symbols = Read<uint64_t>(object, section(i) + 0x18);
+			const auto count = Read<uint64_t>(object, section(i) + 0x20) / 24;
+			const auto strings = Read<uint64_t>(object, section(Read<uint32_t>(object, section(i) + 0x28)) + 0x18);
+			for(size_t j = 0; j < count; j++)
+			{
+				const size_t symbol = symbols + j * 24;
+				if(object.c_str() + strings + Read<uint32_t>(object, symbol) == name)
+				{
+					const auto data = Read<uint64_t>(object, section(Read<uint16_t>(object, symbol + 6)) + 0x18);
+					return data + Read<uint64_t>(object, symbol + 8);
+				}
+			}
+		}
+
+		ADD_FAILURE() << "No symbol " << name;
+		return 0;
+	}
+} // namespace
+
+TEST(BackendTests, BlockTooLargeForDMATag)
+{
+	const std::string path = testing::TempDir() + "large.raw";
+	{
+		// 512x512 CT32 is 65536 qwords of pixels before the transfer setup
+		const std::string pixels(512 * 512 * 4, '\0');
+		std::ofstream(path, std::ios::binary).write(pixels.data(), pixels.size());
+	}
+
+	const auto upload = [&](Machine& machine) {
+		EXPECT_TRUE(machine.TryStartBlock("block1"));
+		EXPECT_TRUE(machine.TryUploadTexture(path, 0, 8, PSM::CT32, Vec4(0, 0, 512, 512)));
+		EXPECT_TRUE(machine.TryEndBlockMacro());
+	};
+
+	EXPECT_TRUE(RunBackend<c_code_backend>({"--bdma"}, upload).failed);
+	EXPECT_TRUE(RunBackend<c_code_backend>({"--bdma-chain"}, upload).failed);
+	EXPECT_TRUE(RunBackend<elf_backend>({"--bdma"}, upload).failed);
+	EXPECT_TRUE(RunBackend<elf_backend>({"--bdma-chain"}, upload).failed);
+	// Without a DMAtag there is nothing to wrap
+	EXPECT_FALSE(RunBackend<c_code_backend>({}, upload).failed);
+	EXPECT_FALSE(RunBackend<elf_backend>({}, upload).failed);
+
+	std::remove(path.c_str());
+}
+
+TEST(BackendTests, ChainPatchesCountFromTheChain)
+{
+	// Two blocks of a GIFtag and an RGBAQ, each behind its CNT tag
+	const auto script = [](Machine& machine) {
+		for(const char* name : {"block1", "block2"})
+		{
+			EXPECT_TRUE(machine.TryStartBlock(name));
+			EXPECT_TRUE(machine.TryMarkPatch("color"));
+			EXPECT_TRUE(machine.TrySetRegister(GenReg(GifRegisters::RGBAQ)));
+			EXPECT_TRUE(machine.TryPushReg(Vec3(0xFF, 0, 0)));
+			EXPECT_TRUE(machine.TryEndBlockMacro());
+		}
+	};
+
+	const auto c_code = RunBackend<c_code_backend>({"--bdma-chain"}, script).output;
+	EXPECT_NE(c_code.find("qword counts from the start of gifscript_chain"), std::string::npos);
+	EXPECT_NE(c_code.find("block1_patches[] = {\n\t{2,0,8,0}, // color.r\n"), std::string::npos);
+	EXPECT_NE(c_code.find("block2_patches[] = {\n\t{5,0,8,0}, // color.r\n"), std::string::npos);
+
+	const auto object = RunBackend<elf_backend>({"--bx86_64", "--bdma-chain"}, script).output;
+	const size_t chain = ElfSymbolOffset(object, "gifscript_chain");
+	for(const auto& [name, qword] : {std::pair{"block1", 2u}, std::pair{"block2", 5u}})
+	{
+		const size_t patches = ElfSymbolOffset(object, std::string(name) + "_patches");
+		EXPECT_EQ(Read<uint32_t>(object, patches), qword) << name;
+		// The RGBAQ right behind the block's GIFtag
+		EXPECT_EQ(Read<uint64_t>(object, chain + (qword - 1) * 16), gs::SetGIFTag(1, 1, 0, 0, gs::GIF_FLG_PACKED, 1)) << name;
+		EXPECT_EQ(Read<uint64_t>(object, chain + qword * 16 + 8), gs::GIF_REG_RGBAQ) << name;
+	}
+}
+
+TEST(BackendTests, CCodeSplitsAtNLOOPMax)
+{
+	GIFBlock block("block1");
+	for(uint32_t i = 0; i < gs::GIF_NLOOP_MAX + 2; i++)
+	{
+		block.registers.push_back(GenReg(GifRegisters::XYZ2));
+		block.registers.back()->Push(Vec3(i % 2048, i / 2048, 0));
+	}
+	block.registers.back()->SetPatch("last");
+	const auto data = EncodeBlock(block);
+	const auto patches = PatchTable(block);
+
+	const auto c_code = RunBackend<c_code_backend>({}, [&](Machine& machine) {
+		machine.DisableOptimization(Machine::Optimization::DEAD_STORE_ELIMINATION);
+		machine.DisableOptimization(Machine::Optimization::DEGENERATE_REMOVAL);
+		GIFBlock copy(block);
+		EXPECT_TRUE(machine.TryEmitBlock(copy));
+	}).output;
+
+	EXPECT_NE(c_code.find(fmt::format("block1_data_size = {};", data.size() * 8)), std::string::npos);
+	EXPECT_NE(c_code.find(fmt::format("{{{},0,16,0}}, // last.x", patches[0].qword)), std::string::npos);
+
+	// Every line of the array is a qword, tags where EncodeBlock has them and registers in between
+	const size_t start = c_code.find("= {\n") + 4;
+	std::istringstream lines(c_code.substr(start, c_code.find("\n};") - start));
+	size_t qword = 0;
+	size_t tags = 0;
+	for(std::string line; std::getline(lines, line); qword++)
+	{
+		ASSERT_LT(qword * 2, data.size());
+		if(line.starts_with("\tGIF_SET_TAG("))
+		{
+			tags++;
+			const uint64_t tag = data[qword * 2];
+			EXPECT_EQ(line, fmt::format("\tGIF_SET_TAG({},{},0,0,0,1),GIF_REG_AD,", tag & 0x7FFF, (tag >> 15) & 1)) << qword;
+		}
+		else
+		{
+			EXPECT_EQ(data[qword * 2 + 1], gs::GIF_REG_XYZ2) << qword;
+		}
+	}
+	EXPECT_EQ(qword * 2, data.size());
+	EXPECT_EQ(tags, 2);
+}
+
+TEST(BackendTests, ElfOutputFailsBeforeTheObjectIsWritten)
+{
+	// The frontends read failed() before the backend goes and writes its object
+	const std::string path = testing::TempDir() + "object.o";
+	{
+		elf_backend backend;
+		backend.set_output(path);
+		EXPECT_FALSE(backend.failed());
+	}
+	std::remove(path.c_str());
+
+	elf_backend missing;
+	missing.set_output(testing::TempDir() + "missing/object.o");
+	EXPECT_TRUE(missing.failed());
+
+	elf_backend none;
+	none.set_output("");
+	EXPECT_TRUE(none.failed());
+}
+
+TEST(EncoderTests, GIFTag_Layout)
+{
+	EXPECT_EQ(gs::SetGIFTag(4, 1, 1, 0x103, gs::GIF_FLG_PACKED, 1), 0x1081C00000008004);
+}
+
+TEST(EncoderTests, DMATag_Layout)
+{
+	EXPECT_EQ(gs::SetDMATag(5, 0, gs::DMA_TAG_CNT, 0, 0, 0), 0x10000005);
+	EXPECT_EQ(gs::SetDMATag(2, 0, gs::DMA_TAG_REF, 0, 0x1000, 0), 0x0000100030000002);
+}
+
+TEST(EncoderTests, Block_ADPairs)
+{
+	GIFBlock block("block1");
+	block.registers.push_back(GenReg(GifRegisters::XYZ2));
+	block.registers.back()->Push(Vec3(1, 2, 3));
+	block.registers.push_back(std::make_unique<FINISH>());
+
+	const auto data = EncodeBlock(block);
+	ASSERT_EQ(data.size(), 6);
+	EXPECT_EQ(data[0], gs::SetGIFTag(2, 1, 0, 0, gs::GIF_FLG_PACKED, 1));
+	EXPECT_EQ(data[1], gs::GIF_REG_AD);
+	EXPECT_EQ(data[2], gs::SetXYZ(1 << 4, 2 << 4, 3));
+	EXPECT_EQ(data[3], static_cast<uint64_t>(GifRegisterID::XYZ2));
+	EXPECT_EQ(data[5], static_cast<uint64_t>(GifRegisterID::FINISH));
+}
+
+TEST(EncoderTests, Block_STAndXYZF2)
+{
+	GIFBlock block("block1");
+	block.registers.push_back(GenReg(GifRegisters::ST));
+	block.registers.back()->Push(Vec2(0x3F800000, 0x3F000000));
+	block.registers.push_back(GenReg(GifRegisters::XYZF2));
+	block.registers.back()->Push(Vec4(1, 2, 3, 0x7F));
+
+	const auto data = EncodeBlock(block);
+	ASSERT_EQ(data.size(), 6);
+	EXPECT_EQ(data[2], 0x3F0000003F800000);
+	EXPECT_EQ(data[3], static_cast<uint64_t>(GifRegisterID::ST));
+	EXPECT_EQ(data[4], 0x7F00000300200010);
+	EXPECT_EQ(data[5], static_cast<uint64_t>(GifRegisterID::XYZF2));
+}
+
+TEST(EncoderTests, Block_TagPrim)
+{
+	GIFBlock block("block1");
+	block.prim = GenReg(GifRegisters::PRIM);
+	block.prim->ApplyModifier(RegModifier::Sprite);
+	block.registers.push_back(std::make_unique<FINISH>());
+
+	const auto data = EncodeBlock(block);
+	EXPECT_EQ(data[0], gs::SetGIFTag(1, 1, 1, gs::SetPRIM(6, 0, 0, 0, 0, 0, 1, 0, 0), gs::GIF_FLG_PACKED, 1));
+}
+
+TEST(EncoderTests, Block_SplitsAtNLOOPMax)
+{
+	GIFBlock block("block1");
+	for(uint32_t i = 0; i < gs::GIF_NLOOP_MAX + 1; i++)
+	{
+		block.registers.push_back(std::make_unique<FINISH>());
+	}
+
+	const auto data = EncodeBlock(block);
+	ASSERT_EQ(data.size(), (gs::GIF_NLOOP_MAX + 3) * 2);
+	EXPECT_EQ(data[0], gs::SetGIFTag(gs::GIF_NLOOP_MAX, 0, 0, 0, gs::GIF_FLG_PACKED, 1));
+	EXPECT_EQ(data[(gs::GIF_NLOOP_MAX + 1) * 2], gs::SetGIFTag(1, 1, 0, 0, gs::GIF_FLG_PACKED, 1));
+}
+
+TEST(EncoderTests, StaticPacketMatchesEncodeBlock)
+{
+	constexpr const auto& packet = gs::StaticPacket<R"(
+		// Compiled while the tests build
+		quad {
+			RGBAQ 0x80,0,0;
+			prim sprite textured;
+			tex0 0x2300 2 ct24 7,7 modulate;
+			st 0.5,1.0;
+			xyz2 0,0,0;
+			xyz2 64,64,0;
+		}
+	)">;
+	static_assert(packet.size() == 12);
+
+	GIFBlock block("quad");
+	block.prim = GenReg(GifRegisters::PRIM);
+	block.prim->ApplyModifier(RegModifier::Sprite);
+	block.prim->ApplyModifier(RegModifier::Texture);
+	block.registers.push_back(GenReg(GifRegisters::RGBAQ));
+	block.registers.back()->Push(Vec3(0x80, 0, 0));
+	block.registers.push_back(GenReg(GifRegisters::TEX0));
+	block.registers.back()->Push(0x2300u);
+	block.registers.back()->Push(2u);
+	block.registers.back()->ApplyModifier(RegModifier::CT24);
+	block.registers.back()->Push(Vec2(7, 7));
+	block.registers.back()->ApplyModifier(RegModifier::Modulate);
+	block.registers.push_back(GenReg(GifRegisters::ST));
+	block.registers.back()->Push(Vec2(0x3F000000, 0x3F800000));
+	block.registers.push_back(GenReg(GifRegisters::XYZ2));
+	block.registers.back()->Push(Vec3(0, 0, 0));
+	block.registers.push_back(GenReg(GifRegisters::XYZ2));
+	block.registers.back()->Push(Vec3(64, 64, 0));
+
+	const auto data = EncodeBlock(block);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(packet.data()) % 16, 0);
+	EXPECT_TRUE(std::equal(packet.begin(), packet.end(), data.begin(), data.end()));
+}
+
+TEST(EncoderTests, PacketBuilderMatchesEncodeBlock)
+{
+	alignas(16) uint64_t buffer[(gs::GIF_NLOOP_MAX + 4) * 2];
+	PacketBuilder builder(buffer);
+	builder.PushPrim(gs::GS_PRIM_SPRITE, false, true);
+	builder.PushRGBAQ(0x80, 0, 0);
+	builder.PushST(0.5f, 1.0f);
+	builder.PushXYZ2(0, 0, 0);
+	builder.PushXYZ2(64, 64, 0);
+
+	GIFBlock block("sprite");
+	block.prim = GenReg(GifRegisters::PRIM);
+	block.prim->ApplyModifier(RegModifier::Sprite);
+	block.prim->ApplyModifier(RegModifier::Texture);
+	block.registers.push_back(GenReg(GifRegisters::RGBAQ));
+	block.registers.back()->Push(Vec3(0x80, 0, 0));
+	block.registers.push_back(GenReg(GifRegisters::ST));
+	block.registers.back()->Push(Vec2(0x3F000000, 0x3F800000));
+	block.registers.push_back(GenReg(GifRegisters::XYZ2));
+	block.registers.back()->Push(Vec3(0, 0, 0));
+	block.registers.push_back(GenReg(GifRegisters::XYZ2));
+	block.registers.back()->Push(Vec3(64, 64, 0));
+
+	const auto expected = EncodeBlock(block);
+	const auto packet = builder.Finish();
+	EXPECT_TRUE(std::equal(packet.begin(), packet.end(), expected.begin(), expected.end()));
+	EXPECT_EQ(builder.Qwords(), 5);
+
+	// A second packet follows the first, its registers split over two tags at NLOOP_MAX
+	builder.Reset();
+	for(uint32_t i = 0; i < gs::GIF_NLOOP_MAX + 1; i++)
+	{
+		builder.PushAD(gs::SetFINISH(0), gs::GS_REG_FINISH);
+	}
+	const auto split = builder.Finish();
+	ASSERT_EQ(split.size(), (gs::GIF_NLOOP_MAX + 3) * 2);
+	EXPECT_EQ(split[0], gs::SetGIFTag(gs::GIF_NLOOP_MAX, 0, 0, 0, gs::GIF_FLG_PACKED, 1));
+	EXPECT_EQ(split[(gs::GIF_NLOOP_MAX + 1) * 2], gs::SetGIFTag(1, 1, 0, 0, gs::GIF_FLG_PACKED, 1));
+	EXPECT_FALSE(builder.Overflowed());
+
+	builder.PushXYZ2(0, 0, 0);
+	EXPECT_TRUE(builder.Overflowed());
+}
+
+TEST(DedupTests, IdenticalPayloadAliasesFirst)
+{
+	block_dedup dedup;
+	const std::vector<uint64_t> a = {1, 2, 3, 4};
+	const std::vector<uint64_t> b = {1, 2, 3, 5};
+
+	EXPECT_FALSE(dedup.find_or_add("a", a).has_value());
+	EXPECT_FALSE(dedup.find_or_add("b", b).has_value());
+	EXPECT_EQ(dedup.find_or_add("c", a), "a");
+	EXPECT_EQ(dedup.find_or_add("d", b), "b");
+}
+
+// Undoes extract_repeats, the way the machine inserts macros
+static script_body ExpandRepeats(const script_body& body, const std::vector<script_body>& macros)
+{
+	script_body expanded;
+	for(const auto& entry : body)
+	{
+		if(entry.kind != script_entry::Kind::MACRO)
+		{
+			expanded.push_back(entry);
+			continue;
+		}
+
+		for(auto inserted : macros[entry.macro])
+		{
+			if(inserted.kind == script_entry::Kind::XYZ2)
+			{
+				inserted.xyz.x += entry.offset.x;
+				inserted.xyz.y += entry.offset.y;
+			}
+			expanded.push_back(inserted);
+		}
+	}
+	return expanded;
+}
+
+static bool SameBody(const script_body& a, const script_body& b)
+{
+	return std::ranges::equal(a, b, [](const script_entry& x, const script_entry& y) {
+		return x.kind == y.kind && x.text == y.text && x.xyz.x == y.xyz.x && x.xyz.y == y.xyz.y && x.xyz.z == y.xyz.z;
+	});
+}
+
+TEST(RepeatFinderTests, MovedSpritesBecomeOneMacro)
+{
+	std::vector<script_body> blocks(2);
+	for(uint32_t i = 0; i < 8; i++)
+	{
+		auto& block = blocks[i % 2];
+		block.push_back({.kind = script_entry::Kind::LINE, .text = "rgbaq 0xff,0x0,0x0,0x80;"});
+		block.push_back({.kind = script_entry::Kind::XYZ2, .xyz = Vec3(100 + i * i * 7, 50 + i * 11, 0)});
+		block.push_back({.kind = script_entry::Kind::XYZ2, .xyz = Vec3(116 + i * i * 7, 66 + i * 11, 0)});
+	}
+	const auto original = blocks;
+
+	const auto macros = extract_repeats(blocks);
+
+	ASSERT_EQ(macros.size(), 1);
+	EXPECT_EQ(macros[0].size(), 3);
+	for(size_t i = 0; i < blocks.size(); i++)
+	{
+		EXPECT_EQ(blocks[i].size(), 4);
+		EXPECT_TRUE(SameBody(ExpandRepeats(blocks[i], macros), original[i]));
+	}
+}
+
+TEST(RepeatFinderTests, DifferentZIsNotARepeat)
+{
+	std::vector<script_body> blocks(1);
+	for(uint32_t i = 0; i < 8; i++)
+	{
+		blocks[0].push_back({.kind = script_entry::Kind::XYZ2, .xyz = Vec3(i * 10, 0, i)});
+		blocks[0].push_back({.kind = script_entry::Kind::LINE, .text = "finish 0x0;"});
+	}
+	const auto original = blocks;
+
+	const auto macros = extract_repeats(blocks);
+
+	for(const auto& macro : macros)
+	{
+		EXPECT_LE(std::ranges::count(macro, script_entry::Kind::XYZ2, &script_entry::kind), 1);
+	}
+	EXPECT_TRUE(SameBody(ExpandRepeats(blocks[0], macros), original[0]));
+}
+
+static std::unique_ptr<PRIM> MakePrim(RegModifier type, bool textured = false)
+{
+	auto prim = std::make_unique<PRIM>();
+	prim->ApplyModifier(type);
+	if(textured)
+	{
+		prim->ApplyModifier(Texture);
+	}
+	return prim;
+}
+
+static std::unique_ptr<XYZ2> MakeXYZ2(uint32_t x, uint32_t y)
+{
+	auto xyz2 = std::make_unique<XYZ2>();
+	xyz2->Push(Vec3(x, y, 0));
+	return xyz2;
+}
+
+static std::unique_ptr<UV> MakeUV(uint32_t u, uint32_t v)
+{
+	auto uv = std::make_unique<UV>();
+	uv->Push(Vec2(u, v));
+	return uv;
+}
+
+TEST(CostTests, SpriteFill)
+{
+	GIFBlock block("block1");
+	block.prim = MakePrim(Sprite);
+	block.registers.push_back(MakeXYZ2(0, 0));
+	block.registers.push_back(MakeXYZ2(64, 32));
+
+	const auto cost = EstimateCost(block);
+	EXPECT_EQ(cost.qwords, 3);
+	EXPECT_EQ(cost.primitives[static_cast<size_t>(PrimType::Sprite)], 1);
+	EXPECT_EQ(cost.pixels, 64 * 32);
+	EXPECT_EQ(cost.fill_cycles, 64 * 32 / gs::PIXELS_PER_CYCLE);
+	EXPECT_EQ(cost.Cycles(), gs::SETUP_CYCLES + cost.fill_cycles);
+}
+
+TEST(CostTests, StripAndFanAssembly)
+{
+	GIFBlock block("block1");
+	block.prim = MakePrim(TriangleStrip);
+	for(uint32_t i = 0; i < 5; i++)
+	{
+		block.registers.push_back(MakeXYZ2(i * 10, (i % 2) * 10));
+	}
+	block.registers.push_back(MakePrim(TriangleFan, true));
+	for(uint32_t i = 0; i < 4; i++)
+	{
+		block.registers.push_back(MakeXYZ2(i * 10, i == 0 ? 0 : 10));
+	}
+
+	const auto cost = EstimateCost(block);
+	EXPECT_EQ(cost.primitives[static_cast<size_t>(PrimType::TriangleStrip)], 3);
+	EXPECT_EQ(cost.primitives[static_cast<size_t>(PrimType::TriangleFan)], 2);
+	EXPECT_EQ(cost.pixels, 3 * 100 + 2 * 50);
+	EXPECT_EQ(cost.textured_pixels, 2 * 50);
+	EXPECT_EQ(cost.state_changes, 1);
+}
+
+TEST(PassTests, SplitSprites)
+{
+	GIFBlock block("block1");
+	block.prim = MakePrim(Sprite, true);
+	// 1:1, cut at U 32, 64 and 96
+	block.registers.push_back(MakeUV(0, 0));
+	block.registers.push_back(MakeXYZ2(100, 0));
+	block.registers.push_back(MakeUV(128, 64));
+	block.registers.push_back(MakeXYZ2(228, 64));
+	// 100 texels over 64 pixels, U 32 would fall between pixels
+	block.registers.push_back(MakeUV(0, 0));
+	block.registers.push_back(MakeXYZ2(0, 0));
+	block.registers.push_back(MakeUV(100, 64));
+	block.registers.push_back(MakeXYZ2(64, 64));
+
+	const auto before = EstimateCost(block);
+	EXPECT_EQ(SplitSprites(block, 32), 1);
+	const auto after = EstimateCost(block);
+
+	ASSERT_EQ(block.registers.size(), 4 * 4 + 4);
+	auto it = block.registers.begin();
+	for(uint32_t strip = 0; strip < 4; strip++)
+	{
+		EXPECT_EQ((*it++)->Encode(), gs::SetUV((strip * 32) << 4, 0));
+		EXPECT_EQ((*it++)->Encode(), gs::SetXYZ((100 + strip * 32) << 4, 0, 0));
+		EXPECT_EQ((*it++)->Encode(), gs::SetUV((strip * 32 + 32) << 4, 64 << 4));
+		EXPECT_EQ((*it++)->Encode(), gs::SetXYZ((132 + strip * 32) << 4, 64 << 4, 0));
+	}
+
+	EXPECT_EQ(after.pixels, before.pixels);
+	// Two page columns reloaded on all 64 rows, then each strip loads its two pages once
+	EXPECT_EQ(before.texture_page_loads, 2 * 64 + 2 * 64);
+	EXPECT_EQ(after.texture_page_loads, 4 * 2 + 2 * 64);
+	EXPECT_LT(after.Cycles(), before.Cycles());
+}
+
+TEST(PassTests, CullOutsideScissor)
+{
+	GIFBlock block("block1");
+	block.prim = MakePrim(Sprite);
+	block.registers.push_back(GenReg(GifRegisters::SCISSOR));
+	block.registers.back()->Push(Vec4(0, 99, 0, 99));
+	block.registers.push_back(MakeXYZ2(10, 10));
+	block.registers.push_back(MakeXYZ2(20, 20));
+	block.registers.push_back(MakeXYZ2(200, 200));
+	block.registers.push_back(MakeXYZ2(300, 300));
+	// The 4th to 6th triangles are outside, the strip restarts after them
+	block.registers.push_back(MakePrim(TriangleStrip));
+	const uint32_t strip[][2] = {{0, 0}, {10, 0}, {0, 10}, {500, 0}, {500, 10}, {510, 0}, {510, 10}, {520, 0}, {0, 0}, {10, 0}, {0, 10}};
+	for(const auto& [x, y] : strip)
+	{
+		block.registers.push_back(MakeXYZ2(x, y));
+	}
+
+	EXPECT_EQ(CullOutsideScissor(block), 1 + 3);
+
+	const auto cost = EstimateCost(block);
+	EXPECT_EQ(cost.primitives[static_cast<size_t>(PrimType::Sprite)], 1);
+	EXPECT_EQ(cost.primitives[static_cast<size_t>(PrimType::TriangleStrip)], 3 + 3);
+
+	ASSERT_EQ(block.registers.size(), 1 + 2 + 1 + 5 + 1 + 5);
+	auto it = std::next(block.registers.begin(), 4 + 5);
+	EXPECT_EQ((*it)->GetID(), GifRegisterID::PRIM);
+	EXPECT_EQ((*++it)->Encode(), gs::SetXYZ(510 << 4, 10 << 4, 0));
+}
+
+TEST(PassTests, RemoveDegenerates)
+{
+	GIFBlock block("block1");
+	block.prim = MakePrim(Sprite);
+	block.registers.push_back(MakeXYZ2(10, 10));
+	block.registers.push_back(MakeXYZ2(10, 20));
+	block.registers.push_back(MakeXYZ2(10, 10));
+	block.registers.push_back(MakeXYZ2(20, 20));
+	// Two strips stitched with repeated vertices, A B C D D E E F G H
+	block.registers.push_back(MakePrim(TriangleStrip));
+	const uint32_t strip[][2] = {{0, 0}, {10, 0}, {0, 10}, {10, 10}, {10, 10}, {50, 0}, {50, 0}, {60, 0}, {50, 10}, {60, 10}};
+	for(const auto& [x, y] : strip)
+	{
+		block.registers.push_back(MakeXYZ2(x, y));
+	}
+	// A B C C D D E F, the D D E triangle stays so D E F keeps its winding
+	block.registers.push_back(MakePrim(TriangleStrip));
+	const uint32_t winding[][2] = {{0, 0}, {10, 0}, {0, 10}, {0, 10}, {50, 0}, {50, 0}, {60, 0}, {50, 10}};
+	for(const auto& [x, y] : winding)
+	{
+		block.registers.push_back(MakeXYZ2(x, y));
+	}
+
+	EXPECT_EQ(RemoveDegenerates(block), 2 + 2 + 1);
+
+	const auto cost = EstimateCost(block);
+	EXPECT_EQ(cost.primitives[static_cast<size_t>(PrimType::Sprite)], 1);
+	EXPECT_EQ(cost.primitives[static_cast<size_t>(PrimType::TriangleStrip)], 2 + 2 + 1 + 2);
+
+	ASSERT_EQ(block.registers.size(), 2 + 1 + 4 + 1 + 4 + 1 + 3 + 1 + 4);
+	auto it = std::next(block.registers.begin(), 2 + 1 + 4);
+	EXPECT_EQ((*it)->GetID(), GifRegisterID::PRIM);
+	EXPECT_EQ((*++it)->Encode(), gs::SetXYZ(50 << 4, 0, 0));
+	it = std::next(it, 4 + 1 + 3);
+	EXPECT_EQ((*it)->GetID(), GifRegisterID::PRIM);
+	EXPECT_EQ((*++it)->Encode(), gs::SetXYZ(50 << 4, 0, 0));
+	EXPECT_EQ((*++it)->Encode(), gs::SetXYZ(50 << 4, 0, 0));
+}
+
+TEST(PassTests, DemoteGouraud)
+{
+	const auto rgbaq = [](uint32_t r) {
+		auto reg = GenReg(GifRegisters::RGBAQ);
+		reg->Push(Vec4(r, 0, 0, 0x80));
+		return reg;
+	};
+
+	GIFBlock block("block1");
+	block.prim = MakePrim(Triangle);
+	block.prim->ApplyModifier(Gouraud);
+	for(uint32_t i = 0; i < 3; i++)
+	{
+		block.registers.push_back(rgbaq(0xFF));
+		block.registers.push_back(MakeXYZ2(i * 10, i * 20));
+	}
+	// The colors differ, this one stays gouraud
+	block.registers.push_back(MakePrim(Triangle));
+	block.registers.back()->ApplyModifier(Gouraud);
+	for(uint32_t i = 0; i < 3; i++)
+	{
+		block.registers.push_back(rgbaq(i));
+		block.registers.push_back(MakeXYZ2(i * 10, i * 20));
+	}
+
+	EXPECT_EQ(DemoteGouraud(block), 1);
+	EXPECT_FALSE(dynamic_cast<const PRIM&>(*block.prim).IsGouraud());
+
+	ASSERT_EQ(block.registers.size(), 1 + 3 + 1 + 6);
+	EXPECT_EQ(block.registers.front()->Encode(), rgbaq(0xFF)->Encode());
+	auto it = std::next(block.registers.begin(), 1 + 3);
+	EXPECT_TRUE(dynamic_cast<const PRIM&>(**it).IsGouraud());
+
+	// Single color, but the next block may draw with it
+	GIFBlock last("block2");
+	last.prim = MakePrim(Triangle);
+	last.prim->ApplyModifier(Gouraud);
+	for(uint32_t i = 0; i < 3; i++)
+	{
+		last.registers.push_back(rgbaq(0xFF));
+		last.registers.push_back(MakeXYZ2(i * 10, i * 20));
+	}
+	EXPECT_EQ(DemoteGouraud(last), 0);
+	EXPECT_TRUE(dynamic_cast<const PRIM&>(*last.prim).IsGouraud());
+}
+
+TEST(PassTests, MergeSprites)
+{
+	const auto rgbaq = [](uint32_t r) {
+		auto reg = GenReg(GifRegisters::RGBAQ);
+		reg->Push(Vec4(r, 0, 0, 0x80));
+		return reg;
+	};
+
+	// A 3x2 grid of red tiles, then a blue one next to it
+	GIFBlock block("block1");
+	block.prim = MakePrim(Sprite);
+	block.registers.push_back(rgbaq(0xFF));
+	for(uint32_t y = 0; y < 20; y += 10)
+	{
+		for(uint32_t x = 0; x < 30; x += 10)
+		{
+			block.registers.push_back(MakeXYZ2(x, y));
+			block.registers.push_back(MakeXYZ2(x + 10, y + 10));
+		}
+	}
+	block.registers.push_back(rgbaq(0));
+	block.registers.push_back(MakeXYZ2(40, 10));
+	block.registers.push_back(MakeXYZ2(30, 0));
+
+	EXPECT_EQ(MergeSprites(block), 5);
+
+	const uint64_t expected[] = {rgbaq(0xFF)->Encode(), gs::SetXYZ(0, 0, 0), gs::SetXYZ(30 << 4, 20 << 4, 0), rgbaq(0)->Encode(),
+		gs::SetXYZ(30 << 4, 0, 0), gs::SetXYZ(40 << 4, 10 << 4, 0)};
+	ASSERT_EQ(block.registers.size(), std::size(expected));
+	auto it = block.registers.begin();
+	for(const uint64_t value : expected)
+	{
+		EXPECT_EQ((*it++)->Encode(), value);
+	}
+
+	// The last one overlaps the other two, the order they are drawn in has to stay
+	GIFBlock overlapping("block2");
+	overlapping.prim = MakePrim(Sprite);
+	overlapping.registers.push_back(rgbaq(0xFF));
+	const uint32_t corners[][2] = {{0, 0}, {10, 10}, {10, 0}, {20, 10}, {5, 5}, {15, 15}};
+	for(const auto& [x, y] : corners)
+	{
+		overlapping.registers.push_back(MakeXYZ2(x, y));
+	}
+	EXPECT_EQ(MergeSprites(overlapping), 0);
+	EXPECT_EQ(overlapping.registers.size(), 1 + 6);
+}
+
+TEST(DecoderTests, EncodedBlockRoundTrips)
+{
+	GIFBlock block("block1");
+	block.registers.push_back(MakePrim(Triangle, true));
+	block.registers.push_back(GenReg(GifRegisters::RGBAQ));
+	block.registers.back()->Push(Vec4(1, 2, 3, 4));
+	block.registers.push_back(GenReg(GifRegisters::UV));
+	block.registers.back()->Push(Vec2(16, 32));
+	block.registers.push_back(MakeXYZ2(100, 200));
+	block.registers.push_back(std::make_unique<FINISH>());
+
+	const auto data = EncodeBlock(block);
+	GIFBlock decoded("block1");
+	DecodeTag(*reinterpret_cast<const GIFTag*>(data.data()), data.data() + 2, 0, decoded);
+
+	ASSERT_EQ(decoded.registers.size(), block.registers.size());
+	for(auto it = block.registers.begin(), dit = decoded.registers.begin(); it != block.registers.end(); ++it, ++dit)
+	{
+		EXPECT_EQ((*dit)->GetID(), (*it)->GetID());
+		EXPECT_EQ((*dit)->Encode(), (*it)->Encode());
+	}
+}
+
+TEST(DecoderTests, PrimFlagsRoundTrip)
+{
+	// STQ textured with AA1, then UV textured
+	for(const uint64_t prim : {gs::SetPRIM(3, 1, 1, 1, 0, 1, 0, 0, 0), gs::SetPRIM(6, 0, 1, 0, 0, 0, 1, 0, 0)})
+	{
+		const uint64_t data[] = {gs::SetGIFTag(1, 1, 0, 0, gs::GIF_FLG_PACKED, 1), gs::GIF_REG_AD, prim, gs::GIF_REG_PRIM};
+
+		GIFBlock block("block1");
+		DecodeTag(*reinterpret_cast<const GIFTag*>(data), data + 2, 0, block);
+		ASSERT_EQ(block.registers.size(), 1);
+		EXPECT_EQ(block.registers.front()->Encode(), prim);
+		EXPECT_EQ(dynamic_cast<PRIM&>(*block.registers.front()).IsUV(), (prim & 0x100) != 0);
+	}
+}
+
+TEST(DecoderTests, PackedRegisters)
+{
+	// PRE with a sprite, then RGBAQ, XYZ2 and a NOP per loop
+	const uint64_t data[] = {
+		gs::SetGIFTag(1, 1, 1, gs::SetPRIM(6, 0, 0, 0, 0, 0, 0, 0, 0), gs::GIF_FLG_PACKED, 3),
+		gs::GIF_REG_RGBAQ | gs::GIF_REG_XYZ2 << 4 | gs::GIF_REG_NOP << 8,
+		0x20 | 0x40ull << 32, 0x60 | 0x80ull << 32,
+		(10 << 4) | (20ull << 4) << 32, 5,
+		0, 0};
+
+	GIFBlock block("block1");
+	const GIFTag& tag = *reinterpret_cast<const GIFTag*>(data);
+	ASSERT_EQ(TagDataWords(tag), 6);
+	DecodeTag(tag, data + 2, 0, block);
+
+	ASSERT_EQ(block.registers.size(), 3);
+	auto it = block.registers.begin();
+	EXPECT_EQ(dynamic_cast<PRIM&>(**it++).GetType(), PrimType::Sprite);
+	EXPECT_EQ((*it++)->Encode(), gs::SetRGBAQ(0x20, 0x40, 0x60, 0x80, 0));
+	EXPECT_EQ((*it)->Encode(), gs::SetXYZ(10 << 4, 20 << 4, 5));
+}
+
+TEST(DecoderTests, ParallelKeepsStreamOrder)
+{
+	std::vector<uint64_t> stream;
+	std::vector<size_t> tags;
+	for(uint32_t i = 0; i < 1000; i++)
+	{
+		GIFBlock block("block");
+		block.registers.push_back(MakeXYZ2(i, i * 2));
+		const auto data = EncodeBlock(block);
+		tags.push_back(stream.size());
+		stream.insert(stream.end(), data.begin(), data.end());
+	}
+
+	std::vector<GIFBlock> blocks(tags.size());
+	ParallelDecoder decoder(4);
+	decoder.Submit(stream.data(), tags, blocks);
+	decoder.Wait();
+
+	for(uint32_t i = 0; i < tags.size(); i++)
+	{
+		EXPECT_EQ(blocks[i].name, fmt::format("block_{:x}", tags[i] * sizeof(uint64_t)));
+		ASSERT_EQ(blocks[i].registers.size(), 1);
+		EXPECT_EQ(blocks[i].registers.front()->Encode(), gs::SetXYZ(i << 4, (i * 2) << 4, 0));
+	}
+}
+
+TEST(DecoderTests, SimdKernelsMatchScalar)
+{
+	// Runs of every unpackable register with odd lengths, so the scalar tails get used too
+	const uint64_t addrs[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x05, 0x40, 0x05};
+	std::vector<uint64_t> qwords;
+	uint64_t seed = 0x9E3779B97F4A7C15;
+	for(size_t run = 0; run < std::size(addrs); run++)
+	{
+		for(size_t i = 0; i < 3 + run * 5; i++)
+		{
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			qwords.push_back(seed);
+			// Junk above the address byte is ignored
+			qwords.push_back(addrs[run] | (seed & 0xFFFFFFFFFFFF0000));
+		}
+	}
+
+	const size_t count = qwords.size() / 2;
+	for(const auto level : {simd::Level::SSE2, simd::Level::AVX2})
+	{
+		if(level > simd::Best())
+		{
+			continue;
+		}
+
+		for(size_t i = 0; i < count;)
+		{
+			const size_t run = simd::ADRunLength(qwords.data() + i * 2, count - i, simd::Level::Scalar);
+			ASSERT_EQ(simd::ADRunLength(qwords.data() + i * 2, count - i, level), run);
+
+			const uint64_t addr = qwords[i * 2 + 1] & 0xFF;
+			if(simd::CanUnpack(addr))
+			{
+				std::vector<std::array<uint32_t, 4>> expected(run), fields(run);
+				simd::UnpackAD(qwords.data() + i * 2, run, addr, reinterpret_cast<uint32_t(*)[4]>(expected.data()), simd::Level::Scalar);
+				simd::UnpackAD(qwords.data() + i * 2, run, addr, reinterpret_cast<uint32_t(*)[4]>(fields.data()), level);
+				EXPECT_EQ(fields, expected);
+			}
+			i += run;
+		}
+	}
+}
+
+TEST(DecoderTests, ADStreamMatchesPerRegisterDecode)
+{
+	GIFBlock block("block1");
+	block.registers.push_back(MakePrim(Sprite));
+	for(uint32_t i = 0; i < 37; i++)
+	{
+		block.registers.push_back(GenReg(GifRegisters::RGBAQ));
+		block.registers.back()->Push(Vec4(i, i + 1, i + 2, 0x80));
+		block.registers.push_back(GenReg(GifRegisters::UV));
+		block.registers.back()->Push(Vec2(i * 3, i * 5));
+	}
+	for(uint32_t i = 0; i < 37; i++)
+	{
+		block.registers.push_back(MakeXYZ2(i * 7, i * 9));
+	}
+
+	const auto data = EncodeBlock(block);
+	GIFBlock decoded("block1");
+	DecodeTag(*reinterpret_cast<const GIFTag*>(data.data()), data.data() + 2, 0, decoded);
+
+	ASSERT_EQ(decoded.registers.size(), block.registers.size());
+	for(auto it = block.registers.begin(), dit = decoded.registers.begin(); it != block.registers.end(); ++it, ++dit)
+	{
+		EXPECT_EQ((*dit)->GetID(), (*it)->GetID());
+		EXPECT_EQ((*dit)->Encode(), (*it)->Encode());
+	}
+}
+
+namespace
+{
+	template <typename T>
+	void Append(std::vector<uint8_t>& dump, T value)
+	{
+		const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+		dump.insert(dump.end(), bytes, bytes + sizeof(T));
+	}
+} // namespace
+
+TEST(GSDumpTests, TransfersBetweenOtherPackets)
+{
+	// New style header with a 4 byte serial after it, 16 bytes of state, the privileged registers
+	std::vector<uint8_t> dump;
+	Append<uint32_t>(dump, 0xFFFFFFFF);
+	Append<uint32_t>(dump, 12);
+	Append<uint32_t>(dump, 1);
+	Append<uint32_t>(dump, 16);
+	Append<uint32_t>(dump, 0);
+	dump.resize(dump.size() + 16 + 0x2000);
+
+	dump.push_back(0); // Transfer
+	dump.push_back(2); // PATH3
+	Append<uint32_t>(dump, 16);
+	const size_t first = dump.size();
+	dump.resize(dump.size() + 16, 0xAA);
+	dump.push_back(1); // VSync
+	dump.push_back(0);
+	dump.push_back(2); // ReadFIFO2
+	Append<uint32_t>(dump, 64);
+	dump.push_back(3); // Registers
+	dump.resize(dump.size() + 0x2000);
+	dump.push_back(0);
+	dump.push_back(1); // PATH2
+	Append<uint32_t>(dump, 32);
+	const size_t second = dump.size();
+	dump.resize(dump.size() + 32, 0xBB);
+	dump.push_back(1);
+	dump.push_back(1);
+
+	GSDump reader(dump);
+	ASSERT_TRUE(reader.TryOpen());
+
+	auto transfer = reader.Next();
+	ASSERT_TRUE(transfer.has_value());
+	EXPECT_EQ(transfer->path, GSDump::Path::Path3);
+	EXPECT_EQ(transfer->offset, first);
+	EXPECT_EQ(transfer->data.size(), 16u);
+
+	transfer = reader.Next();
+	ASSERT_TRUE(transfer.has_value());
+	EXPECT_EQ(transfer->path, GSDump::Path::Path2);
+	EXPECT_EQ(transfer->offset, second);
+	EXPECT_EQ(transfer->data[0], 0xBB);
+
+	EXPECT_FALSE(reader.Next().has_value());
+	EXPECT_FALSE(reader.Failed());
+	EXPECT_EQ(reader.Frames(), 2u);
+
+	// Cut into the middle of the second transfer
+	GSDump truncated(std::span<const uint8_t>(dump).first(second + 8));
+	ASSERT_TRUE(truncated.TryOpen());
+	EXPECT_TRUE(truncated.Next().has_value());
+	EXPECT_FALSE(truncated.Next().has_value());
+	EXPECT_TRUE(truncated.Failed());
+}
+
+TEST(CompilerTests, CompilesInMemory)
+{
+	const auto result = CompileScript("quad {\n"
+									  "\tprim sprite;\n"
+									  "\trgbaq 255,0,0;\n"
+									  "\txyz2 0,0,0;\n"
+									  "\txyz2 64,64,0;\n"
+									  "}\n",
+		{.backend = "gifscript"});
+
+	EXPECT_TRUE(result.ok);
+	EXPECT_NE(result.output.find("quad {"), std::string::npos);
+	EXPECT_NE(result.output.find("xyz2 0x40,0x40,0x0;"), std::string::npos);
+	EXPECT_TRUE(std::ranges::any_of(result.diagnostics, [](const Diagnostic& diagnostic) {
+		return diagnostic.level == logger::Level::Info && diagnostic.message == "Emitting block: quad";
+	}));
+}
+
+TEST(CompilerTests, ReportsErrorsOnTheirLine)
+{
+	const auto result = CompileScript("quad {\n"
+									  "\tprim sprite;\n"
+									  "\txyz2 0,0,0 0,0,0;\n"
+									  "}\n");
+
+	EXPECT_FALSE(result.ok);
+	EXPECT_TRUE(std::ranges::any_of(result.diagnostics, [](const Diagnostic& diagnostic) {
+		return diagnostic.level == logger::Level::Error && diagnostic.line == 3;
+	}));
+}
+
+TEST(CompilerTests, UnknownBackend)
+{
+	const auto result = CompileScript("", {.backend = "nope"});
+
+	EXPECT_FALSE(result.ok);
+	ASSERT_EQ(result.diagnostics.size(), 1);
+	EXPECT_EQ(result.diagnostics[0].level, logger::Level::Error);
+}
+
+TEST(CompilerTests, InvalidElfFlags)
+{
+	EXPECT_FALSE(CompileScript("", {.backend = "elf", .backend_args = {"--bflags=n32"}}).ok);
+	EXPECT_FALSE(CompileScript("", {.backend = "elf", .backend_args = {"--bflags=0x"}}).ok);
+	EXPECT_FALSE(CompileScript("", {.backend = "elf", .backend_args = {"--bflags=0x1ffffffff"}}).ok);
+	EXPECT_TRUE(CompileScript("", {.backend = "elf", .backend_args = {"--bflags=0x20920020"}}).ok);
+}
+
 int main(void)
 {
 	logger::g_log_enabled = false;
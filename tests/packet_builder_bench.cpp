@@ -0,0 +1,60 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#include "packet_builder.hpp"
+
+// Rebuilds a packet of gouraud triangles the way a game would every frame
+// and reports how many vertices per second PacketBuilder encodes.
+// Usage: packet_builder_bench [triangles per frame] [frames]
+int main(int argc, char** argv)
+{
+	const size_t triangles = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4096;
+	const size_t frames = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000;
+	if(triangles == 0 || frames == 0)
+	{
+		std::fprintf(stderr, "Usage: %s [triangles per frame] [frames]\n", argv[0]);
+		return 1;
+	}
+
+	// Two registers per vertex, a PRIM and the tags for every NLOOP_MAX of them
+	const size_t registers = triangles * 6;
+	const size_t qwords = registers + registers / gs::GIF_NLOOP_MAX + 2;
+	const auto buffer = std::make_unique_for_overwrite<uint64_t[]>(qwords * 2);
+
+	uint64_t checksum = 0;
+	const auto start = std::chrono::steady_clock::now();
+	for(size_t frame = 0; frame < frames; frame++)
+	{
+		PacketBuilder builder({buffer.get(), qwords * 2});
+		builder.PushPrim(gs::GS_PRIM_TRIANGLE, true);
+		for(size_t i = 0; i < triangles; i++)
+		{
+			const uint32_t x = (i * 7 + frame) % 600;
+			const uint32_t y = (i * 13 + frame) % 420;
+			builder.PushRGBAQ(i, frame, 0x80);
+			builder.PushXYZ2(x, y, 0);
+			builder.PushRGBAQ(frame, i, 0x80);
+			builder.PushXYZ2(x + 32, y, 0);
+			builder.PushRGBAQ(0x80, i, frame);
+			builder.PushXYZ2(x, y + 32, 0);
+		}
+
+		const auto packet = builder.Finish();
+		if(builder.Overflowed())
+		{
+			std::fprintf(stderr, "Packet buffer too small\n");
+			return 1;
+		}
+		// Keeps the packet from being optimised away
+		checksum += packet[packet.size() - 2];
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	const double vertices = static_cast<double>(triangles) * 3 * frames;
+	std::printf("%zu triangles x %zu frames in %.3fs\n", triangles, frames, elapsed.count());
+	std::printf("%.1f Mvertices/s (%.1f MB/s of packet, checksum %llx)\n", vertices / elapsed.count() / 1e6,
+		vertices * 2 * 16 / elapsed.count() / 1e6, static_cast<unsigned long long>(checksum));
+	return 0;
+}